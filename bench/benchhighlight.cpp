@@ -0,0 +1,339 @@
+// Benchmark of the Markdown highlighter pipeline.
+//
+// Loads a corpus of Markdown files into offscreen QTextDocuments and times
+// the three stages of a highlight separately:
+// - parse: pmh_markdown_to_elements() via PegParser;
+// - regions: PegParseResult::parse();
+// - blocks: PegHighlighterResult::parseBlocksHighlights().
+// Results are printed as JSON to stdout.
+//
+// Usage: vnote-bench-highlight [--iterations N] [--style FILE] PATH...
+// PATH could be a Markdown file or a directory to search for *.md files.
+
+#include <QApplication>
+#include <QDir>
+#include <QDirIterator>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QTextDocument>
+#include <QTextStream>
+
+#include <atomic>
+#include <new>
+#include <algorithm>
+#include <cstdlib>
+
+#if defined(Q_OS_UNIX)
+#include <sys/resource.h>
+#endif
+
+#include "pegparser.h"
+#include "peghighlighterresult.h"
+#include "vstyleparser.h"
+
+// Globals defined by main.cpp of VNote.
+class VConfigManager;
+class VPalette;
+
+VConfigManager *g_config = NULL;
+
+VPalette *g_palette = NULL;
+
+#if defined(QT_NO_DEBUG)
+QFile g_logFile;
+#endif
+
+// Count all the C++ heap allocations.
+static std::atomic<unsigned long long> s_numOfAllocs(0);
+
+void *operator new(std::size_t p_size)
+{
+    ++s_numOfAllocs;
+    void *ptr = std::malloc(p_size ? p_size : 1);
+    if (!ptr) {
+        throw std::bad_alloc();
+    }
+
+    return ptr;
+}
+
+void *operator new[](std::size_t p_size)
+{
+    return operator new(p_size);
+}
+
+void operator delete(void *p_ptr) noexcept
+{
+    std::free(p_ptr);
+}
+
+void operator delete[](void *p_ptr) noexcept
+{
+    std::free(p_ptr);
+}
+
+void operator delete(void *p_ptr, std::size_t) noexcept
+{
+    std::free(p_ptr);
+}
+
+void operator delete[](void *p_ptr, std::size_t) noexcept
+{
+    std::free(p_ptr);
+}
+
+// Same extensions as PegMarkdownHighlighter with MathJax enabled.
+static const int c_extensions = pmh_EXT_NOTES
+                                | pmh_EXT_STRIKE
+                                | pmh_EXT_FRONTMATTER
+                                | pmh_EXT_MARK
+                                | pmh_EXT_TABLE
+                                | pmh_EXT_MATH
+                                | pmh_EXT_MATH_RAW;
+
+struct StageStats
+{
+    StageStats()
+        : m_allocs(0)
+    {
+    }
+
+    void add(qint64 p_ns, unsigned long long p_allocs)
+    {
+        m_samples.append(p_ns);
+        m_allocs += p_allocs;
+    }
+
+    QJsonObject toJson() const
+    {
+        QVector<qint64> samples(m_samples);
+        std::sort(samples.begin(), samples.end());
+
+        QJsonObject obj;
+        obj["p50_ms"] = percentile(samples, 50) / 1e6;
+        obj["p99_ms"] = percentile(samples, 99) / 1e6;
+        obj["max_ms"] = samples.isEmpty() ? 0 : samples.last() / 1e6;
+        obj["allocs_per_run"] = samples.isEmpty() ? 0.0 : double(m_allocs) / samples.size();
+        return obj;
+    }
+
+    static qint64 percentile(const QVector<qint64> &p_sorted, int p_pct)
+    {
+        if (p_sorted.isEmpty()) {
+            return 0;
+        }
+
+        int idx = (p_sorted.size() * p_pct + 99) / 100 - 1;
+        return p_sorted[qBound(0, idx, p_sorted.size() - 1)];
+    }
+
+    QVector<qint64> m_samples;
+
+    unsigned long long m_allocs;
+};
+
+struct FileStats
+{
+    FileStats()
+        : m_size(0),
+          m_numOfBlocks(0),
+          m_pmhAllocs(0),
+          m_pmhBytes(0)
+    {
+    }
+
+    QString m_path;
+
+    int m_size;
+
+    int m_numOfBlocks;
+
+    StageStats m_parse;
+
+    StageStats m_regions;
+
+    StageStats m_blocks;
+
+    // Allocations and bytes of the pmh arena of the last run.
+    size_t m_pmhAllocs;
+
+    size_t m_pmhBytes;
+
+    QJsonObject toJson() const
+    {
+        QJsonObject obj;
+        obj["file"] = m_path;
+        obj["bytes"] = m_size;
+        obj["blocks"] = m_numOfBlocks;
+        obj["parse"] = m_parse.toJson();
+        obj["regions"] = m_regions.toJson();
+        obj["blocks_highlights"] = m_blocks.toJson();
+        obj["pmh_arena_allocs"] = double(m_pmhAllocs);
+        obj["pmh_arena_bytes"] = double(m_pmhBytes);
+        return obj;
+    }
+};
+
+static qint64 peakRssKB()
+{
+#if defined(Q_OS_UNIX)
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0) {
+#if defined(Q_OS_MACOS)
+        // In bytes on macOS.
+        return usage.ru_maxrss / 1024;
+#else
+        return usage.ru_maxrss;
+#endif
+    }
+#endif
+
+    return -1;
+}
+
+static QStringList collectFiles(const QStringList &p_paths)
+{
+    QStringList files;
+    for (const auto &path : p_paths) {
+        QFileInfo info(path);
+        if (info.isDir()) {
+            QDirIterator it(path,
+                            QStringList() << "*.md" << "*.markdown",
+                            QDir::Files,
+                            QDirIterator::Subdirectories);
+            QStringList dirFiles;
+            while (it.hasNext()) {
+                dirFiles << it.next();
+            }
+
+            dirFiles.sort();
+            files << dirFiles;
+        } else if (info.isFile()) {
+            files << path;
+        } else {
+            QTextStream(stderr) << "skip invalid path " << path << "\n";
+        }
+    }
+
+    return files;
+}
+
+static QVector<HighlightingStyle> loadStyles(const QString &p_file)
+{
+    QFile file(p_file);
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+        QTextStream(stderr) << "fail to open style file " << p_file << "\n";
+        return QVector<HighlightingStyle>();
+    }
+
+    VStyleParser parser;
+    parser.parseMarkdownStyle(QString::fromUtf8(file.readAll()));
+    return parser.fetchMarkdownStyles(QFont());
+}
+
+static FileStats benchFile(const QString &p_file,
+                           const QVector<HighlightingStyle> &p_styles,
+                           int p_iterations)
+{
+    FileStats stats;
+    stats.m_path = p_file;
+
+    QFile file(p_file);
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+        QTextStream(stderr) << "fail to open " << p_file << "\n";
+        return stats;
+    }
+
+    QTextDocument doc;
+    doc.setPlainText(QString::fromUtf8(file.readAll()));
+
+    QSharedPointer<PegParseConfig> config(new PegParseConfig());
+    config->m_timeStamp = 1;
+    config->m_data = doc.toPlainText().toUtf8();
+    config->m_numOfBlocks = doc.blockCount();
+    config->m_extensions = c_extensions;
+
+    stats.m_size = config->m_data.size();
+    stats.m_numOfBlocks = config->m_numOfBlocks;
+
+    QElapsedTimer timer;
+    QAtomicInt stop(0);
+    for (int i = 0; i < p_iterations; ++i) {
+        QSharedPointer<PegParseResult> result(new PegParseResult(config));
+
+        unsigned long long allocs = s_numOfAllocs.load();
+        timer.start();
+        result->m_pmhElements = PegParser::parseMarkdownToElements(config);
+        stats.m_parse.add(timer.nsecsElapsed(), s_numOfAllocs.load() - allocs);
+
+        if (result->m_pmhElements) {
+            pmh_get_alloc_stats(result->m_pmhElements, &stats.m_pmhAllocs, &stats.m_pmhBytes);
+        }
+
+        allocs = s_numOfAllocs.load();
+        timer.start();
+        result->parse(stop, false);
+        stats.m_regions.add(timer.nsecsElapsed(), s_numOfAllocs.load() - allocs);
+
+        BlockHighlights<HLUnit> blocksHighlights;
+        allocs = s_numOfAllocs.load();
+        timer.start();
+        PegHighlighterResult::parseBlocksHighlights(blocksHighlights, &doc, p_styles, result);
+        stats.m_blocks.add(timer.nsecsElapsed(), s_numOfAllocs.load() - allocs);
+    }
+
+    return stats;
+}
+
+int main(int argc, char *argv[])
+{
+    // Run headless unless told otherwise.
+    if (qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM")) {
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+    }
+
+    QApplication app(argc, argv);
+
+    int iterations = 10;
+    QString styleFile(":/resources/themes/v_pure/v_pure.mdhl");
+    QStringList paths;
+
+    QStringList args = app.arguments();
+    for (int i = 1; i < args.size(); ++i) {
+        if (args[i] == "--iterations" && i + 1 < args.size()) {
+            iterations = qMax(1, args[++i].toInt());
+        } else if (args[i] == "--style" && i + 1 < args.size()) {
+            styleFile = args[++i];
+        } else {
+            paths << args[i];
+        }
+    }
+
+    QStringList files = collectFiles(paths);
+    if (files.isEmpty()) {
+        QTextStream(stderr) << "usage: vnote-bench-highlight [--iterations N] [--style FILE] PATH...\n";
+        return 1;
+    }
+
+    QVector<HighlightingStyle> styles = loadStyles(styleFile);
+    if (styles.isEmpty()) {
+        return 1;
+    }
+
+    QJsonArray filesJson;
+    for (const auto &file : files) {
+        filesJson.append(benchFile(file, styles, iterations).toJson());
+    }
+
+    QJsonObject obj;
+    obj["iterations"] = iterations;
+    obj["files"] = filesJson;
+    obj["peak_rss_kb"] = double(peakRssKB());
+
+    QTextStream(stdout) << QJsonDocument(obj).toJson();
+    return 0;
+}
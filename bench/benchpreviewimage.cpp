@@ -0,0 +1,236 @@
+// Benchmark of loading images to preview via VPreviewManager::loadPreviewImage().
+//
+// Loads each image twice with the thumbnail cache in a temporary folder:
+// - cold: the original image is decoded, scaled and saved to the cache;
+// - warm: the preview-sized bitmap is loaded from the cache.
+// The warm load of an image scaled down to preview should not decode the
+// original image; the exit code is 2 if any does.
+// Results are printed as JSON to stdout.
+//
+// Usage: vnote-bench-preview-image [--iterations N] [--width N] [--height N]
+//                                  [--max-width N] [PATH...]
+// Without PATH, an image of --width x --height is generated to load.
+
+#include <QApplication>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QImage>
+#include <QImageReader>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QLinearGradient>
+#include <QPainter>
+#include <QTemporaryDir>
+#include <QTextStream>
+
+#include "vpreviewmanager.h"
+#include "vthumbnailcache.h"
+
+// Globals defined by main.cpp of VNote.
+class VConfigManager;
+class VPalette;
+
+VConfigManager *g_config = NULL;
+
+VPalette *g_palette = NULL;
+
+#if defined(QT_NO_DEBUG)
+QFile g_logFile;
+#endif
+
+// Generate a PNG file of @p_width x @p_height in @p_folder.
+static QString generateImage(const QString &p_folder, int p_width, int p_height)
+{
+    QImage image(p_width, p_height, QImage::Format_RGB32);
+    QPainter painter(&image);
+    QLinearGradient gradient(0, 0, p_width, p_height);
+    gradient.setColorAt(0, Qt::darkBlue);
+    gradient.setColorAt(1, Qt::yellow);
+    painter.fillRect(image.rect(), gradient);
+    painter.end();
+
+    QString path = p_folder + "/bench.png";
+    if (!image.save(path)) {
+        QTextStream(stderr) << "fail to generate image " << path << "\n";
+        return QString();
+    }
+
+    return path;
+}
+
+struct FileStats
+{
+    FileStats()
+        : m_coldNs(0),
+          m_coldDecodes(0),
+          m_warmNs(0),
+          m_warmDecodes(0),
+          m_runs(0)
+    {
+    }
+
+    QJsonObject toJson() const
+    {
+        QJsonObject obj;
+        obj["file"] = m_path;
+        obj["original_size"] = QString("%1x%2").arg(m_originalSize.width())
+                                               .arg(m_originalSize.height());
+        obj["preview_size"] = QString("%1x%2").arg(m_previewSize.width())
+                                              .arg(m_previewSize.height());
+        obj["cold_ms"] = m_runs ? m_coldNs / 1e6 / m_runs : 0.0;
+        obj["warm_ms"] = m_runs ? m_warmNs / 1e6 / m_runs : 0.0;
+        obj["cold_decodes"] = m_coldDecodes;
+        obj["warm_decodes"] = m_warmDecodes;
+        return obj;
+    }
+
+    QString m_path;
+
+    QSize m_originalSize;
+
+    QSize m_previewSize;
+
+    qint64 m_coldNs;
+
+    int m_coldDecodes;
+
+    qint64 m_warmNs;
+
+    int m_warmDecodes;
+
+    int m_runs;
+};
+
+static FileStats benchFile(const QString &p_file,
+                           const QString &p_cacheFolder,
+                           int p_maxWidth,
+                           int p_iterations)
+{
+    FileStats stats;
+    stats.m_path = p_file;
+    stats.m_originalSize = QImageReader(p_file).size();
+
+    QElapsedTimer timer;
+    for (int i = 0; i < p_iterations; ++i) {
+        // Start from an empty cache each time.
+        QDir(p_cacheFolder).removeRecursively();
+        VThumbnailCache::init(p_cacheFolder, 100 * 1024 * 1024);
+
+        QString key = VThumbnailCache::key(p_file, -1, -1, 1, p_maxWidth);
+
+        bool decoded = false;
+        timer.start();
+        QImage image = VPreviewManager::loadPreviewImage(p_file,
+                                                         QByteArray(),
+                                                         -1,
+                                                         -1,
+                                                         1,
+                                                         p_maxWidth,
+                                                         key,
+                                                         &decoded);
+        stats.m_coldNs += timer.nsecsElapsed();
+        stats.m_coldDecodes += decoded ? 1 : 0;
+        stats.m_previewSize = image.size();
+
+        timer.start();
+        image = VPreviewManager::loadPreviewImage(p_file,
+                                                  QByteArray(),
+                                                  -1,
+                                                  -1,
+                                                  1,
+                                                  p_maxWidth,
+                                                  key,
+                                                  &decoded);
+        stats.m_warmNs += timer.nsecsElapsed();
+        stats.m_warmDecodes += decoded ? 1 : 0;
+
+        if (image.size() != stats.m_previewSize) {
+            QTextStream(stderr) << "cached image of " << p_file << " differs in size\n";
+        }
+
+        ++stats.m_runs;
+    }
+
+    return stats;
+}
+
+int main(int argc, char *argv[])
+{
+    // Run headless unless told otherwise.
+    if (qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM")) {
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+    }
+
+    QApplication app(argc, argv);
+
+    int iterations = 5;
+    int width = 6000;
+    int height = 4000;
+    int maxWidth = 1920;
+    QStringList paths;
+
+    QStringList args = app.arguments();
+    for (int i = 1; i < args.size(); ++i) {
+        if (args[i] == "--iterations" && i + 1 < args.size()) {
+            iterations = qMax(1, args[++i].toInt());
+        } else if (args[i] == "--width" && i + 1 < args.size()) {
+            width = qMax(1, args[++i].toInt());
+        } else if (args[i] == "--height" && i + 1 < args.size()) {
+            height = qMax(1, args[++i].toInt());
+        } else if (args[i] == "--max-width" && i + 1 < args.size()) {
+            maxWidth = qMax(0, args[++i].toInt());
+        } else {
+            paths << args[i];
+        }
+    }
+
+    QTemporaryDir tmpDir;
+    if (!tmpDir.isValid()) {
+        QTextStream(stderr) << "fail to create temporary folder\n";
+        return 1;
+    }
+
+    if (paths.isEmpty()) {
+        QString path = generateImage(tmpDir.path(), width, height);
+        if (path.isEmpty()) {
+            return 1;
+        }
+
+        paths << path;
+    }
+
+    QString cacheFolder = tmpDir.path() + "/thumbnails";
+    int warmDecodes = 0;
+    QJsonArray filesJson;
+    for (const auto &path : paths) {
+        if (!QFileInfo(path).isFile()) {
+            QTextStream(stderr) << "skip invalid path " << path << "\n";
+            continue;
+        }
+
+        FileStats stats = benchFile(path, cacheFolder, maxWidth, iterations);
+        // Images not scaled down are not cached on disk.
+        if (stats.m_previewSize != stats.m_originalSize) {
+            warmDecodes += stats.m_warmDecodes;
+        }
+
+        filesJson.append(stats.toJson());
+    }
+
+    QJsonObject obj;
+    obj["iterations"] = iterations;
+    obj["max_width"] = maxWidth;
+    obj["files"] = filesJson;
+
+    QTextStream(stdout) << QJsonDocument(obj).toJson();
+
+    if (warmDecodes > 0) {
+        QTextStream(stderr) << "warm loads decoded the original images " << warmDecodes << " times\n";
+        return 2;
+    }
+
+    return 0;
+}
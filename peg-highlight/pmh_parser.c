@@ -26,6 +26,7 @@ struct _GREG;
  * from the PEG grammar.
  */
 
+#include <stddef.h>
 #include "pmh_parser.h"
 
 #ifndef pmh_DEBUG_OUTPUT
@@ -50,9 +51,116 @@ struct _GREG;
 #endif
 
 
-char *strdup_or_null(char *s)
+// Bump allocator owning all the memory allocated while parsing one input,
+// so that the whole element graph can be released with one call.
+typedef struct pmh_ArenaChunk
 {
-    return (s == NULL) ? NULL : strdup(s);
+    struct pmh_ArenaChunk *prev;
+    size_t size;
+    size_t used;
+} pmh_arena_chunk;
+
+typedef struct
+{
+    // Current chunk to allocate from; previous chunks are linked by `prev`:
+    pmh_arena_chunk *chunk;
+    
+    // Statistics:
+    size_t num_allocs;
+    size_t num_chunks;
+    size_t num_bytes;
+} pmh_arena;
+
+#define pmh_ARENA_CHUNK_SIZE    (64 * 1024)
+#define pmh_ARENA_ALIGN(x)      (((x) + 2 * sizeof(void *) - 1) \
+                                 & ~(2 * sizeof(void *) - 1))
+#define pmh_ARENA_CHUNK_DATA(c) ((char *)(c) + pmh_ARENA_ALIGN(sizeof(pmh_arena_chunk)))
+
+static void *arena_alloc(pmh_arena *arena, size_t size)
+{
+    size = pmh_ARENA_ALIGN(size);
+    arena->num_allocs++;
+    
+    pmh_arena_chunk *chunk = arena->chunk;
+    if (chunk != NULL && chunk->size - chunk->used >= size)
+    {
+        void *ret = pmh_ARENA_CHUNK_DATA(chunk) + chunk->used;
+        chunk->used += size;
+        return ret;
+    }
+    
+    // Large allocations get a chunk of their own behind the current one,
+    // so that the free space of the current chunk is not wasted:
+    bool dedicated = (size > pmh_ARENA_CHUNK_SIZE / 4);
+    size_t chunk_size = dedicated ? size : pmh_ARENA_CHUNK_SIZE;
+    pmh_arena_chunk *new_chunk = (pmh_arena_chunk *)
+        malloc(pmh_ARENA_ALIGN(sizeof(pmh_arena_chunk)) + chunk_size);
+    new_chunk->size = chunk_size;
+    new_chunk->used = size;
+    arena->num_chunks++;
+    arena->num_bytes += chunk_size;
+    
+    if (dedicated && chunk != NULL) {
+        new_chunk->prev = chunk->prev;
+        chunk->prev = new_chunk;
+    } else {
+        new_chunk->prev = chunk;
+        arena->chunk = new_chunk;
+    }
+    
+    return pmh_ARENA_CHUNK_DATA(new_chunk);
+}
+
+static void *arena_calloc(pmh_arena *arena, size_t num, size_t size)
+{
+    void *ret = arena_alloc(arena, num * size);
+    memset(ret, 0, num * size);
+    return ret;
+}
+
+// Allocation which remembers its size so that it can be reallocated:
+static void *arena_alloc_sized(pmh_arena *arena, size_t size)
+{
+    size_t *ret = (size_t *)arena_alloc(arena, pmh_ARENA_ALIGN(sizeof(size_t)) + size);
+    *ret = size;
+    return (char *)ret + pmh_ARENA_ALIGN(sizeof(size_t));
+}
+
+static void *arena_realloc_sized(pmh_arena *arena, void *ptr, size_t size)
+{
+    if (ptr == NULL)
+        return arena_alloc_sized(arena, size);
+    
+    size_t old_size = *(size_t *)((char *)ptr - pmh_ARENA_ALIGN(sizeof(size_t)));
+    if (old_size >= size)
+        return ptr;
+    
+    // The old block is released together with the arena:
+    void *ret = arena_alloc_sized(arena, size);
+    memcpy(ret, ptr, old_size);
+    return ret;
+}
+
+static char *arena_strdup(pmh_arena *arena, const char *s)
+{
+    if (s == NULL)
+        return NULL;
+    
+    size_t len = strlen(s);
+    char *ret = (char *)arena_alloc(arena, len + 1);
+    memcpy(ret, s, len + 1);
+    return ret;
+}
+
+static void arena_free(pmh_arena *arena)
+{
+    pmh_arena_chunk *chunk = arena->chunk;
+    while (chunk != NULL) {
+        pmh_arena_chunk *prev = chunk->prev;
+        free(chunk);
+        chunk = prev;
+    }
+    arena->chunk = NULL;
 }
 
 
@@ -88,6 +196,21 @@ struct pmh_RealElement
 };
 typedef struct pmh_RealElement pmh_realelement;
 
+// Number of input characters to read between two cancellation checks:
+#define pmh_CANCEL_CHECK_INTERVAL 4096
+
+// Cancellation state shared by all parsing runs of one parse:
+typedef struct
+{
+    pmh_cancel_callback callback;
+    void *context;
+    
+    /* Characters left to read until the next check: */
+    int countdown;
+    
+    bool cancelled;
+} pmh_cancel_state;
+
 
 
 
@@ -124,8 +247,27 @@ typedef struct
     
     /* List of reference elements: */
     pmh_realelement *references;
+    
+    /* Allocator of all the elements and strings: */
+    pmh_arena *arena;
+    
+    /* Parser state kept to be reused by the next parsing run: */
+    struct _GREG *spare_greg;
+    
+    /* Cancellation state, or NULL if the parse is not cancellable: */
+    pmh_cancel_state *cancel;
 } parser_data;
 
+// The result of one parse. pmh_markdown_to_elements() returns `elems`.
+typedef struct
+{
+    pmh_arena arena;
+    pmh_realelement *elems[pmh_NUM_TYPES];
+} pmh_result;
+
+#define pmh_RESULT_FROM_ELEMS(x) \
+    ((pmh_result *)((char *)(x) - offsetof(pmh_result, elems)))
+
 static parser_data *mk_parser_data(char *original_input,
                                    unsigned long *strip_positions,
                                    size_t strip_positions_len,
@@ -134,9 +276,13 @@ static parser_data *mk_parser_data(char *original_input,
                                    unsigned long offset,
                                    int extensions,
                                    pmh_realelement **head_elems,
-                                   pmh_realelement *references)
+                                   pmh_realelement *references,
+                                   pmh_arena *arena)
 {
-    parser_data *p_data = (parser_data *)malloc(sizeof(parser_data));
+    parser_data *p_data = (parser_data *)arena_alloc(arena, sizeof(parser_data));
+    p_data->arena = arena;
+    p_data->spare_greg = NULL;
+    p_data->cancel = NULL;
     p_data->extensions = extensions;
     p_data->original_input = original_input;
     p_data->strip_positions = strip_positions;
@@ -146,19 +292,30 @@ static parser_data *mk_parser_data(char *original_input,
     p_data->elem_head = p_data->current_elem = parsing_elems;
     p_data->references = references;
     p_data->parsing_only_references = false;
-    if (head_elems != NULL)
-        p_data->head_elems = head_elems;
-    else {
-        p_data->head_elems = (pmh_realelement **)
-                             malloc(sizeof(pmh_realelement *) * pmh_NUM_TYPES);
-        int i;
-        for (i = 0; i < pmh_NUM_TYPES; i++)
-            p_data->head_elems[i] = NULL;
-    }
+    p_data->head_elems = head_elems;
     return p_data;
 }
 
 
+static bool is_cancelled(parser_data *p_data)
+{
+    pmh_cancel_state *cancel = p_data->cancel;
+    if (cancel == NULL)
+        return false;
+    if (!cancel->cancelled && --cancel->countdown <= 0)
+    {
+        cancel->countdown = pmh_CANCEL_CHECK_INTERVAL;
+        cancel->cancelled = cancel->callback(cancel->context);
+    }
+    return cancel->cancelled;
+}
+
+static bool was_cancelled(parser_data *p_data)
+{
+    return p_data->cancel != NULL && p_data->cancel->cancelled;
+}
+
+
 // Forward declarations
 static void parse_markdown(parser_data *p_data);
 static void parse_references(parser_data *p_data);
@@ -322,6 +479,9 @@ static void process_raw_blocks(parser_data *p_data)
     pmh_PRINTF("--------process_raw_blocks---------\n");
     while (p_data->head_elems[pmh_RAW_LIST] != NULL)
     {
+        if (was_cancelled(p_data))
+            return;
+        
         pmh_PRINTF("new iteration.\n");
         pmh_realelement *cursor = p_data->head_elems[pmh_RAW_LIST];
         p_data->head_elems[pmh_RAW_LIST] = NULL;
@@ -377,12 +537,18 @@ static void process_raw_blocks(parser_data *p_data)
                     subspan_list->pos,
                     p_data->extensions,
                     p_data->head_elems,
-                    p_data->references
+                    p_data->references,
+                    p_data->arena
                 );
+                raw_p_data->spare_greg = p_data->spare_greg;
+                raw_p_data->cancel = p_data->cancel;
                 parse_markdown(raw_p_data);
-                free(raw_p_data);
+                p_data->spare_greg = raw_p_data->spare_greg;
                 
                 pmh_PRINTF("parse over\n");
+                
+                if (was_cancelled(raw_p_data))
+                    return;
             }
             
             cursor = cursor->next;
@@ -411,21 +577,17 @@ static void print_raw_blocks(char *text, pmh_realelement *elem[])
 /* Free all elements created while parsing */
 void pmh_free_elements(pmh_element **elems)
 {
-    pmh_realelement *cursor = (pmh_realelement*)elems[pmh_ALL];
-    while (cursor != NULL) {
-        pmh_realelement *tofree = cursor;
-        cursor = cursor->all_elems_next;
-        if (tofree->text != NULL)
-            free(tofree->text);
-        if (tofree->label != NULL)
-            free(tofree->label);
-        if (tofree->address != NULL)
-            free(tofree->address);
-        free(tofree);
-    }
-    elems[pmh_ALL] = NULL;
-    
-    free(elems);
+    pmh_result *result = pmh_RESULT_FROM_ELEMS(elems);
+    arena_free(&result->arena);
+    free(result);
+}
+
+void pmh_get_alloc_stats(pmh_element **elems, size_t *out_num_allocs,
+                         size_t *out_num_bytes)
+{
+    pmh_result *result = pmh_RESULT_FROM_ELEMS(elems);
+    *out_num_allocs = result->arena.num_allocs;
+    *out_num_bytes = result->arena.num_bytes;
 }
 
 
@@ -507,6 +669,15 @@ static int strcpy_preformat(char *str, char **out,
 
 void pmh_markdown_to_elements(char *text, int extensions,
                               pmh_element **out_result[])
+{
+    pmh_markdown_to_elements_cancellable(text, extensions, NULL, NULL,
+                                         out_result);
+}
+
+bool pmh_markdown_to_elements_cancellable(char *text, int extensions,
+                                          pmh_cancel_callback cancel_callback,
+                                          void *cancel_context,
+                                          pmh_element **out_result[])
 {
     char *text_copy = NULL;
     unsigned long *strip_positions = NULL;
@@ -514,8 +685,11 @@ void pmh_markdown_to_elements(char *text, int extensions,
     int text_copy_len = strcpy_preformat(text, &text_copy, &strip_positions,
                                          &strip_positions_len);
     
+    pmh_result *result = (pmh_result *)calloc(1, sizeof(pmh_result));
+    
     pmh_realelement *parsing_elem = (pmh_realelement *)
-                                    malloc(sizeof(pmh_realelement));
+                                    arena_alloc(&result->arena,
+                                                sizeof(pmh_realelement));
     parsing_elem->type = pmh_RAW;
     parsing_elem->pos = 0;
     parsing_elem->end = text_copy_len;
@@ -529,16 +703,29 @@ void pmh_markdown_to_elements(char *text, int extensions,
         parsing_elem,
         0,
         extensions,
+        result->elems,
         NULL,
-        NULL
+        &result->arena
     );
-    pmh_realelement **result = p_data->head_elems;
     
-    if (*text_copy != '\0')
+    pmh_cancel_state cancel;
+    if (cancel_callback != NULL)
+    {
+        cancel.callback = cancel_callback;
+        cancel.context = cancel_context;
+        cancel.countdown = 0;
+        cancel.cancelled = false;
+        p_data->cancel = &cancel;
+    }
+    
+    if (*text_copy != '\0' && !is_cancelled(p_data))
     {
         // Get reference definitions into p_data->references
         parse_references(p_data);
-        
+    }
+    
+    if (*text_copy != '\0' && !was_cancelled(p_data))
+    {
         // Reset parser state to beginning of input
         p_data->offset = 0;
         p_data->current_elem = p_data->elem_head;
@@ -547,18 +734,25 @@ void pmh_markdown_to_elements(char *text, int extensions,
         parse_markdown(p_data);
         
         #if pmh_DEBUG_OUTPUT
-        print_raw_blocks(text_copy, result);
+        print_raw_blocks(text_copy, result->elems);
         #endif
         
         process_raw_blocks(p_data);
     }
     
     free(strip_positions);
-    free(p_data);
-    free(parsing_elem);
     free(text_copy);
     
-    *out_result = (pmh_element**)result;
+    // Partial results of a cancelled parse are useless:
+    if (was_cancelled(p_data))
+    {
+        pmh_free_elements((pmh_element **)result->elems);
+        *out_result = NULL;
+        return false;
+    }
+    
+    *out_result = (pmh_element**)result->elems;
+    return true;
 }
 
 
@@ -715,8 +909,8 @@ static pmh_realelement *reverse(pmh_realelement *list)
 static pmh_realelement *mk_element(parser_data *p_data, pmh_element_type type,
                                    long pos, long end)
 {
-    pmh_realelement *result = (pmh_realelement *)malloc(sizeof(pmh_realelement));
-    memset(result, 0, sizeof(*result));
+    pmh_realelement *result = (pmh_realelement *)
+                              arena_calloc(p_data->arena, 1, sizeof(pmh_realelement));
     result->type = type;
     result->pos = pos;
     result->end = end;
@@ -733,9 +927,9 @@ static pmh_realelement *mk_element(parser_data *p_data, pmh_element_type type,
 static pmh_realelement *copy_element(parser_data *p_data, pmh_realelement *elem)
 {
     pmh_realelement *result = mk_element(p_data, elem->type, elem->pos, elem->end);
-    result->label = strdup_or_null(elem->label);
-    result->text = strdup_or_null(elem->text);
-    result->address = strdup_or_null(elem->address);
+    result->label = arena_strdup(p_data->arena, elem->label);
+    result->text = arena_strdup(p_data->arena, elem->text);
+    result->address = arena_strdup(p_data->arena, elem->address);
     return result;
 }
 
@@ -745,7 +939,7 @@ static pmh_realelement *mk_etext(parser_data *p_data, char *string)
     pmh_realelement *result;
     assert(string != NULL);
     result = mk_element(p_data, pmh_EXTRA_TEXT, 0,0);
-    result->text = strdup_or_null(string);
+    result->text = arena_strdup(p_data->arena, string);
     return result;
 }
 
@@ -925,7 +1119,8 @@ static char *copy_input_span(parser_data *p_data,
         
         // Copy span from original input:
         size_t adjusted_len = adjusted_end - adjusted_pos;
-        char *str = (char *)malloc(sizeof(char)*adjusted_len + 1);
+        char *str = (char *)arena_alloc(p_data->arena,
+                                        sizeof(char)*adjusted_len + 1);
         *str = '\0';
         strncat(str, (p_data->original_input + adjusted_pos), adjusted_len);
         
@@ -934,13 +1129,11 @@ static char *copy_input_span(parser_data *p_data,
         else
         {
             // append str to ret:
-            char *new_ret = (char *)malloc(sizeof(char)
-                                           *(strlen(str) + strlen(ret)) + 1);
+            char *new_ret = (char *)arena_alloc(p_data->arena, sizeof(char)
+                                                *(strlen(str) + strlen(ret)) + 1);
             *new_ret = '\0';
             strcat(new_ret, ret);
             strcat(new_ret, str);
-            free(ret);
-            free(str);
             ret = new_ret;
         }
         
@@ -965,7 +1158,8 @@ static char *copy_input_span(parser_data *p_data,
 static void yy_input_func(char *buf, int *result, int max_size,
                           parser_data *p_data)
 {
-    if (p_data->current_elem == NULL)
+    // Feed EOF to let the parser bail out quickly once cancelled:
+    if (p_data->current_elem == NULL || is_cancelled(p_data))
     {
         (*result) = 0;
         return;
@@ -1023,8 +1217,10 @@ static void yy_input_func(char *buf, int *result, int max_size,
 #define REF_EXISTS(x) reference_exists((parser_data *)G->data, x)
 #define GET_REF(x)  get_reference((parser_data *)G->data, x)
 #define PARSING_REFERENCES ((parser_data *)G->data)->parsing_only_references
-#define FREE_LABEL(l) { free(l->label); l->label = NULL; }
-#define FREE_ADDRESS(l) { free(l->address); l->address = NULL; }
+#define STRDUP(x)   arena_strdup(((parser_data *)G->data)->arena, x)
+// Strings are released together with the arena:
+#define FREE_LABEL(l) { l->label = NULL; }
+#define FREE_ADDRESS(l) { l->address = NULL; }
 
 // This gives us the text matched with < > as it appears in the original input:
 #define COPY_YYTEXT_ORIG() copy_input_span((parser_data *)G->data, thunk->begin, thunk->end)
@@ -1087,6 +1283,12 @@ bool nested_dfr()
 }
 
 
+// Parser buffers come from the arena, too:
+#define YY_ALLOC(N, D)      arena_alloc_sized(((parser_data *)(D))->arena, N)
+#define YY_CALLOC(N, S, D)  arena_calloc(((parser_data *)(D))->arena, N, S)
+#define YY_REALLOC(B, N, D) arena_realloc_sized(((parser_data *)(D))->arena, B, N)
+#define YY_FREE(B)
+
 #ifndef YY_ALLOC
 #define YY_ALLOC(N, D) malloc(N)
 #endif
@@ -1731,8 +1933,8 @@ YY_ACTION(void) yy_1_Reference(GREG *G, char *yytext, int yyleng, yythunk *thunk
   yyprintf((stderr, "do yy_1_Reference\n"));
   
                 pmh_realelement *el = elem_s(pmh_REFERENCE);
-                el->label = strdup_or_null(l->label);
-                el->address = strdup_or_null(r->address);
+                el->label = STRDUP(l->label);
+                el->address = STRDUP(r->address);
                 ADD(el);
                 FREE_LABEL(l);
                 FREE_ADDRESS(r);
@@ -1812,7 +2014,7 @@ YY_ACTION(void) yy_1_ExplicitLinkSize(GREG *G, char *yytext, int yyleng, yythunk
   
                         yy = elem_s(pmh_LINK);
                         if (l->address != NULL)
-                            yy->address = strdup_or_null(l->address);
+                            yy->address = STRDUP(l->address);
                         FREE_LABEL(s);
                         FREE_ADDRESS(l);
                     ;
@@ -1827,7 +2029,7 @@ YY_ACTION(void) yy_1_ExplicitLink(GREG *G, char *yytext, int yyleng, yythunk *th
   
                     yy = elem_s(pmh_LINK);
                     if (l->address != NULL)
-                        yy->address = strdup_or_null(l->address);
+                        yy->address = STRDUP(l->address);
                     FREE_LABEL(s);
                     FREE_ADDRESS(l);
                 ;
@@ -1842,8 +2044,8 @@ YY_ACTION(void) yy_1_ReferenceLinkSingle(GREG *G, char *yytext, int yyleng, yyth
                         	pmh_realelement *reference = GET_REF(s->label);
                             if (reference) {
                                 yy = elem_s(pmh_LINK);
-                                yy->label = strdup_or_null(s->label);
-                                yy->address = strdup_or_null(reference->address);
+                                yy->label = STRDUP(s->label);
+                                yy->address = STRDUP(reference->address);
                             } else
                                 yy = NULL;
                             FREE_LABEL(s);
@@ -1859,8 +2061,8 @@ YY_ACTION(void) yy_1_ReferenceLinkDouble(GREG *G, char *yytext, int yyleng, yyth
                         	pmh_realelement *reference = GET_REF(l->label);
                             if (reference) {
                                 yy = elem_s(pmh_LINK);
-                                yy->label = strdup_or_null(l->label);
-                                yy->address = strdup_or_null(reference->address);
+                                yy->label = STRDUP(l->label);
+                                yy->address = STRDUP(reference->address);
                             } else
                                 yy = NULL;
                             FREE_LABEL(s);
@@ -7435,7 +7637,7 @@ YY_PARSE(int) YY_NAME(parse)(GREG *G)
 
 YY_PARSE(GREG *) YY_NAME(parse_new)(YY_XTYPE data)
 {
-  GREG *G = (GREG *)YY_CALLOC(1, sizeof(GREG), G->data);
+  GREG *G = (GREG *)YY_CALLOC(1, sizeof(GREG), data);
   G->data = data;
   return G;
 }
@@ -7467,12 +7669,22 @@ YY_PARSE(void) YY_NAME(parse_free)(GREG *G)
 
 static void _parse(parser_data *p_data, yyrule start_rule)
 {
-    GREG *g = YY_NAME(parse_new)(p_data);
+    // Reuse the state and buffers of previous parsing run:
+    GREG *g = p_data->spare_greg;
+    p_data->spare_greg = NULL;
+    if (g == NULL)
+        g = YY_NAME(parse_new)(p_data);
+    else {
+        g->data = p_data;
+        g->limit = g->offset = 0;
+    }
+    
     if (start_rule == NULL)
         YY_NAME(parse)(g);
     else
         YY_NAME(parse_from)(g, start_rule);
-    YY_NAME(parse_free)(g);
+    
+    p_data->spare_greg = g;
     
     pmh_PRINTF("\n\n");
 }
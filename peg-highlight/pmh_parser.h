@@ -41,6 +41,40 @@
 void pmh_markdown_to_elements(char *text, int extensions,
                               pmh_element **out_result[]);
 
+/**
+* \brief Callback polled by a cancellable parse
+* 
+* \param[in]  context  The context passed to
+*                      pmh_markdown_to_elements_cancellable().
+* 
+* \return true if the parse should be aborted.
+*/
+typedef bool (*pmh_cancel_callback)(void *context);
+
+/**
+* \brief Parse Markdown text cooperatively, return elements
+* 
+* Same as pmh_markdown_to_elements(), but polls \a cancel_callback
+* periodically while consuming the input and aborts the parse as soon
+* as it returns true.
+* 
+* \param[in]  text             The Markdown text to parse for highlighting.
+* \param[in]  extensions       The extensions to use in parsing (a bitfield
+*                              of pmh_extensions values).
+* \param[in]  cancel_callback  The callback to poll, or NULL.
+* \param[in]  cancel_context   The context passed to \a cancel_callback.
+* \param[out] out_result       Same as in pmh_markdown_to_elements(). Set
+*                              to NULL if the parse is aborted.
+* 
+* \return false if the parse is aborted.
+* 
+* \sa pmh_markdown_to_elements
+*/
+bool pmh_markdown_to_elements_cancellable(char *text, int extensions,
+                                          pmh_cancel_callback cancel_callback,
+                                          void *cancel_context,
+                                          pmh_element **out_result[]);
+
 /**
 * \brief Sort elements in list by start offset.
 * 
@@ -67,6 +101,22 @@ void pmh_sort_elements_by_pos(pmh_element *element_lists[]);
 */
 void pmh_free_elements(pmh_element **elems);
 
+/**
+* \brief Get allocation statistics of pmh_element array
+* 
+* All the elements of one parse are allocated from one arena, which
+* is released by pmh_free_elements().
+* 
+* \param[in]  elems           The pmh_element array resulting from calling
+*                             pmh_markdown_to_elements().
+* \param[out] out_num_allocs  Number of allocations served by the arena.
+* \param[out] out_num_bytes   Number of bytes the arena has reserved.
+* 
+* \sa pmh_markdown_to_elements
+*/
+void pmh_get_alloc_stats(pmh_element **elems, size_t *out_num_allocs,
+                         size_t *out_num_bytes);
+
 /**
 * \brief Get element type name
 * 
@@ -2,6 +2,9 @@
 #define MARKDOWNHIGHLIGHTERDATA_H
 
 #include <QTextCharFormat>
+#include <QVector>
+
+#include <algorithm>
 
 #include "vconstants.h"
 
@@ -55,6 +58,168 @@ struct HLUnitStyle
     }
 };
 
+// Highlight units of all the blocks in one contiguous array, with a table of
+// the offset of the first unit of each block.
+// Units within a block are sorted by start position, with the longer one first.
+// @T: HLUnit or HLUnitStyle.
+template <typename T>
+class BlockHighlights
+{
+public:
+    // Read-only view of the units of one block.
+    class Units
+    {
+    public:
+        Units()
+            : m_data(NULL), m_size(0)
+        {
+        }
+
+        Units(const T *p_data, int p_size)
+            : m_data(p_data), m_size(p_size)
+        {
+        }
+
+        Units(const QVector<T> &p_units)
+            : m_data(p_units.constData()), m_size(p_units.size())
+        {
+        }
+
+        int size() const
+        {
+            return m_size;
+        }
+
+        bool isEmpty() const
+        {
+            return m_size == 0;
+        }
+
+        const T &operator[](int p_idx) const
+        {
+            return m_data[p_idx];
+        }
+
+        const T *begin() const
+        {
+            return m_data;
+        }
+
+        const T *end() const
+        {
+            return m_data + m_size;
+        }
+
+    private:
+        const T *m_data;
+
+        int m_size;
+    };
+
+    // Unit @m_unit of block @m_blockNum.
+    struct Entry
+    {
+        int m_blockNum;
+
+        T m_unit;
+    };
+
+    // Number of blocks.
+    int size() const
+    {
+        return m_offsets.isEmpty() ? 0 : m_offsets.size() - 1;
+    }
+
+    int numOfUnits() const
+    {
+        return m_units.size();
+    }
+
+    Units operator[](int p_blockNum) const
+    {
+        int start = m_offsets[p_blockNum];
+        return Units(m_units.constData() + start, m_offsets[p_blockNum + 1] - start);
+    }
+
+    void clear()
+    {
+        m_units.clear();
+        m_offsets.clear();
+    }
+
+    // Build the table of @p_numOfBlocks blocks from @p_entries.
+    // Units of the same position and length keep their order in @p_entries.
+    void build(int p_numOfBlocks, const QVector<Entry> &p_entries)
+    {
+        m_offsets.fill(0, p_numOfBlocks + 1);
+        for (const auto &entry : p_entries) {
+            ++m_offsets[entry.m_blockNum + 1];
+        }
+
+        for (int i = 0; i < p_numOfBlocks; ++i) {
+            m_offsets[i + 1] += m_offsets[i];
+        }
+
+        // Scatter the units to their blocks.
+        m_units.resize(p_entries.size());
+        T *data = m_units.data();
+        QVector<int> cursors(m_offsets);
+        for (const auto &entry : p_entries) {
+            data[cursors[entry.m_blockNum]++] = entry.m_unit;
+        }
+
+        for (int i = 0; i < p_numOfBlocks; ++i) {
+            T *first = data + m_offsets[i];
+            T *last = data + m_offsets[i + 1];
+            if (last - first > 1 && !std::is_sorted(first, last, lessThan)) {
+                std::stable_sort(first, last, lessThan);
+            }
+        }
+    }
+
+    // Reserve for building the table block by block via appendBlock().
+    void reserve(int p_numOfBlocks, int p_numOfUnits)
+    {
+        m_offsets.reserve(p_numOfBlocks + 1);
+        m_units.reserve(p_numOfUnits);
+    }
+
+    // Append @p_units as the units of the next block.
+    void appendBlock(const Units &p_units)
+    {
+        if (m_offsets.isEmpty()) {
+            m_offsets.append(0);
+        }
+
+        for (const auto &unit : p_units) {
+            m_units.append(unit);
+        }
+
+        m_offsets.append(m_units.size());
+    }
+
+    // Estimated memory in bytes.
+    qint64 estimatedSize() const
+    {
+        return (qint64)m_units.size() * sizeof(T) + (qint64)m_offsets.size() * sizeof(int);
+    }
+
+private:
+    static bool lessThan(const T &p_a, const T &p_b)
+    {
+        if (p_a.start != p_b.start) {
+            return p_a.start < p_b.start;
+        }
+
+        return p_a.length > p_b.length;
+    }
+
+    QVector<T> m_units;
+
+    // Offset of the first unit of each block, with the number of units appended.
+    QVector<int> m_offsets;
+};
+
 // Fenced code block only.
 struct VCodeBlock
 {
@@ -1,5 +1,7 @@
 #include "peghighlighterresult.h"
 
+#include <climits>
+
 #include <QTextDocument>
 #include <QTextBlock>
 
@@ -30,9 +32,11 @@ PegHighlighterResult::PegHighlighterResult()
 }
 
 PegHighlighterResult::PegHighlighterResult(const PegMarkdownHighlighter *p_peg,
-                                           const QSharedPointer<PegParseResult> &p_result)
+                                           const QSharedPointer<PegParseResult> &p_result,
+                                           const PegHighlighterResult *p_base)
     : m_timeStamp(p_result->m_timeStamp),
       m_numOfBlocks(p_result->m_numOfBlocks),
+      m_parseResult(p_result),
       m_codeBlockHighlightReceived(false),
       m_codeBlockTimeStamp(0),
       m_numOfCodeBlockHighlightsToRecv(0)
@@ -42,6 +46,11 @@ PegHighlighterResult::PegHighlighterResult(const PegMarkdownHighlighter *p_peg,
 
     parseBlocksHighlights(m_blocksHighlights, p_peg, p_result);
 
+    if (p_result->isIncremental()) {
+        Q_ASSERT(p_base && p_base->m_timeStamp == p_result->m_baseTimeStamp);
+        spliceBlocksHighlights(p_base, p_result);
+    }
+
     // Implicit sharing.
     m_imageRegions = p_result->m_imageRegions;
     m_headerRegions = p_result->m_headerRegions;
@@ -55,111 +64,213 @@ PegHighlighterResult::PegHighlighterResult(const PegMarkdownHighlighter *p_peg,
     parseTableBlocks(p_result);
 }
 
-static bool compHLUnit(const HLUnit &p_a, const HLUnit &p_b)
+QSharedPointer<PegHighlighterResult> PegHighlighterResult::copyWithTimeStamp(TimeStamp p_timeStamp) const
 {
-    if (p_a.start < p_b.start) {
-        return true;
-    } else if (p_a.start == p_b.start) {
-        return p_a.length > p_b.length;
-    } else {
-        return false;
+    // Containers are implicitly shared.
+    QSharedPointer<PegHighlighterResult> result(new PegHighlighterResult(*this));
+    result->m_timeStamp = p_timeStamp;
+
+    if (!m_parseResult.isNull()) {
+        // It is the base of the next incremental parse, which checks the timestamp.
+        Q_ASSERT(m_parseResult->isEmpty() && !m_parseResult->isIncremental());
+        result->m_parseResult.reset(new PegParseResult(*m_parseResult));
+        result->m_parseResult->m_pmhElements = NULL;
+        result->m_parseResult->m_timeStamp = p_timeStamp;
+    }
+
+    if (!m_codeBlockHighlightReceived) {
+        result->m_codeBlocksHighlights.clear();
+    }
+
+    result->m_codeBlocksHighlightsToBuild.clear();
+
+    result->m_numOfCodeBlockHighlightsToRecv = 0;
+    return result;
+}
+
+int PegHighlighterResult::estimatedSize() const
+{
+    qint64 sz = sizeof(PegHighlighterResult);
+    sz += m_blocksHighlights.estimatedSize();
+    sz += m_codeBlocksHighlights.estimatedSize();
+
+    for (const auto &cb : m_codeBlocks) {
+        sz += sizeof(cb) + (cb.m_lang.size() + cb.m_text.size()) * sizeof(QChar);
+    }
+
+    for (const auto &mb : m_mathjaxBlocks) {
+        sz += sizeof(mb) + mb.m_text.size() * sizeof(QChar);
+    }
+
+    sz += (m_imageRegions.size() + m_headerRegions.size()) * sizeof(VElementRegion);
+    sz += m_codeBlocksState.size() * (sizeof(int) + sizeof(HighlightBlockState));
+    sz += m_hruleBlocks.size() * sizeof(int);
+    sz += m_tableBlocks.size() * sizeof(VTableBlock);
+
+    if (!m_parseResult.isNull()) {
+        const PegParseResult &res = *m_parseResult;
+        sz += sizeof(PegParseResult);
+        sz += (res.m_imageRegions.size()
+               + res.m_headerRegions.size()
+               + res.m_codeBlockRegions.size()
+               + res.m_inlineEquationRegions.size()
+               + res.m_displayFormulaRegions.size()
+               + res.m_hruleRegions.size()
+               + res.m_tableRegions.size()
+               + res.m_tableHeaderRegions.size()
+               + res.m_tableBorderRegions.size()) * sizeof(VElementRegion);
     }
+
+    return (int)qMin(sz, (qint64)INT_MAX);
 }
 
-void PegHighlighterResult::parseBlocksHighlights(QVector<QVector<HLUnit>> &p_blocksHighlights,
+void PegHighlighterResult::parseBlocksHighlights(BlockHighlights<HLUnit> &p_blocksHighlights,
                                                  const PegMarkdownHighlighter *p_peg,
                                                  const QSharedPointer<PegParseResult> &p_result)
 {
-    p_blocksHighlights.resize(p_result->m_numOfBlocks);
+    parseBlocksHighlights(p_blocksHighlights,
+                          p_peg->getDocument(),
+                          p_peg->getStyles(),
+                          p_result);
+}
+
+struct ElementSpan
+{
+    unsigned long m_pos;
+
+    unsigned long m_end;
+
+    int m_styleIndex;
+};
+
+void PegHighlighterResult::parseBlocksHighlights(BlockHighlights<HLUnit> &p_blocksHighlights,
+                                                 const QTextDocument *p_doc,
+                                                 const QVector<HighlightingStyle> &p_styles,
+                                                 const QSharedPointer<PegParseResult> &p_result)
+{
+    const int numOfBlocks = p_result->m_numOfBlocks;
+    QVector<BlockHighlights<HLUnit>::Entry> entries;
     if (p_result->isEmpty()) {
+        p_blocksHighlights.build(numOfBlocks, entries);
         return;
     }
 
-    int offset = p_result->m_offset;
-    const QTextDocument *doc = p_peg->getDocument();
-    const QVector<HighlightingStyle> &styles = p_peg->getStyles();
+    // When the the highlight element is at the end of document, its end will equals
+    // to the characterCount.
+    unsigned long nrChar = (unsigned long)p_doc->characterCount();
+
+    // Collect elements of all styles and sort them by start position, with the
+    // longer one first, which is the order of HLUnits within a block.
+    QVector<ElementSpan> spans;
+    unsigned long offset = p_result->m_offset;
     auto pmhResult = p_result->m_pmhElements;
-    for (int i = 0; i < styles.size(); i++)
+    for (int i = 0; i < p_styles.size(); i++)
     {
-        const HighlightingStyle &style = styles[i];
-        pmh_element *elem_cursor = pmhResult[style.type];
+        pmh_element *elem_cursor = pmhResult[p_styles[i].type];
         while (elem_cursor != NULL)
         {
             // elem_cursor->pos and elem_cursor->end is the start
             // and end position of the element in document.
-            if (elem_cursor->end <= elem_cursor->pos) {
-                elem_cursor = elem_cursor->next;
-                continue;
+            ElementSpan span;
+            span.m_pos = offset + elem_cursor->pos;
+            span.m_end = offset + elem_cursor->end;
+            span.m_styleIndex = i;
+            if (span.m_end >= nrChar && nrChar > 0) {
+                span.m_end = nrChar - 1;
+            }
+
+            if (span.m_pos < span.m_end) {
+                spans.append(span);
             }
 
-            parseBlocksHighlightOne(p_blocksHighlights,
-                                    doc,
-                                    offset + elem_cursor->pos,
-                                    offset + elem_cursor->end,
-                                    i);
             elem_cursor = elem_cursor->next;
         }
     }
 
-    // Sort p_blocksHighlights.
-    for (int i = 0; i < p_blocksHighlights.size(); ++i) {
-        if (p_blocksHighlights[i].size() > 1) {
-            std::sort(p_blocksHighlights[i].begin(), p_blocksHighlights[i].end(), compHLUnit);
+    std::stable_sort(spans.begin(), spans.end(), [](const ElementSpan &p_a, const ElementSpan &p_b) {
+        if (p_a.m_pos != p_b.m_pos) {
+            return p_a.m_pos < p_b.m_pos;
         }
-    }
-}
 
-void PegHighlighterResult::parseBlocksHighlightOne(QVector<QVector<HLUnit>> &p_blocksHighlights,
-                                                   const QTextDocument *p_doc,
-                                                   unsigned long p_pos,
-                                                   unsigned long p_end,
-                                                   int p_styleIndex)
-{
-    // When the the highlight element is at the end of document, @p_end will equals
-    // to the characterCount.
-    unsigned int nrChar = (unsigned int)p_doc->characterCount();
-    if (p_end >= nrChar && nrChar > 0) {
-        p_end = nrChar - 1;
+        return p_a.m_end > p_b.m_end;
+    });
+
+    // Start positions of blocks, with the end of the last block appended.
+    int nrBlocks = 0;
+    QVector<unsigned long> blockStarts;
+    blockStarts.reserve(numOfBlocks + 1);
+    QTextBlock block = p_doc->begin();
+    while (block.isValid() && nrBlocks < numOfBlocks) {
+        blockStarts.append(block.position());
+        ++nrBlocks;
+        block = block.next();
     }
 
-    QTextBlock block = p_doc->findBlock(p_pos);
-    int startBlockNum = block.blockNumber();
-    int endBlockNum = p_doc->findBlock(p_end - 1).blockNumber();
-    if (endBlockNum >= p_blocksHighlights.size()) {
-        endBlockNum = p_blocksHighlights.size() - 1;
-    }
+    blockStarts.append(block.isValid() ? block.position() : nrChar);
 
-    while (block.isValid())
-    {
-        int blockNum = block.blockNumber();
-        if (blockNum > endBlockNum) {
-            break;
+    // Distribute the spans to blocks in one sweep.
+    entries.reserve(spans.size());
+    int blockNum = 0;
+    for (const auto &span : spans) {
+        while (blockNum < nrBlocks && blockStarts[blockNum + 1] <= span.m_pos) {
+            ++blockNum;
         }
 
-        int blockStartPos = block.position();
-        HLUnit unit;
-        if (blockNum == startBlockNum) {
-            unit.start = p_pos - blockStartPos;
-            unit.length = (startBlockNum == endBlockNum) ?
-                          (p_end - p_pos) : (block.length() - unit.start);
-        } else if (blockNum == endBlockNum) {
-            unit.start = 0;
-            unit.length = p_end - blockStartPos;
-        } else {
-            unit.start = 0;
-            unit.length = block.length();
+        if (blockNum >= nrBlocks) {
+            break;
         }
 
-        unit.styleIndex = p_styleIndex;
+        for (int i = blockNum; i < nrBlocks && blockStarts[i] < span.m_end; ++i) {
+            unsigned long start = qMax(span.m_pos, blockStarts[i]);
+            unsigned long end = qMin(span.m_end, blockStarts[i + 1]);
 
-        Q_ASSERT(unit.length > 0);
+            BlockHighlights<HLUnit>::Entry entry;
+            entry.m_blockNum = i;
+            entry.m_unit.start = start - blockStarts[i];
+            entry.m_unit.length = end - start;
+            entry.m_unit.styleIndex = span.m_styleIndex;
 
-        if (unit.length > 0) {
-            p_blocksHighlights[blockNum].append(unit);
+            Q_ASSERT(entry.m_unit.length > 0);
+
+            entries.append(entry);
         }
+    }
 
-        block = block.next();
+    // Units of a block will be sorted by start position and length.
+    p_blocksHighlights.build(numOfBlocks, entries);
+}
+
+void PegHighlighterResult::spliceBlocksHighlights(const PegHighlighterResult *p_base,
+                                                  const QSharedPointer<PegParseResult> &p_result)
+{
+    const BlockHighlights<HLUnit> &baseHls = p_base->m_blocksHighlights;
+    int delta = m_numOfBlocks - p_base->m_numOfBlocks;
+    int firstBlock = qMin(p_result->m_firstBlock, baseHls.size());
+    int tailBlock = qMax(p_result->m_lastBlock + 1, delta);
+
+    // Units of block @i, from the base outside the parse window.
+    auto blockUnits = [&](int i) {
+        if (i < firstBlock) {
+            return baseHls[i];
+        } else if (i >= tailBlock && i - delta < baseHls.size()) {
+            return baseHls[i - delta];
+        }
+
+        return m_blocksHighlights[i];
+    };
+
+    int nrUnits = 0;
+    for (int i = 0; i < m_blocksHighlights.size(); ++i) {
+        nrUnits += blockUnits(i).size();
+    }
+
+    BlockHighlights<HLUnit> hls;
+    hls.reserve(m_blocksHighlights.size(), nrUnits);
+    for (int i = 0; i < m_blocksHighlights.size(); ++i) {
+        hls.appendBlock(blockUnits(i));
     }
+
+    m_blocksHighlights = hls;
 }
 
 #if 0
@@ -30,7 +30,7 @@ public:
 
     TimeStamp m_timeStamp;
 
-    QVector<QVector<HLUnit>> m_blocksHighlights;
+    BlockHighlights<HLUnit> m_blocksHighlights;
 };
 
 
@@ -40,27 +40,52 @@ public:
     PegHighlighterResult();
 
     // TODO: handle p_result->m_offset.
+    // @p_base: the result incremental @p_result is based on.
     PegHighlighterResult(const PegMarkdownHighlighter *p_peg,
-                         const QSharedPointer<PegParseResult> &p_result);
+                         const QSharedPointer<PegParseResult> &p_result,
+                         const PegHighlighterResult *p_base = NULL);
 
     bool matched(TimeStamp p_timeStamp) const;
 
+    bool isIncremental() const;
+
+    // Copy of this result for the same content with timestamp @p_timeStamp.
+    // Code block highlights are kept only if all of them have been received.
+    QSharedPointer<PegHighlighterResult> copyWithTimeStamp(TimeStamp p_timeStamp) const;
+
+    // Estimated memory in bytes used by this result.
+    int estimatedSize() const;
+
     // Parse highlight elements for all the blocks from parse results.
-    static void parseBlocksHighlights(QVector<QVector<HLUnit>> &p_blocksHighlights,
+    static void parseBlocksHighlights(BlockHighlights<HLUnit> &p_blocksHighlights,
                                       const PegMarkdownHighlighter *p_peg,
                                       const QSharedPointer<PegParseResult> &p_result);
 
+    // Parse highlight elements for all the blocks of @p_doc with @p_styles.
+    static void parseBlocksHighlights(BlockHighlights<HLUnit> &p_blocksHighlights,
+                                      const QTextDocument *p_doc,
+                                      const QVector<HighlightingStyle> &p_styles,
+                                      const QSharedPointer<PegParseResult> &p_result);
+
     TimeStamp m_timeStamp;
 
     int m_numOfBlocks;
 
-    QVector<QVector<HLUnit>> m_blocksHighlights;
+    // Parse result with only the regions left, which is the base of the next
+    // incremental parse.
+    QSharedPointer<PegParseResult> m_parseResult;
+
+    BlockHighlights<HLUnit> m_blocksHighlights;
 
     // Use another member to store the codeblocks highlights, because the highlight
     // sequence is blockHighlights, regular-expression-based highlihgts, and then
     // codeBlockHighlights.
     // Support fenced code block only.
-    QVector<QVector<HLUnitStyle> > m_codeBlocksHighlights;
+    BlockHighlights<HLUnitStyle> m_codeBlocksHighlights;
+
+    // Code block highlights received so far, which will be built into
+    // m_codeBlocksHighlights once all of them are received.
+    QVector<BlockHighlights<HLUnitStyle>::Entry> m_codeBlocksHighlightsToBuild;
 
     // Whether the code block highlight results of this result have been received.
     bool m_codeBlockHighlightReceived;
@@ -93,12 +118,9 @@ public:
     QVector<VTableBlock> m_tableBlocks;
 
 private:
-    // Parse highlight elements for blocks from one parse result.
-    static void parseBlocksHighlightOne(QVector<QVector<HLUnit>> &p_blocksHighlights,
-                                        const QTextDocument *p_doc,
-                                        unsigned long p_pos,
-                                        unsigned long p_end,
-                                        int p_styleIndex);
+    // Take highlights of blocks outside the parse window from @p_base.
+    void spliceBlocksHighlights(const PegHighlighterResult *p_base,
+                                const QSharedPointer<PegParseResult> &p_result);
 
     // Parse fenced code blocks from parse results.
     void parseFencedCodeBlocks(const PegMarkdownHighlighter *p_peg,
@@ -130,4 +152,9 @@ inline bool PegHighlighterResult::matched(TimeStamp p_timeStamp) const
 {
     return m_timeStamp == p_timeStamp;
 }
+
+inline bool PegHighlighterResult::isIncremental() const
+{
+    return !m_parseResult.isNull() && m_parseResult->isIncremental();
+}
 #endif // PEGHIGHLIGHTERRESULT_H
@@ -0,0 +1,43 @@
+#include "peghighlighterresultcache.h"
+
+#include <QCryptographicHash>
+
+#include "peghighlighterresult.h"
+
+// 32MB by default.
+QCache<QByteArray, PegHighlighterResultCache::Entry> PegHighlighterResultCache::s_cache(32 * 1024 * 1024);
+
+QByteArray PegHighlighterResultCache::key(const QByteArray &p_contentHash, const QByteArray &p_signature)
+{
+    return p_contentHash + '|' + p_signature;
+}
+
+QByteArray PegHighlighterResultCache::hashContent(const QByteArray &p_data)
+{
+    return QCryptographicHash::hash(p_data, QCryptographicHash::Md5);
+}
+
+QSharedPointer<PegHighlighterResult> PegHighlighterResultCache::get(const QByteArray &p_key)
+{
+    Entry *entry = s_cache.object(p_key);
+    if (entry) {
+        return entry->m_result;
+    }
+
+    return QSharedPointer<PegHighlighterResult>();
+}
+
+void PegHighlighterResultCache::insert(const QByteArray &p_key,
+                                       const QSharedPointer<PegHighlighterResult> &p_result)
+{
+    Entry *entry = new Entry();
+    entry->m_result = p_result;
+
+    // QCache will delete the entry if it exceeds the budget.
+    s_cache.insert(p_key, entry, p_result->estimatedSize() + p_key.size());
+}
+
+void PegHighlighterResultCache::setCapacity(int p_bytes)
+{
+    s_cache.setMaxCost(qMax(0, p_bytes));
+}
@@ -0,0 +1,41 @@
+#ifndef PEGHIGHLIGHTERRESULTCACHE_H
+#define PEGHIGHLIGHTERRESULTCACHE_H
+
+#include <QCache>
+#include <QByteArray>
+#include <QSharedPointer>
+
+class PegHighlighterResult;
+
+// Process-wide LRU cache of highlighter results keyed by content, so that
+// a reopened note could be highlighted without parsing.
+// Should be accessed in the main thread only.
+class PegHighlighterResultCache
+{
+public:
+    // @p_contentHash: hash of the UTF-8 content.
+    // @p_signature: other things the result depends on, such as parser
+    // extensions and styles.
+    static QByteArray key(const QByteArray &p_contentHash, const QByteArray &p_signature);
+
+    static QByteArray hashContent(const QByteArray &p_data);
+
+    // Return null if not found.
+    static QSharedPointer<PegHighlighterResult> get(const QByteArray &p_key);
+
+    static void insert(const QByteArray &p_key,
+                       const QSharedPointer<PegHighlighterResult> &p_result);
+
+    // Set the memory budget in bytes.
+    static void setCapacity(int p_bytes);
+
+private:
+    struct Entry
+    {
+        QSharedPointer<PegHighlighterResult> m_result;
+    };
+
+    static QCache<QByteArray, Entry> s_cache;
+};
+
+#endif // PEGHIGHLIGHTERRESULTCACHE_H
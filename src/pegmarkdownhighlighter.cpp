@@ -3,8 +3,10 @@
 #include <QTextDocument>
 #include <QTimer>
 #include <QScrollBar>
+#include <QElapsedTimer>
 
 #include "pegparser.h"
+#include "peghighlighterresultcache.h"
 #include "vconfigmanager.h"
 #include "utils/vutils.h"
 #include "utils/veditutils.h"
@@ -14,6 +16,19 @@ extern VConfigManager *g_config;
 
 #define LARGE_BLOCK_NUMBER 1000
 
+// Interval to parse the whole document after incremental parses.
+#define FULL_PARSE_INTERVAL 2000
+
+// Time budget in ms of one slice to rehighlight blocks in background.
+#define BACKGROUND_REHIGHLIGHT_SLICE 8
+
+// Weight of the latest sample in the moving averages of highlight cost.
+#define COST_EWMA_ALPHA 0.25
+
+// Parse interval is this times of the cost of one highlight, so parses
+// will not pile up.
+#define COST_INTERVAL_FACTOR 2
+
 PegMarkdownHighlighter::PegMarkdownHighlighter(QTextDocument *p_doc, VMdEditor *p_editor)
     : QSyntaxHighlighter(p_doc),
       m_doc(p_doc),
@@ -27,6 +42,12 @@ PegMarkdownHighlighter::PegMarkdownHighlighter(QTextDocument *p_doc, VMdEditor *
                    | pmh_EXT_MARK
                    | pmh_EXT_TABLE),
       m_parseInterval(50),
+      m_minParseInterval(50),
+      m_maxParseInterval(2000),
+      m_backgroundTimeStamp(0),
+      m_backgroundCodeBlockTimeStamp(0),
+      m_backgroundDone(false),
+      m_coldParse(false),
       m_notifyHighlightComplete(false),
       m_fastParseInterval(30)
 {
@@ -35,7 +56,9 @@ PegMarkdownHighlighter::PegMarkdownHighlighter(QTextDocument *p_doc, VMdEditor *
 void PegMarkdownHighlighter::init(const QVector<HighlightingStyle> &p_styles,
                                   const QHash<QString, QTextCharFormat> &p_codeBlockStyles,
                                   bool p_mathjaxEnabled,
-                                  int p_timerInterval)
+                                  int p_timerInterval,
+                                  int p_minTimerInterval,
+                                  int p_maxTimerInterval)
 {
     m_styles = p_styles;
     m_codeBlockStyles = p_codeBlockStyles;
@@ -44,7 +67,18 @@ void PegMarkdownHighlighter::init(const QVector<HighlightingStyle> &p_styles,
         m_parserExts |= (pmh_EXT_MATH | pmh_EXT_MATH_RAW);
     }
 
-    m_parseInterval = p_timerInterval;
+    m_minParseInterval = qMax(0, p_minTimerInterval);
+    m_maxParseInterval = qMax(m_minParseInterval, p_maxTimerInterval);
+    m_parseInterval = qBound(m_minParseInterval, p_timerInterval, m_maxParseInterval);
+    m_costStats.m_interval = m_parseInterval;
+
+    // Results depend on the extensions and the index of styles.
+    m_cacheSignature = QByteArray::number(m_parserExts);
+    for (const auto &style : m_styles) {
+        m_cacheSignature += ',' + QByteArray::number(style.type);
+    }
+
+    PegHighlighterResultCache::setCapacity(g_config->getMarkdownHighlightCacheSize() * 1024 * 1024);
 
     m_codeBlockFormat.setForeground(QBrush(Qt::darkYellow));
     for (int index = 0; index < m_styles.size(); ++index) {
@@ -75,7 +109,15 @@ void PegMarkdownHighlighter::init(const QVector<HighlightingStyle> &p_styles,
     m_timer->setSingleShot(true);
     m_timer->setInterval(m_parseInterval);
     connect(m_timer, &QTimer::timeout,
-            this, &PegMarkdownHighlighter::startParse);
+            this, [this]() {
+                startParse();
+            });
+
+    m_fullParseTimer = new QTimer(this);
+    m_fullParseTimer->setSingleShot(true);
+    m_fullParseTimer->setInterval(FULL_PARSE_INTERVAL);
+    connect(m_fullParseTimer, &QTimer::timeout,
+            this, &PegMarkdownHighlighter::consolidateIncrementalResult);
 
     m_fastParseTimer = new QTimer(this);
     m_fastParseTimer->setSingleShot(true);
@@ -91,11 +133,7 @@ void PegMarkdownHighlighter::init(const QVector<HighlightingStyle> &p_styles,
     m_scrollRehighlightTimer->setSingleShot(true);
     m_scrollRehighlightTimer->setInterval(5);
     connect(m_scrollRehighlightTimer, &QTimer::timeout,
-            this, [this]() {
-                if (m_result->m_numOfBlocks > LARGE_BLOCK_NUMBER) {
-                    rehighlightSensitiveBlocks();
-                }
-            });
+            this, &PegMarkdownHighlighter::rehighlightSensitiveBlocks);
 
     m_rehighlightTimer = new QTimer(this);
     m_rehighlightTimer->setSingleShot(true);
@@ -103,6 +141,13 @@ void PegMarkdownHighlighter::init(const QVector<HighlightingStyle> &p_styles,
     connect(m_rehighlightTimer, &QTimer::timeout,
             this, &PegMarkdownHighlighter::rehighlightBlocks);
 
+    // Let pending events go first between slices.
+    m_backgroundRehighlightTimer = new QTimer(this);
+    m_backgroundRehighlightTimer->setSingleShot(true);
+    m_backgroundRehighlightTimer->setInterval(0);
+    connect(m_backgroundRehighlightTimer, &QTimer::timeout,
+            this, &PegMarkdownHighlighter::rehighlightBackground);
+
     connect(m_doc, &QTextDocument::contentsChange,
             this, &PegMarkdownHighlighter::handleContentsChange);
 
@@ -206,7 +251,7 @@ static bool containSpecialChar(const QString &p_str)
            || la == '`' || la == '$' || la == '~' || la == '*' || la == '_';
 }
 
-bool PegMarkdownHighlighter::preHighlightSingleFormatBlock(const QVector<QVector<HLUnit>> &p_highlights,
+bool PegMarkdownHighlighter::preHighlightSingleFormatBlock(const BlockHighlights<HLUnit> &p_highlights,
                                                            int p_blockNum,
                                                            const QString &p_text,
                                                            bool p_forced)
@@ -224,7 +269,7 @@ bool PegMarkdownHighlighter::preHighlightSingleFormatBlock(const QVector<QVector
         return false;
     }
 
-    const QVector<HLUnit> &units = p_highlights[p_blockNum];
+    BlockHighlights<HLUnit>::Units units = p_highlights[p_blockNum];
     if (units.size() == 1) {
         const HLUnit &unit = units[0];
         if (unit.start == 0
@@ -238,18 +283,21 @@ bool PegMarkdownHighlighter::preHighlightSingleFormatBlock(const QVector<QVector
     return false;
 }
 
-bool PegMarkdownHighlighter::highlightBlockOne(const QVector<QVector<HLUnit>> &p_highlights,
+bool PegMarkdownHighlighter::highlightBlockOne(const BlockHighlights<HLUnit> &p_highlights,
                                                int p_blockNum,
                                                QVector<HLUnit> *p_cache)
 {
     bool highlighted = false;
     if (p_highlights.size() > p_blockNum) {
         // units are sorted by start position and length.
-        const QVector<HLUnit> &units = p_highlights[p_blockNum];
+        BlockHighlights<HLUnit>::Units units = p_highlights[p_blockNum];
         if (!units.isEmpty()) {
             highlighted = true;
             if (p_cache) {
-                p_cache->append(units);
+                p_cache->reserve(p_cache->size() + units.size());
+                for (const auto &unit : units) {
+                    p_cache->append(unit);
+                }
             }
 
             highlightBlockOne(units);
@@ -259,7 +307,7 @@ bool PegMarkdownHighlighter::highlightBlockOne(const QVector<QVector<HLUnit>> &p
     return highlighted;
 }
 
-void PegMarkdownHighlighter::highlightBlockOne(const QVector<HLUnit> &p_units)
+void PegMarkdownHighlighter::highlightBlockOne(const BlockHighlights<HLUnit>::Units &p_units)
 {
     for (int i = 0; i < p_units.size(); ++i) {
         const HLUnit &unit = p_units[i];
@@ -293,8 +341,6 @@ void PegMarkdownHighlighter::highlightBlockOne(const QVector<HLUnit> &p_units)
 // highlightBlock() will be called before this function.
 void PegMarkdownHighlighter::handleContentsChange(int p_position, int p_charsRemoved, int p_charsAdded)
 {
-    Q_UNUSED(p_position);
-
     int interval = m_contentChangeTime.restart();
 
     if (p_charsRemoved == 0 && p_charsAdded == 0) {
@@ -304,6 +350,15 @@ void PegMarkdownHighlighter::handleContentsChange(int p_position, int p_charsRem
     ++m_timeStamp;
 
     m_timer->stop();
+    m_fullParseTimer->stop();
+
+    // The whole document is replaced, such as open and reload.
+    m_coldParse = p_position == 0 && p_charsAdded >= m_doc->characterCount() - 1;
+
+    // Pending blocks will be rehighlighted with the coming result.
+    stopBackgroundRehighlight();
+
+    updateDirtyRanges(p_position, p_charsAdded);
 
     if (m_timeStamp > 2) {
         m_fastParseInfo.m_position = p_position;
@@ -316,15 +371,248 @@ void PegMarkdownHighlighter::handleContentsChange(int p_position, int p_charsRem
     m_timer->start(m_timeStamp == 2 ? 0 : m_parseInterval);
 }
 
-void PegMarkdownHighlighter::startParse()
+void PegMarkdownHighlighter::startParse(bool p_incremental)
 {
-    QSharedPointer<PegParseConfig> config(new PegParseConfig());
+    QSharedPointer<PegParseConfig> config;
+    if (p_incremental) {
+        config = prepareIncrementalParse();
+    }
+
+    if (config.isNull()) {
+        config.reset(new PegParseConfig());
+        config->m_timeStamp = m_timeStamp;
+        config->m_data = m_doc->toPlainText().toUtf8();
+        config->m_numOfBlocks = m_doc->blockCount();
+        config->m_extensions = m_parserExts;
+
+        if (m_coldParse) {
+            m_coldParse = false;
+            if (applyCachedResult(config)) {
+                return;
+            }
+        }
+    }
+
+    addDirtyRange();
+
+    m_parser->parseAsync(config);
+}
+
+void PegMarkdownHighlighter::updateCostStats(qint64 p_parseTime, qint64 p_applyTime)
+{
+    if (m_costStats.m_numOfSamples == 0) {
+        m_costStats.m_parseTime = p_parseTime;
+        m_costStats.m_applyTime = p_applyTime;
+    } else {
+        m_costStats.m_parseTime += COST_EWMA_ALPHA * (p_parseTime - m_costStats.m_parseTime);
+        m_costStats.m_applyTime += COST_EWMA_ALPHA * (p_applyTime - m_costStats.m_applyTime);
+    }
+
+    ++m_costStats.m_numOfSamples;
+
+    qreal cost = m_costStats.m_parseTime + m_costStats.m_applyTime;
+    m_parseInterval = qBound(m_minParseInterval,
+                             qRound(cost * COST_INTERVAL_FACTOR),
+                             m_maxParseInterval);
+    m_costStats.m_interval = m_parseInterval;
+    m_timer->setInterval(m_parseInterval);
+}
+
+QSharedPointer<PegParseConfig> PegMarkdownHighlighter::prepareIncrementalParse() const
+{
+    QSharedPointer<PegParseConfig> config;
+
+    // Small document could be parsed as a whole quickly.
+    int nrBlocks = m_doc->blockCount();
+    if (nrBlocks <= LARGE_BLOCK_NUMBER
+        || m_result->m_parseResult.isNull()
+        || m_dirtyRanges.isEmpty()) {
+        return config;
+    }
+
+    const DirtyRange &dirty = m_dirtyRanges.first();
+    if (dirty.m_timeStamp != m_result->m_timeStamp) {
+        return config;
+    }
+
+    int first = dirty.m_headBlocks;
+    int last = nrBlocks - 1 - dirty.m_tailBlocks;
+    if (first >= nrBlocks || last < first) {
+        return config;
+    }
+
+    getIncrementalParseBlockRange(first, last);
+    if ((last - first + 1) * 2 > nrBlocks) {
+        return config;
+    }
+
+    // A fence or display formula left open in the window will change the
+    // meaning of the rest of the document.
+    QRegularExpression codeBlockStartExp(VUtils::c_fencedCodeBlockStartRegExp);
+    QRegularExpression codeBlockEndExp(VUtils::c_fencedCodeBlockEndRegExp);
+    bool inCodeBlock = false;
+    QString marker;
+    int nrFormulaMarkers = 0;
+    QTextBlock block = m_doc->findBlockByNumber(first);
+    int offset = block.position();
+    int windowEnd = offset;
+    QTextBlock lastBlock = m_doc->findBlockByNumber(last);
+    QString text;
+    text.reserve(lastBlock.position() + lastBlock.length() - offset);
+    while (block.isValid()) {
+        int blockNum = block.blockNumber();
+        if (blockNum > last) {
+            break;
+        }
+
+        QString blockText = block.text();
+        if (blockText.contains('`') || blockText.contains('~')) {
+            if (inCodeBlock) {
+                auto match = codeBlockEndExp.match(blockText);
+                if (match.hasMatch() && marker == match.captured(2)) {
+                    inCodeBlock = false;
+                }
+            } else {
+                auto match = codeBlockStartExp.match(blockText);
+                if (match.hasMatch()) {
+                    inCodeBlock = true;
+                    marker = match.captured(2);
+                }
+            }
+        }
+
+        nrFormulaMarkers += blockText.count("$$");
+
+        if (blockNum != first) {
+            text.append('\n');
+        }
+
+        text.append(blockText);
+
+        windowEnd = block.position() + block.length();
+        block = block.next();
+    }
+
+    if (inCodeBlock
+        || (isMathJaxEnabled() && nrFormulaMarkers % 2 != 0)
+        || text.isEmpty()) {
+        return config;
+    }
+
+    config.reset(new PegParseConfig());
     config->m_timeStamp = m_timeStamp;
-    config->m_data = m_doc->toPlainText().toUtf8();
-    config->m_numOfBlocks = m_doc->blockCount();
+    config->m_data = text.toUtf8();
+    config->m_numOfBlocks = nrBlocks;
+    config->m_offset = offset;
     config->m_extensions = m_parserExts;
+    config->m_baseResult = m_result->m_parseResult;
+    config->m_firstBlock = first;
+    config->m_lastBlock = last;
+    config->m_windowEnd = windowEnd;
+    config->m_charDelta = m_doc->characterCount() - dirty.m_numOfChars;
+    return config;
+}
 
-    m_parser->parseAsync(config);
+void PegMarkdownHighlighter::getIncrementalParseBlockRange(int &p_first, int &p_last) const
+{
+    // Look up for an empty block outside code block.
+    QTextBlock block = m_doc->findBlockByNumber(p_first);
+    while (block.isValid()) {
+        QTextBlock preBlock = block.previous();
+        if (!preBlock.isValid()) {
+            break;
+        }
+
+        int state = block.userState();
+        if (state != HighlightBlockState::CodeBlock
+            && state != HighlightBlockState::CodeBlockEnd
+            && VEditUtils::isEmptyBlock(preBlock)
+            && VEditUtils::fetchIndentation(block) < 4) {
+            int preState = preBlock.userState();
+            if (preState != HighlightBlockState::CodeBlockStart
+                && preState != HighlightBlockState::CodeBlock) {
+                break;
+            }
+        }
+
+        block = preBlock;
+    }
+
+    p_first = block.blockNumber();
+
+    // Look down.
+    block = m_doc->findBlockByNumber(p_last);
+    while (block.isValid()) {
+        QTextBlock nextBlock = block.next();
+        if (!nextBlock.isValid()) {
+            break;
+        }
+
+        int state = block.userState();
+        if (state != HighlightBlockState::CodeBlockStart
+            && state != HighlightBlockState::CodeBlock
+            && VEditUtils::isEmptyBlock(nextBlock)) {
+            int nstate = nextBlock.userState();
+            if (nstate != HighlightBlockState::CodeBlockStart
+                && nstate != HighlightBlockState::CodeBlock
+                && nstate != HighlightBlockState::CodeBlockEnd) {
+                // Indented block may be the continuation of a list item.
+                QTextBlock nnBlock = nextBlock.next();
+                if (!nnBlock.isValid() || VEditUtils::fetchIndentation(nnBlock) < 4) {
+                    break;
+                }
+            }
+        }
+
+        block = nextBlock;
+    }
+
+    p_last = block.blockNumber();
+}
+
+void PegMarkdownHighlighter::addDirtyRange()
+{
+    if (!m_dirtyRanges.isEmpty() && m_dirtyRanges.last().m_timeStamp == m_timeStamp) {
+        return;
+    }
+
+    DirtyRange dirty;
+    dirty.m_timeStamp = m_timeStamp;
+    dirty.m_headBlocks = INT_MAX;
+    dirty.m_tailBlocks = INT_MAX;
+    dirty.m_numOfChars = m_doc->characterCount();
+    m_dirtyRanges.append(dirty);
+}
+
+void PegMarkdownHighlighter::updateDirtyRanges(int p_position, int p_charsAdded)
+{
+    if (m_dirtyRanges.isEmpty()) {
+        return;
+    }
+
+    int firstBlock = qMax(m_doc->findBlock(p_position).blockNumber(), 0);
+    QTextBlock lastBlock = m_doc->findBlock(p_position + p_charsAdded);
+    if (!lastBlock.isValid()) {
+        lastBlock = m_doc->lastBlock();
+    }
+
+    int tailBlocks = qMax(m_doc->blockCount() - 1 - lastBlock.blockNumber(), 0);
+    for (auto &dirty : m_dirtyRanges) {
+        dirty.m_headBlocks = qMin(dirty.m_headBlocks, firstBlock);
+        dirty.m_tailBlocks = qMin(dirty.m_tailBlocks, tailBlocks);
+    }
+}
+
+void PegMarkdownHighlighter::consolidateIncrementalResult()
+{
+    if (!m_result->isIncremental() || !m_result->matched(m_timeStamp)) {
+        return;
+    }
+
+    // Keep current timestamp since the content does not change. The full
+    // result of the same timestamp takes place of the incremental one, while
+    // previews keyed by the timestamp stay valid.
+    startParse(false);
 }
 
 void PegMarkdownHighlighter::startFastParse(int p_position, int p_charsRemoved, int p_charsAdded)
@@ -389,17 +677,6 @@ void PegMarkdownHighlighter::processFastParseResult(const QSharedPointer<PegPars
     }
 }
 
-static bool compHLUnitStyle(const HLUnitStyle &a, const HLUnitStyle &b)
-{
-    if (a.start < b.start) {
-        return true;
-    } else if (a.start == b.start) {
-        return a.length > b.length;
-    } else {
-        return false;
-    }
-}
-
 void PegMarkdownHighlighter::setCodeBlockHighlights(TimeStamp p_timeStamp,
                                                     const QVector<HLUnitPos> &p_units)
 {
@@ -414,7 +691,7 @@ void PegMarkdownHighlighter::setCodeBlockHighlights(TimeStamp p_timeStamp,
     }
 
     {
-    QVector<QVector<HLUnitStyle>> highlights(result->m_codeBlocksHighlights.size());
+    QVector<BlockHighlights<HLUnitStyle>::Entry> entries;
     for (auto const &unit : p_units) {
         int pos = unit.m_position;
         int end = unit.m_position + unit.m_length;
@@ -423,7 +700,7 @@ void PegMarkdownHighlighter::setCodeBlockHighlights(TimeStamp p_timeStamp,
         int endBlockNum = m_doc->findBlock(end).blockNumber();
 
         // Text has been changed. Abandon the obsolete parsed result.
-        if (startBlockNum == -1 || endBlockNum >= highlights.size()) {
+        if (startBlockNum == -1 || endBlockNum >= result->m_numOfBlocks) {
             goto exit;
         }
 
@@ -434,7 +711,9 @@ void PegMarkdownHighlighter::setCodeBlockHighlights(TimeStamp p_timeStamp,
             }
 
             int blockStartPos = block.position();
-            HLUnitStyle hl;
+            BlockHighlights<HLUnitStyle>::Entry entry;
+            entry.m_blockNum = blockNumber;
+            HLUnitStyle &hl = entry.m_unit;
             hl.style = unit.m_style;
             if (blockNumber == startBlockNum) {
                 hl.start = pos - blockStartPos;
@@ -448,27 +727,21 @@ void PegMarkdownHighlighter::setCodeBlockHighlights(TimeStamp p_timeStamp,
                 hl.length = block.length();
             }
 
-            highlights[blockNumber].append(hl);
+            entries.append(entry);
 
             block = block.next();
         }
     }
 
-    // Need to highlight in order.
-    for (int i = 0; i < highlights.size(); ++i) {
-        QVector<HLUnitStyle> &units = highlights[i];
-        if (!units.isEmpty()) {
-            if (units.size() > 1) {
-                std::sort(units.begin(), units.end(), compHLUnitStyle);
-            }
-
-            result->m_codeBlocksHighlights[i].append(units);
-        }
-    }
+    result->m_codeBlocksHighlightsToBuild += entries;
     }
 
 exit:
     if (--result->m_numOfCodeBlockHighlightsToRecv <= 0) {
+        // Units within a block will be sorted in order.
+        result->m_codeBlocksHighlights.build(result->m_numOfBlocks,
+                                             result->m_codeBlocksHighlightsToBuild);
+        result->m_codeBlocksHighlightsToBuild.clear();
         result->m_codeBlockTimeStamp = nextCodeBlockTimeStamp();
         result->m_codeBlockHighlightReceived = true;
         rehighlightBlocksLater();
@@ -494,9 +767,59 @@ void PegMarkdownHighlighter::handleParseResult(const QSharedPointer<PegParseResu
         return;
     }
 
+    if (p_result->isIncremental()
+        && (m_result.isNull() || m_result->m_timeStamp != p_result->m_baseTimeStamp)) {
+        // The base result has been replaced. Parse again based on current result.
+        m_timer->start(0);
+        return;
+    }
+
+    QElapsedTimer applyTimer;
+    applyTimer.start();
+
+    QSharedPointer<PegHighlighterResult> result(new PegHighlighterResult(this, p_result, m_result.data()));
+
+    // Only regions are needed from now on.
+    p_result->clearPmhElements();
+
+    if (!p_result->m_contentHash.isEmpty()) {
+        PegHighlighterResultCache::insert(PegHighlighterResultCache::key(p_result->m_contentHash,
+                                                                         m_cacheSignature),
+                                          result);
+    }
+
+    applyResult(result);
+
+    updateCostStats(p_result->m_parseTime, applyTimer.elapsed());
+}
+
+bool PegMarkdownHighlighter::applyCachedResult(const QSharedPointer<PegParseConfig> &p_config)
+{
+    QByteArray hash = PegHighlighterResultCache::hashContent(p_config->m_data);
+    auto cached = PegHighlighterResultCache::get(PegHighlighterResultCache::key(hash, m_cacheSignature));
+    if (cached.isNull() || cached->m_numOfBlocks != p_config->m_numOfBlocks) {
+        return false;
+    }
+
+    applyResult(cached->copyWithTimeStamp(p_config->m_timeStamp));
+    return true;
+}
+
+void PegMarkdownHighlighter::applyResult(const QSharedPointer<PegHighlighterResult> &p_result)
+{
     clearFastParseResult();
 
-    m_result.reset(new PegHighlighterResult(this, p_result));
+    m_result = p_result;
+
+    // Drop dirty ranges before this result.
+    while (!m_dirtyRanges.isEmpty()
+           && m_dirtyRanges.first().m_timeStamp < m_result->m_timeStamp) {
+        m_dirtyRanges.removeFirst();
+    }
+
+    if (m_result->isIncremental()) {
+        m_fullParseTimer->start();
+    }
 
     m_result->m_codeBlockTimeStamp = nextCodeBlockTimeStamp();
 
@@ -524,10 +847,10 @@ void PegMarkdownHighlighter::handleParseResult(const QSharedPointer<PegParseResu
     }
 }
 
-void PegMarkdownHighlighter::updateSingleFormatBlocks(const QVector<QVector<HLUnit>> &p_highlights)
+void PegMarkdownHighlighter::updateSingleFormatBlocks(const BlockHighlights<HLUnit> &p_highlights)
 {
     for (int i = 0; i < p_highlights.size(); ++i) {
-        const QVector<HLUnit> &units = p_highlights[i];
+        BlockHighlights<HLUnit>::Units units = p_highlights[i];
         if (units.size() == 1) {
             const HLUnit &unit = units[0];
             if (unit.start == 0 && unit.length > 0) {
@@ -547,7 +870,7 @@ void PegMarkdownHighlighter::updateCodeBlocks(const QSharedPointer<PegHighlighte
         int cbSz = p_result->m_codeBlocks.size();
         if (cbSz > 0) {
             if (PegMarkdownHighlighter::isEmptyCodeBlockHighlights(p_result->m_codeBlocksHighlights)) {
-                p_result->m_codeBlocksHighlights.resize(p_result->m_numOfBlocks);
+                p_result->m_codeBlocksHighlightsToBuild.clear();
                 p_result->m_numOfCodeBlockHighlightsToRecv = cbSz;
             }
         } else {
@@ -667,10 +990,13 @@ void PegMarkdownHighlighter::highlightCodeBlock(const QSharedPointer<PegHighligh
     }
 
     if (p_result->m_codeBlocksHighlights.size() > p_blockNum) {
-        const QVector<HLUnitStyle> &units = p_result->m_codeBlocksHighlights[p_blockNum];
+        BlockHighlights<HLUnitStyle>::Units units = p_result->m_codeBlocksHighlights[p_blockNum];
         if (!units.isEmpty()) {
             if (p_cache) {
-                p_cache->append(units);
+                p_cache->reserve(p_cache->size() + units.size());
+                for (const auto &unit : units) {
+                    p_cache->append(unit);
+                }
             }
 
             highlightCodeBlockOne(units);
@@ -694,7 +1020,7 @@ void PegMarkdownHighlighter::highlightCodeBlock(const QVector<HLUnitStyle> &p_un
     }
 }
 
-void PegMarkdownHighlighter::highlightCodeBlockOne(const QVector<HLUnitStyle> &p_units)
+void PegMarkdownHighlighter::highlightCodeBlockOne(const BlockHighlights<HLUnitStyle>::Units &p_units)
 {
     QVector<QTextCharFormat *> formats(p_units.size(), NULL);
     for (int i = 0; i < p_units.size(); ++i) {
@@ -889,15 +1215,14 @@ void PegMarkdownHighlighter::rehighlightSensitiveBlocks()
             m_editor->ensureCursorVisibleW();
         }
     }
+
+    scheduleBackgroundRehighlight(first, last);
 }
 
 void PegMarkdownHighlighter::rehighlightBlocks()
 {
-    if (m_result->m_numOfBlocks <= LARGE_BLOCK_NUMBER) {
-        rehighlightBlockRange(0, m_result->m_numOfBlocks - 1);
-    } else {
-        rehighlightSensitiveBlocks();
-    }
+    // Visible blocks first and then the others in background.
+    rehighlightSensitiveBlocks();
 
     if (m_notifyHighlightComplete) {
         m_notifyHighlightComplete = false;
@@ -908,10 +1233,6 @@ void PegMarkdownHighlighter::rehighlightBlocks()
 bool PegMarkdownHighlighter::rehighlightBlockRange(int p_first, int p_last)
 {
     bool highlighted = false;
-    const QHash<int, HighlightBlockState> &cbStates = m_result->m_codeBlocksState;
-    const QVector<QVector<HLUnit>> &hls = m_result->m_blocksHighlights;
-    const QVector<QVector<HLUnitStyle>> &cbHls = m_result->m_codeBlocksHighlights;
-
     int nr = 0;
     QTextBlock block = m_doc->findBlockByNumber(p_first);
     while (block.isValid()) {
@@ -920,54 +1241,138 @@ bool PegMarkdownHighlighter::rehighlightBlockRange(int p_first, int p_last)
             break;
         }
 
-        bool needHL = false;
-        bool updateTS = false;
-        VTextBlockData *data = VTextBlockData::blockData(block);
-        if (PegMarkdownHighlighter::blockTimeStamp(block) != m_result->m_timeStamp) {
-            needHL = true;
-            // Try to find cache.
-            if (blockNum < hls.size()) {
-                if (data->isBlockHighlightCacheMatched(hls[blockNum])) {
-                    needHL = false;
-                    updateTS = true;
-                }
+        if (rehighlightBlockIfNecessary(block)) {
+            highlighted = true;
+            ++nr;
+        }
+
+        block = block.next();
+    }
+
+    qDebug() << "rehighlightBlockRange" << p_first << p_last << nr;
+    return highlighted;
+}
+
+bool PegMarkdownHighlighter::rehighlightBlockIfNecessary(const QTextBlock &p_block)
+{
+    const QHash<int, HighlightBlockState> &cbStates = m_result->m_codeBlocksState;
+    const BlockHighlights<HLUnit> &hls = m_result->m_blocksHighlights;
+    const BlockHighlights<HLUnitStyle> &cbHls = m_result->m_codeBlocksHighlights;
+
+    int blockNum = p_block.blockNumber();
+    bool needHL = false;
+    bool updateTS = false;
+    VTextBlockData *data = VTextBlockData::blockData(p_block);
+    if (PegMarkdownHighlighter::blockTimeStamp(p_block) != m_result->m_timeStamp) {
+        needHL = true;
+        // Try to find cache.
+        if (blockNum < hls.size()) {
+            if (data->isBlockHighlightCacheMatched(hls[blockNum])) {
+                needHL = false;
+                updateTS = true;
             }
         }
+    }
 
-        if (!needHL) {
-            // FIXME: what about a previous code block turn into a non-code block? For now,
-            // they can be distinguished by block highlights.
-            auto it = cbStates.find(blockNum);
-            if (it != cbStates.end() && it.value() == HighlightBlockState::CodeBlock) {
-                if (PegMarkdownHighlighter::blockCodeBlockTimeStamp(block) != m_result->m_codeBlockTimeStamp
-                    && m_result->m_codeBlockHighlightReceived) {
-                    needHL = true;
-                    // Try to find cache.
-                    if (blockNum < cbHls.size()) {
-                        if (data->isCodeBlockHighlightCacheMatched(cbHls[blockNum])) {
-                            needHL = false;
-                            updateTS = true;
-                        }
+    if (!needHL) {
+        // FIXME: what about a previous code block turn into a non-code block? For now,
+        // they can be distinguished by block highlights.
+        auto it = cbStates.find(blockNum);
+        if (it != cbStates.end() && it.value() == HighlightBlockState::CodeBlock) {
+            if (PegMarkdownHighlighter::blockCodeBlockTimeStamp(p_block) != m_result->m_codeBlockTimeStamp
+                && m_result->m_codeBlockHighlightReceived) {
+                needHL = true;
+                // Try to find cache.
+                if (blockNum < cbHls.size()) {
+                    if (data->isCodeBlockHighlightCacheMatched(cbHls[blockNum])) {
+                        needHL = false;
+                        updateTS = true;
                     }
                 }
             }
         }
+    }
 
-        if (needHL) {
-            highlighted = true;
-            rehighlightBlock(block);
-            ++nr;
-        } else if (updateTS) {
-            data->setCacheValid(true);
-            data->setTimeStamp(m_result->m_timeStamp);
-            data->setCodeBlockTimeStamp(m_result->m_codeBlockTimeStamp);
+    if (needHL) {
+        rehighlightBlock(p_block);
+        return true;
+    } else if (updateTS) {
+        data->setCacheValid(true);
+        data->setTimeStamp(m_result->m_timeStamp);
+        data->setCodeBlockTimeStamp(m_result->m_codeBlockTimeStamp);
+    }
+
+    return false;
+}
+
+void PegMarkdownHighlighter::scheduleBackgroundRehighlight(int p_first, int p_last)
+{
+    m_backgroundRanges.clear();
+    m_backgroundRehighlightTimer->stop();
+
+    if (m_backgroundDone
+        && m_backgroundTimeStamp == m_result->m_timeStamp
+        && m_backgroundCodeBlockTimeStamp == m_result->m_codeBlockTimeStamp) {
+        // All blocks are up to date.
+        return;
+    }
+
+    m_backgroundTimeStamp = m_result->m_timeStamp;
+    m_backgroundCodeBlockTimeStamp = m_result->m_codeBlockTimeStamp;
+    m_backgroundDone = false;
+
+    int lastBlock = qMin(m_result->m_numOfBlocks, m_doc->blockCount()) - 1;
+    if (p_last < lastBlock) {
+        m_backgroundRanges.append(QPair<int, int>(p_last + 1, lastBlock));
+    }
+
+    if (p_first > 0) {
+        m_backgroundRanges.append(QPair<int, int>(0, qMin(p_first, lastBlock + 1) - 1));
+    }
+
+    if (m_backgroundRanges.isEmpty()) {
+        m_backgroundDone = true;
+    } else {
+        m_backgroundRehighlightTimer->start();
+    }
+}
+
+void PegMarkdownHighlighter::rehighlightBackground()
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    while (!m_backgroundRanges.isEmpty()
+           && timer.elapsed() < BACKGROUND_REHIGHLIGHT_SLICE) {
+        QPair<int, int> &range = m_backgroundRanges.first();
+        QTextBlock block = m_doc->findBlockByNumber(range.first);
+        while (block.isValid()
+               && range.first <= range.second
+               && timer.elapsed() < BACKGROUND_REHIGHLIGHT_SLICE) {
+            rehighlightBlockIfNecessary(block);
+            ++range.first;
+            block = block.next();
         }
 
-        block = block.next();
+        if (!block.isValid() || range.first > range.second) {
+            m_backgroundRanges.removeFirst();
+        }
     }
 
-    qDebug() << "rehighlightBlockRange" << p_first << p_last << nr;
-    return highlighted;
+    if (!m_backgroundRanges.isEmpty()) {
+        m_backgroundRehighlightTimer->start();
+        return;
+    }
+
+    // The result may change during the slices.
+    m_backgroundDone = m_backgroundTimeStamp == m_result->m_timeStamp
+                       && m_backgroundCodeBlockTimeStamp == m_result->m_codeBlockTimeStamp;
+}
+
+void PegMarkdownHighlighter::stopBackgroundRehighlight()
+{
+    m_backgroundRanges.clear();
+    m_backgroundRehighlightTimer->stop();
 }
 
 void PegMarkdownHighlighter::clearFastParseResult()
@@ -13,6 +13,41 @@ class PegParser;
 class QTimer;
 class VMdEditor;
 
+// Measured cost of highlight of one document, which decides the interval
+// of the parse timer.
+struct HighlightCostStats
+{
+    HighlightCostStats()
+        : m_parseTime(0),
+          m_applyTime(0),
+          m_numOfSamples(0),
+          m_interval(0)
+    {
+    }
+
+    QString toString() const
+    {
+        return QString("HighlightCostStats parse %1ms apply %2ms samples %3 interval %4ms")
+                      .arg(m_parseTime, 0, 'f', 1)
+                      .arg(m_applyTime, 0, 'f', 1)
+                      .arg(m_numOfSamples)
+                      .arg(m_interval);
+    }
+
+    // Exponentially weighted moving average of the time in ms to parse
+    // in worker thread.
+    qreal m_parseTime;
+
+    // Exponentially weighted moving average of the time in ms to apply
+    // a parse result.
+    qreal m_applyTime;
+
+    int m_numOfSamples;
+
+    // Current interval of the parse timer in ms.
+    int m_interval;
+};
+
 class PegMarkdownHighlighter : public QSyntaxHighlighter
 {
     Q_OBJECT
@@ -22,7 +57,9 @@ public:
     void init(const QVector<HighlightingStyle> &p_styles,
               const QHash<QString, QTextCharFormat> &p_codeBlockStyles,
               bool p_mathjaxEnabled,
-              int p_timerInterval);
+              int p_timerInterval,
+              int p_minTimerInterval,
+              int p_maxTimerInterval);
 
     // Set code block highlight result by VCodeBlockHighlightHelper.
     void setCodeBlockHighlights(TimeStamp p_timeStamp, const QVector<HLUnitPos> &p_units);
@@ -47,12 +84,14 @@ public:
 
     const QVector<VCodeBlock> &getCodeBlocks() const;
 
+    const HighlightCostStats &getCostStats() const;
+
 public slots:
     // Parse and rehighlight immediately.
     void updateHighlight();
 
     // Rehighlight sensitive blocks using current parse result, mainly
-    // visible blocks.
+    // visible blocks, and then other blocks in background.
     void rehighlightSensitiveBlocks();
 
 signals:
@@ -89,7 +128,48 @@ private:
         int m_charsAdded;
     } m_fastParseInfo;
 
-    void startParse();
+    // Changes of the document since the parse with timestamp m_timeStamp started.
+    // Blocks outside the dirty blocks are not touched since then.
+    struct DirtyRange
+    {
+        TimeStamp m_timeStamp;
+
+        // Number of leading blocks not touched.
+        int m_headBlocks;
+
+        // Number of trailing blocks not touched.
+        int m_tailBlocks;
+
+        // Number of characters of the document when the parse started.
+        int m_numOfChars;
+    };
+
+    // @p_incremental: whether try to parse only the changed blocks.
+    void startParse(bool p_incremental = true);
+
+    // Add a sample of parse and apply cost and adapt the parse interval.
+    void updateCostStats(qint64 p_parseTime, qint64 p_applyTime);
+
+    // Make @p_result the current result and rehighlight.
+    void applyResult(const QSharedPointer<PegHighlighterResult> &p_result);
+
+    // Apply the cached result of the same content as @p_config if there is one.
+    // Return true if applied.
+    bool applyCachedResult(const QSharedPointer<PegParseConfig> &p_config);
+
+    // Prepare a config to parse only the blocks changed since m_result.
+    // Return null if incremental parse is not applicable.
+    QSharedPointer<PegParseConfig> prepareIncrementalParse() const;
+
+    // Widen the range [@p_first, @p_last] to top-level Markdown boundaries.
+    void getIncrementalParseBlockRange(int &p_first, int &p_last) const;
+
+    void addDirtyRange();
+
+    void updateDirtyRanges(int p_position, int p_charsAdded);
+
+    // Parse the whole document to take place of the incremental result.
+    void consolidateIncrementalResult();
 
     void startFastParse(int p_position, int p_charsRemoved, int p_charsAdded);
 
@@ -111,7 +191,7 @@ private:
     void highlightCodeBlock(const QVector<HLUnitStyle> &p_units,
                             const QString &p_text);
 
-    void highlightCodeBlockOne(const QVector<HLUnitStyle> &p_units);
+    void highlightCodeBlockOne(const BlockHighlights<HLUnitStyle>::Units &p_units);
 
     // Highlight color column in code block.
     void highlightCodeBlockColorColumn(const QString &p_text);
@@ -134,19 +214,19 @@ private:
 
     void processFastParseResult(const QSharedPointer<PegParseResult> &p_result);
 
-    bool highlightBlockOne(const QVector<QVector<HLUnit>> &p_highlights,
+    bool highlightBlockOne(const BlockHighlights<HLUnit> &p_highlights,
                            int p_blockNum,
                            QVector<HLUnit> *p_cache);
 
-    void highlightBlockOne(const QVector<HLUnit> &p_units);
+    void highlightBlockOne(const BlockHighlights<HLUnit>::Units &p_units);
 
     // To avoid line height jitter and code block mess.
-    bool preHighlightSingleFormatBlock(const QVector<QVector<HLUnit>> &p_highlights,
+    bool preHighlightSingleFormatBlock(const BlockHighlights<HLUnit> &p_highlights,
                                        int p_blockNum,
                                        const QString &p_text,
                                        bool p_forced);
 
-    void updateSingleFormatBlocks(const QVector<QVector<HLUnit>> &p_highlights);
+    void updateSingleFormatBlocks(const BlockHighlights<HLUnit> &p_highlights);
 
     void rehighlightBlocks();
 
@@ -154,6 +234,19 @@ private:
 
     bool rehighlightBlockRange(int p_first, int p_last);
 
+    // Rehighlight @p_block if its highlights are outdated.
+    // Return true if it is rehighlighted.
+    bool rehighlightBlockIfNecessary(const QTextBlock &p_block);
+
+    // Schedule to rehighlight blocks outside [@p_first, @p_last] in background,
+    // starting from the blocks next to the range.
+    void scheduleBackgroundRehighlight(int p_first, int p_last);
+
+    // Rehighlight pending blocks for a time slice.
+    void rehighlightBackground();
+
+    void stopBackgroundRehighlight();
+
     TimeStamp nextCodeBlockTimeStamp();
 
     bool isFastParseBlock(int p_blockNum) const;
@@ -162,7 +255,7 @@ private:
 
     static VTextBlockData *getBlockData(const QTextBlock &p_block);
 
-    static bool isEmptyCodeBlockHighlights(const QVector<QVector<HLUnitStyle>> &p_highlights);
+    static bool isEmptyCodeBlockHighlights(const BlockHighlights<HLUnitStyle> &p_highlights);
 
     static TimeStamp blockTimeStamp(const QTextBlock &p_block);
 
@@ -206,12 +299,45 @@ private:
 
     int m_parseInterval;
 
+    // Bounds of m_parseInterval.
+    int m_minParseInterval;
+
+    int m_maxParseInterval;
+
+    HighlightCostStats m_costStats;
+
+    // Whether the next complete parse could be served by the result cache.
+    bool m_coldParse;
+
+    // Key part of PegHighlighterResultCache besides the content.
+    QByteArray m_cacheSignature;
+
     QTimer *m_fastParseTimer;
 
     QTimer *m_scrollRehighlightTimer;
 
     QTimer *m_rehighlightTimer;
 
+    // Timer to rehighlight blocks in background slice by slice.
+    QTimer *m_backgroundRehighlightTimer;
+
+    // Block ranges to rehighlight in background, inclusive.
+    QVector<QPair<int, int>> m_backgroundRanges;
+
+    // Timestamps of the result the background rehighlight is scheduled for.
+    TimeStamp m_backgroundTimeStamp;
+
+    TimeStamp m_backgroundCodeBlockTimeStamp;
+
+    // Whether all blocks have been rehighlighted with that result.
+    bool m_backgroundDone;
+
+    // Timer to trigger a full parse after incremental parses.
+    QTimer *m_fullParseTimer;
+
+    // Dirty ranges since each running parse and m_result, sorted by timestamp.
+    QVector<DirtyRange> m_dirtyRanges;
+
     // Blocks have only one format set which occupies the whole block.
     QSet<int> m_singleFormatBlocks;
 
@@ -256,6 +382,11 @@ inline QHash<QString, QTextCharFormat> &PegMarkdownHighlighter::getCodeBlockStyl
     return m_codeBlockStyles;
 }
 
+inline const HighlightCostStats &PegMarkdownHighlighter::getCostStats() const
+{
+    return m_costStats;
+}
+
 inline QVector<HighlightingStyle> &PegMarkdownHighlighter::getStyles()
 {
     return m_styles;
@@ -341,21 +472,9 @@ inline void PegMarkdownHighlighter::updateBlockCodeBlockTimeStamp(const QTextBlo
     }
 }
 
-inline bool PegMarkdownHighlighter::isEmptyCodeBlockHighlights(const QVector<QVector<HLUnitStyle>> &p_highlights)
+inline bool PegMarkdownHighlighter::isEmptyCodeBlockHighlights(const BlockHighlights<HLUnitStyle> &p_highlights)
 {
-    if (p_highlights.isEmpty()) {
-        return true;
-    }
-
-    bool empty = true;
-    for (int i = 0; i < p_highlights.size(); ++i) {
-        if (!p_highlights[i].isEmpty()) {
-            empty = false;
-            break;
-        }
-    }
-
-    return empty;
+    return p_highlights.numOfUnits() == 0;
 }
 
 inline VTextBlockData *PegMarkdownHighlighter::getBlockData(const QTextBlock &p_block)
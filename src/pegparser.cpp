@@ -1,5 +1,14 @@
 #include "pegparser.h"
 
+#include <functional>
+
+#include <QElapsedTimer>
+#include <QRunnable>
+#include <QSemaphore>
+#include <QThreadPool>
+
+#include "peghighlighterresultcache.h"
+
 enum WorkerState
 {
     Idle,
@@ -8,12 +17,52 @@ enum WorkerState
     Finished
 };
 
+// Extract regions in parallel for documents with more blocks than this.
+#define PARALLEL_PARSE_BLOCK_NUMBER 2000
+
+// Run @m_func in a thread pool and release @m_done when finished.
+class RegionTask : public QRunnable
+{
+public:
+    RegionTask(const std::function<void()> &p_func, QSemaphore *p_done)
+        : m_func(p_func),
+          m_done(p_done)
+    {
+    }
+
+    void run() Q_DECL_OVERRIDE
+    {
+        m_func();
+        m_done->release();
+    }
+
+private:
+    std::function<void()> m_func;
+
+    QSemaphore *m_done;
+};
+
+// Pool shared by all the parser workers to extract regions.
+static QThreadPool *regionThreadPool()
+{
+    static QThreadPool pool;
+    return &pool;
+}
+
 void PegParseResult::parse(QAtomicInt &p_stop, bool p_fast)
 {
     if (p_fast) {
         return;
     }
 
+    // Each pass reads m_pmhElements only and writes its own regions.
+    if (!isIncremental()
+        && m_numOfBlocks > PARALLEL_PARSE_BLOCK_NUMBER
+        && QThread::idealThreadCount() > 1) {
+        parseInParallel(p_stop);
+        return;
+    }
+
     parseImageRegions(p_stop);
 
     parseHeaderRegions(p_stop);
@@ -33,6 +82,103 @@ void PegParseResult::parse(QAtomicInt &p_stop, bool p_fast)
     parseTableBorderRegions(p_stop);
 }
 
+void PegParseResult::parseInParallel(QAtomicInt &p_stop)
+{
+    QVector<std::function<void()>> passes;
+    passes << [this, &p_stop]() { parseHeaderRegions(p_stop); }
+           << [this, &p_stop]() { parseFencedCodeBlockRegions(p_stop); }
+           << [this, &p_stop]() { parseInlineEquationRegions(p_stop); }
+           << [this, &p_stop]() { parseDisplayFormulaRegions(p_stop); }
+           << [this, &p_stop]() { parseHRuleRegions(p_stop); }
+           << [this, &p_stop]() { parseTableRegions(p_stop); }
+           << [this, &p_stop]() { parseTableHeaderRegions(p_stop); }
+           << [this, &p_stop]() { parseTableBorderRegions(p_stop); };
+
+    QSemaphore done;
+    QThreadPool *pool = regionThreadPool();
+    for (const auto &pass : passes) {
+        pool->start(new RegionTask(pass, &done));
+    }
+
+    // Take one pass on current thread.
+    parseImageRegions(p_stop);
+
+    done.acquire(passes.size());
+}
+
+// Replace the regions of @p_base within [@p_start, @p_oldEnd) with @p_regs and
+// shift the regions after it by @p_delta.
+// Keep the order of @p_base.
+static void spliceRegions(QVector<VElementRegion> &p_regs,
+                          const QVector<VElementRegion> &p_base,
+                          int p_start,
+                          int p_oldEnd,
+                          int p_delta)
+{
+    QVector<VElementRegion> regs;
+    regs.reserve(p_base.size() + p_regs.size());
+    for (auto const &reg : p_base) {
+        if (reg.m_endPos <= p_start) {
+            regs.append(reg);
+        }
+    }
+
+    regs.append(p_regs);
+
+    for (auto const &reg : p_base) {
+        if (reg.m_startPos >= p_oldEnd) {
+            regs.append(VElementRegion(reg.m_startPos + p_delta, reg.m_endPos + p_delta));
+        }
+    }
+
+    p_regs = regs;
+}
+
+void PegParseResult::spliceBaseResult(QAtomicInt &p_stop,
+                                      const QSharedPointer<PegParseConfig> &p_config)
+{
+    Q_ASSERT(p_config->isIncremental());
+    const PegParseResult &base = *p_config->m_baseResult;
+    int start = p_config->m_offset;
+    int delta = p_config->m_charDelta;
+    int oldEnd = p_config->m_windowEnd - delta;
+
+    spliceRegions(m_imageRegions, base.m_imageRegions, start, oldEnd, delta);
+    spliceRegions(m_headerRegions, base.m_headerRegions, start, oldEnd, delta);
+
+    if (p_stop.load() == 1) {
+        return;
+    }
+
+    QMap<int, VElementRegion> codeBlockRegions;
+    for (auto it = base.m_codeBlockRegions.begin(); it != base.m_codeBlockRegions.end(); ++it) {
+        const VElementRegion &reg = it.value();
+        if (reg.m_endPos <= start) {
+            codeBlockRegions.insert(it.key(), reg);
+        } else if (reg.m_startPos >= oldEnd) {
+            codeBlockRegions.insert(it.key() + delta,
+                                    VElementRegion(reg.m_startPos + delta, reg.m_endPos + delta));
+        }
+    }
+
+    for (auto it = m_codeBlockRegions.begin(); it != m_codeBlockRegions.end(); ++it) {
+        codeBlockRegions.insert(it.key(), it.value());
+    }
+
+    m_codeBlockRegions = codeBlockRegions;
+
+    if (p_stop.load() == 1) {
+        return;
+    }
+
+    spliceRegions(m_inlineEquationRegions, base.m_inlineEquationRegions, start, oldEnd, delta);
+    spliceRegions(m_displayFormulaRegions, base.m_displayFormulaRegions, start, oldEnd, delta);
+    spliceRegions(m_hruleRegions, base.m_hruleRegions, start, oldEnd, delta);
+    spliceRegions(m_tableRegions, base.m_tableRegions, start, oldEnd, delta);
+    spliceRegions(m_tableHeaderRegions, base.m_tableHeaderRegions, start, oldEnd, delta);
+    spliceRegions(m_tableBorderRegions, base.m_tableBorderRegions, start, oldEnd, delta);
+}
+
 void PegParseResult::parseImageRegions(QAtomicInt &p_stop)
 {
     parseRegions(p_stop,
@@ -183,7 +329,8 @@ void PegParseResult::parseRegions(QAtomicInt &p_stop,
 PegParserWorker::PegParserWorker(QObject *p_parent)
     : QThread(p_parent),
       m_stop(0),
-      m_state(WorkerState::Idle)
+      m_state(WorkerState::Idle),
+      m_pmhAborted(false)
 {
 }
 
@@ -201,6 +348,7 @@ void PegParserWorker::reset()
     m_parseResult.reset();
     m_stop.store(0);
     m_state = WorkerState::Idle;
+    m_pmhAborted = false;
 }
 
 void PegParserWorker::stop()
@@ -231,14 +379,27 @@ QSharedPointer<PegParseResult> PegParserWorker::parseMarkdown(const QSharedPoint
         return result;
     }
 
-    result->m_pmhElements = PegParser::parseMarkdownToElements(p_config);
+    QElapsedTimer timer;
+    timer.start();
+
+    result->m_pmhElements = PegParser::parseMarkdownToElements(p_config, &p_stop);
 
     if (p_stop.load() == 1) {
+        m_pmhAborted = result->isEmpty();
         return result;
     }
 
     result->parse(p_stop, p_config->m_fast);
 
+    if (p_config->isIncremental() && p_stop.load() != 1) {
+        result->spliceBaseResult(p_stop, p_config);
+    }
+
+    if (!p_config->isIncremental() && !p_config->m_fast && p_stop.load() != 1) {
+        result->m_contentHash = PegHighlighterResultCache::hashContent(p_config->m_data);
+    }
+
+    result->m_parseTime = timer.elapsed();
     return result;
 }
 
@@ -246,7 +407,9 @@ QSharedPointer<PegParseResult> PegParserWorker::parseMarkdown(const QSharedPoint
 #define NUM_OF_THREADS 2
 
 PegParser::PegParser(QObject *p_parent)
-    : QObject(p_parent)
+    : QObject(p_parent),
+      m_numOfCancelledWorks(0),
+      m_numOfAbortedWorks(0)
 {
     init();
 }
@@ -311,6 +474,11 @@ void PegParser::handleWorkerFinished(PegParserWorker *p_worker)
     QSharedPointer<PegParseResult> result;
     if (p_worker->state() == WorkerState::Finished) {
         result = p_worker->parseResult();
+    } else if (p_worker->state() == WorkerState::Cancelled) {
+        ++m_numOfCancelledWorks;
+        if (p_worker->isPmhAborted()) {
+            ++m_numOfAbortedWorks;
+        }
     }
 
     p_worker->reset();
@@ -514,7 +682,13 @@ static QSharedPointer<char> tryFixUnicodeData(const char *p_data)
     return res;
 }
 
-pmh_element **PegParser::parseMarkdownToElements(const QSharedPointer<PegParseConfig> &p_config)
+static bool isPmhParseCancelled(void *p_context)
+{
+    return static_cast<QAtomicInt *>(p_context)->load() == 1;
+}
+
+pmh_element **PegParser::parseMarkdownToElements(const QSharedPointer<PegParseConfig> &p_config,
+                                                 QAtomicInt *p_stop)
 {
     if (p_config->m_data.isEmpty()) {
         return NULL;
@@ -534,6 +708,15 @@ pmh_element **PegParser::parseMarkdownToElements(const QSharedPointer<PegParseCo
         data = fixedData.data();
     }
 
-    pmh_markdown_to_elements(data, p_config->m_extensions, &pmhResult);
+    if (p_stop) {
+        pmh_markdown_to_elements_cancellable(data,
+                                             p_config->m_extensions,
+                                             isPmhParseCancelled,
+                                             p_stop,
+                                             &pmhResult);
+    } else {
+        pmh_markdown_to_elements(data, p_config->m_extensions, &pmhResult);
+    }
+
     return pmhResult;
 }
@@ -11,6 +11,8 @@
 #include "vconstants.h"
 #include "markdownhighlighterdata.h"
 
+struct PegParseResult;
+
 struct PegParseConfig
 {
     PegParseConfig()
@@ -18,7 +20,11 @@ struct PegParseConfig
           m_numOfBlocks(0),
           m_offset(0),
           m_extensions(pmh_EXT_NONE),
-          m_fast(false)
+          m_fast(false),
+          m_firstBlock(-1),
+          m_lastBlock(-1),
+          m_windowEnd(0),
+          m_charDelta(0)
     {
     }
 
@@ -36,11 +42,33 @@ struct PegParseConfig
     // Fast parse.
     bool m_fast;
 
+    // Incremental parse.
+    // m_data only contains blocks [m_firstBlock, m_lastBlock] and the results
+    // of other blocks are taken from m_baseResult.
+    QSharedPointer<PegParseResult> m_baseResult;
+
+    int m_firstBlock;
+
+    int m_lastBlock;
+
+    // End position of the parse window in the document.
+    int m_windowEnd;
+
+    // Characters added to the document since m_baseResult.
+    int m_charDelta;
+
+    bool isIncremental() const
+    {
+        return !m_baseResult.isNull();
+    }
+
     QString toString() const
     {
-        return QString("PegParseConfig ts %1 data %2 blocks %3").arg(m_timeStamp)
-                                                                .arg(m_data.size())
-                                                                .arg(m_numOfBlocks);
+        return QString("PegParseConfig ts %1 data %2 blocks %3 window [%4,%5]").arg(m_timeStamp)
+                                                                               .arg(m_data.size())
+                                                                               .arg(m_numOfBlocks)
+                                                                               .arg(m_firstBlock)
+                                                                               .arg(m_lastBlock);
     }
 };
 
@@ -50,8 +78,17 @@ struct PegParseResult
         : m_timeStamp(p_config->m_timeStamp),
           m_numOfBlocks(p_config->m_numOfBlocks),
           m_offset(p_config->m_offset),
+          m_baseTimeStamp(0),
+          m_firstBlock(-1),
+          m_lastBlock(-1),
+          m_parseTime(0),
           m_pmhElements(NULL)
     {
+        if (p_config->isIncremental()) {
+            m_baseTimeStamp = p_config->m_baseResult->m_timeStamp;
+            m_firstBlock = p_config->m_firstBlock;
+            m_lastBlock = p_config->m_lastBlock;
+        }
     }
 
     ~PegParseResult()
@@ -82,15 +119,39 @@ struct PegParseResult
         return !m_pmhElements;
     }
 
+    bool isIncremental() const
+    {
+        return m_baseTimeStamp > 0;
+    }
+
     // Parse m_pmhElements.
     void parse(QAtomicInt &p_stop, bool p_fast);
 
+    // Merge regions of @p_config->m_baseResult outside the parse window into
+    // this incremental result.
+    void spliceBaseResult(QAtomicInt &p_stop, const QSharedPointer<PegParseConfig> &p_config);
+
     TimeStamp m_timeStamp;
 
     int m_numOfBlocks;
 
     int m_offset;
 
+    // Timestamp of the result this incremental result is based on.
+    TimeStamp m_baseTimeStamp;
+
+    // Block range of the parse window of an incremental result, inclusive.
+    int m_firstBlock;
+
+    int m_lastBlock;
+
+    // Time in ms spent on the parse.
+    qint64 m_parseTime;
+
+    // Hash of the parsed data of a complete parse. Empty for incremental
+    // or fast parse.
+    QByteArray m_contentHash;
+
     pmh_element **m_pmhElements;
 
     // All image link regions.
@@ -125,6 +186,9 @@ struct PegParseResult
     QVector<VElementRegion> m_tableBorderRegions;
 
 private:
+    // Run the passes of parse() in a thread pool.
+    void parseInParallel(QAtomicInt &p_stop);
+
     void parseImageRegions(QAtomicInt &p_stop);
 
     void parseHeaderRegions(QAtomicInt &p_stop);
@@ -183,6 +247,12 @@ public:
         return m_parseResult;
     }
 
+    // Whether the last work was aborted inside pmh_markdown_to_elements().
+    bool isPmhAborted() const
+    {
+        return m_pmhAborted;
+    }
+
 public slots:
     void stop();
 
@@ -202,6 +272,8 @@ private:
 
     int m_state;
 
+    bool m_pmhAborted;
+
     QSharedPointer<PegParseConfig> m_parseConfig;
 
     QSharedPointer<PegParseResult> m_parseResult;
@@ -222,7 +294,21 @@ public:
     static QVector<VElementRegion> parseImageRegions(const QSharedPointer<PegParseConfig> &p_config);
 
     // MUST pmh_free_elements() the result.
-    static pmh_element **parseMarkdownToElements(const QSharedPointer<PegParseConfig> &p_config);
+    // Return NULL if it is aborted by @p_stop.
+    static pmh_element **parseMarkdownToElements(const QSharedPointer<PegParseConfig> &p_config,
+                                                 QAtomicInt *p_stop = NULL);
+
+    // Number of works cancelled since the parser was created.
+    int numOfCancelledWorks() const
+    {
+        return m_numOfCancelledWorks;
+    }
+
+    // Number of cancelled works aborted inside pmh_markdown_to_elements().
+    int numOfAbortedWorks() const
+    {
+        return m_numOfAbortedWorks;
+    }
 
 signals:
     void parseResultReady(const QSharedPointer<PegParseResult> &p_result);
@@ -243,6 +329,10 @@ private:
     QVector<PegParserWorker *> m_workers;
 
     QSharedPointer<PegParseConfig> m_pendingWork;
+
+    int m_numOfCancelledWorks;
+
+    int m_numOfAbortedWorks;
 };
 
 #endif // PEGPARSER_H
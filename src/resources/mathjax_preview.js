@@ -18,6 +18,7 @@ new QWebChannel(qt.webChannelTransport,
         content = channel.objects.content;
 
         content.requestPreviewMathJax.connect(previewMathJax);
+        content.requestPreviewMathJaxBatch.connect(previewMathJaxBatch);
         content.requestPreviewDiagram.connect(previewDiagram);
 
         channelInitialized = true;
@@ -36,12 +37,10 @@ var isEmptyMathJax = function(text) {
     return text.replace(/\$/g, '').trim().length == 0;
 };
 
-var previewMathJax = function(identifier, id, timeStamp, text, isHtml) {
-    timeStamps.set(identifier, timeStamp);
-
+// Returns a <p> element of MathJax @text, or null if it is empty.
+var createMathJaxElement = function(text, isHtml) {
     if (isEmptyMathJax(text)) {
-        content.mathjaxResultReady(identifier, id, timeStamp, 'png', '');
-        return;
+        return null;
     }
 
     var p = null;
@@ -60,6 +59,13 @@ var previewMathJax = function(identifier, id, timeStamp, text, isHtml) {
         p.textContent = text;
     }
 
+    return p;
+};
+
+var previewMathJax = function(identifier, id, timeStamp, text, isHtml) {
+    timeStamps.set(identifier, timeStamp);
+
+    var p = createMathJaxElement(text, isHtml);
     if (!p) {
         content.mathjaxResultReady(identifier, id, timeStamp, 'png', '');
         return;
@@ -83,8 +89,69 @@ var previewMathJax = function(identifier, id, timeStamp, text, isHtml) {
         });
 };
 
+// Typeset all the @texts in one MathJax pass and reply the PNG data of them
+// in one array of the same order. Empty data for failed ones.
+var previewMathJaxBatch = function(identifier, batchId, timeStamp, texts, isHtml) {
+    timeStamps.set(identifier, timeStamp);
+
+    var results = new Array(texts.length).fill('');
+    var elements = [];
+    var indexes = [];
+    for (var i = 0; i < texts.length; ++i) {
+        var p = createMathJaxElement(texts[i], isHtml);
+        if (p) {
+            contentDiv.appendChild(p);
+            elements.push(p);
+            indexes.push(i);
+        }
+    }
+
+    var finish = function() {
+        elements.forEach(function(p) {
+            contentDiv.removeChild(p);
+        });
+
+        content.mathjaxBatchResultReady(identifier, batchId, timeStamp, 'png', results);
+    };
+
+    if (elements.length == 0) {
+        finish();
+        return;
+    }
+
+    MathJax
+        .typesetPromise(elements)
+        .then(function () {
+            // Convert them one by one to bound the memory of canvases.
+            var chain = Promise.resolve();
+            elements.forEach(function(p, j) {
+                var idx = indexes[j];
+                var isBlock = texts[idx].indexOf('$$') !== -1;
+                chain = chain.then(function() {
+                    if (timeStamps.get(identifier) != timeStamp) {
+                        return;
+                    }
+
+                    var hei = p.clientHeight * 1.5 + (isBlock ? 20 : 5);
+                    return domtoimage.toPng(p, { height: hei }).then(function (dataUrl) {
+                        results[idx] = dataUrl.substring(dataUrl.indexOf(',') + 1);
+                    }).catch(function (err) {
+                        content.setLog("err: " + err);
+                    });
+                });
+            });
+
+            chain.then(finish);
+        }).catch(function (err) {
+            content.setLog("err: " + err);
+            finish();
+        });
+};
+
 var postProcessMathJax = function(identifier, id, timeStamp, container, isBlock) {
     if (timeStamps.get(identifier) != timeStamp) {
+        // Always reply so that the host could release the request.
+        content.mathjaxResultReady(identifier, id, timeStamp, 'png', '');
         contentDiv.removeChild(container);
         delete container;
         return;
@@ -113,6 +180,7 @@ var wavedromIdx = 0;
 
 var previewDiagram = function(identifier, id, timeStamp, lang, text) {
     if (text.length == 0) {
+        content.diagramResultReady(identifier, id, timeStamp, 'png', '');
         return;
     }
 
@@ -71,6 +71,14 @@ SOURCES += main.cpp\
     vnavigationmode.cpp \
     vorphanfile.cpp \
     vcodeblockhighlighthelper.cpp \
+    vcodeblocktokenizer.cpp \
+    vcodeblockhighlightcache.cpp \
+    vpreviewimagecache.cpp \
+    vthumbnailcache.cpp \
+    vdownloadscheduler.cpp \
+    vrendercache.cpp \
+    vrenderscheduler.cpp \
+    vgvcrenderer.cpp \
     vwebview.cpp \
     vmdtab.cpp \
     vhtmltab.cpp \
@@ -139,6 +147,7 @@ SOURCES += main.cpp\
     vlistfolderue.cpp \
     dialog/vfixnotebookdialog.cpp \
     vplantumlhelper.cpp \
+    vplantumlserver.cpp \
     vgraphvizhelper.cpp \
     vlivepreviewhelper.cpp \
     vmathjaxpreviewhelper.cpp \
@@ -156,6 +165,7 @@ SOURCES += main.cpp\
     pegmarkdownhighlighter.cpp \
     pegparser.cpp \
     peghighlighterresult.cpp \
+    peghighlighterresultcache.cpp \
     vtexteditcompleter.cpp \
     utils/vkeyboardlayoutmanager.cpp \
     dialog/vkeyboardlayoutmappingdialog.cpp \
@@ -209,6 +219,14 @@ HEADERS  += vmainwindow.h \
     vnavigationmode.h \
     vorphanfile.h \
     vcodeblockhighlighthelper.h \
+    vcodeblocktokenizer.h \
+    vcodeblockhighlightcache.h \
+    vpreviewimagecache.h \
+    vthumbnailcache.h \
+    vdownloadscheduler.h \
+    vrendercache.h \
+    vrenderscheduler.h \
+    vgvcrenderer.h \
     vwebview.h \
     vmdtab.h \
     vhtmltab.h \
@@ -282,6 +300,7 @@ HEADERS  += vmainwindow.h \
     vlistfolderue.h \
     dialog/vfixnotebookdialog.h \
     vplantumlhelper.h \
+    vplantumlserver.h \
     vgraphvizhelper.h \
     vlivepreviewhelper.h \
     vmathjaxpreviewhelper.h \
@@ -303,6 +322,7 @@ HEADERS  += vmainwindow.h \
     pegmarkdownhighlighter.h \
     pegparser.h \
     peghighlighterresult.h \
+    peghighlighterresultcache.h \
     vtexteditcompleter.h \
     vtextdocumentlayoutdata.h \
     utils/vkeyboardlayoutmanager.h \
@@ -324,6 +344,13 @@ macx {
     INCLUDEPATH += /usr/local/include
 }
 
+# Render Graphviz in process via libgvc: qmake CONFIG+=libgvc
+libgvc {
+    CONFIG += link_pkgconfig
+    PKGCONFIG += libgvc libcgraph
+    DEFINES += VNOTE_USE_LIBGVC
+}
+
 INCLUDEPATH += $$PWD/../peg-highlight
 DEPENDPATH += $$PWD/../peg-highlight
 
@@ -1411,6 +1411,38 @@ void VUtils::touchFile(const QString &p_file)
     file.close();
 }
 
+qint64 VUtils::evictFilesByTime(const QString &p_folder,
+                                const QString &p_nameFilter,
+                                qint64 p_capacity,
+                                const QString &p_companionSuffix)
+{
+    QDir dir(p_folder);
+    QFileInfoList files = dir.entryInfoList(QStringList() << p_nameFilter,
+                                            QDir::Files,
+                                            QDir::Time | QDir::Reversed);
+    qint64 size = 0;
+    for (const auto &file : files) {
+        size += file.size();
+    }
+
+    // From the oldest one.
+    for (const auto &file : files) {
+        if (size <= p_capacity) {
+            break;
+        }
+
+        if (!p_companionSuffix.isEmpty()) {
+            dir.remove(file.completeBaseName() + p_companionSuffix);
+        }
+
+        if (dir.remove(file.fileName())) {
+            size -= file.size();
+        }
+    }
+
+    return size;
+}
+
 bool VUtils::isMetaKey(int p_key)
 {
     return p_key == Qt::Key_Control
@@ -308,6 +308,16 @@ public:
     // If @p_file does not exists, create an empty file.
     static void touchFile(const QString &p_file);
 
+    // Remove files matching @p_nameFilter in @p_folder from the least recently
+    // modified one until the total size of them is within @p_capacity.
+    // @p_companionSuffix: suffix of the file with the same base name to
+    // remove along with each one, not counted in the size. Could be empty.
+    // Returns the total size of the files left.
+    static qint64 evictFilesByTime(const QString &p_folder,
+                                   const QString &p_nameFilter,
+                                   qint64 p_capacity,
+                                   const QString &p_companionSuffix = QString());
+
     // Ctrl, Meta, Shift, Alt.
     static bool isMetaKey(int p_key);
 
@@ -1,10 +1,18 @@
 #include "vapplication.h"
 
+#include "vpreviewimagecache.h"
+
 VApplication::VApplication(int &argc, char **argv)
     : QApplication(argc, argv)
 {
     connect(this, &QApplication::applicationStateChanged,
             this, &VApplication::onApplicationStateChanged);
+
+    // Pixmaps in the static cache should be gone before the application.
+    connect(this, &QCoreApplication::aboutToQuit,
+            this, []() {
+                VPreviewImageCache::clear();
+            });
 }
 
 void VApplication::onApplicationStateChanged(Qt::ApplicationState state)
@@ -0,0 +1,51 @@
+#include "vcodeblockhighlightcache.h"
+
+#include <QCryptographicHash>
+
+// 8MB by default.
+QCache<QByteArray, VCodeBlockHighlightCache::Entry> VCodeBlockHighlightCache::s_cache(8 * 1024 * 1024);
+
+int VCodeBlockHighlightCache::s_hits = 0;
+
+int VCodeBlockHighlightCache::s_misses = 0;
+
+QByteArray VCodeBlockHighlightCache::key(const QString &p_text,
+                                         const QString &p_lang,
+                                         const QString &p_highlighter)
+{
+    return QCryptographicHash::hash(p_text.toUtf8(), QCryptographicHash::Md5)
+           + '|' + p_lang.toUtf8()
+           + '|' + p_highlighter.toUtf8();
+}
+
+bool VCodeBlockHighlightCache::get(const QByteArray &p_key, QVector<HLUnitPos> &p_units)
+{
+    Entry *entry = s_cache.object(p_key);
+    if (entry) {
+        ++s_hits;
+        p_units = entry->m_units;
+        return true;
+    }
+
+    ++s_misses;
+    return false;
+}
+
+void VCodeBlockHighlightCache::insert(const QByteArray &p_key, const QVector<HLUnitPos> &p_units)
+{
+    int cost = p_key.size() + sizeof(Entry);
+    for (const auto &unit : p_units) {
+        cost += sizeof(HLUnitPos) + unit.m_style.size() * sizeof(QChar);
+    }
+
+    Entry *entry = new Entry();
+    entry->m_units = p_units;
+
+    // QCache will delete the entry if it exceeds the budget.
+    s_cache.insert(p_key, entry, cost);
+}
+
+void VCodeBlockHighlightCache::setCapacity(int p_bytes)
+{
+    s_cache.setMaxCost(qMax(0, p_bytes));
+}
@@ -0,0 +1,56 @@
+#ifndef VCODEBLOCKHIGHLIGHTCACHE_H
+#define VCODEBLOCKHIGHLIGHTCACHE_H
+
+#include <QCache>
+#include <QByteArray>
+#include <QString>
+#include <QVector>
+
+#include "markdownhighlighterdata.h"
+
+// Process-wide LRU cache of code block highlight results shared by all the
+// editors, with a memory budget in bytes.
+// Should be accessed in the main thread only.
+class VCodeBlockHighlightCache
+{
+public:
+    // @p_text: the raw text of the code block.
+    // @p_highlighter: which highlighter produces the units, since the native
+    // and the web highlighters differ in results.
+    static QByteArray key(const QString &p_text,
+                          const QString &p_lang,
+                          const QString &p_highlighter);
+
+    // Get the highlight units with position relative to the code block.
+    // Return false if not found.
+    static bool get(const QByteArray &p_key, QVector<HLUnitPos> &p_units);
+
+    static void insert(const QByteArray &p_key, const QVector<HLUnitPos> &p_units);
+
+    // Set the memory budget in bytes.
+    static void setCapacity(int p_bytes);
+
+    static int hits()
+    {
+        return s_hits;
+    }
+
+    static int misses()
+    {
+        return s_misses;
+    }
+
+private:
+    struct Entry
+    {
+        QVector<HLUnitPos> m_units;
+    };
+
+    static QCache<QByteArray, Entry> s_cache;
+
+    static int s_hits;
+
+    static int s_misses;
+};
+
+#endif // VCODEBLOCKHIGHLIGHTCACHE_H
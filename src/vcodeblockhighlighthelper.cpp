@@ -6,6 +6,52 @@
 #include "vdocument.h"
 #include "utils/vutils.h"
 #include "pegmarkdownhighlighter.h"
+#include "vcodeblocktokenizer.h"
+#include "vcodeblockhighlightcache.h"
+
+extern VConfigManager *g_config;
+
+VCodeBlockHighlightWorker::VCodeBlockHighlightWorker(QObject *p_parent)
+    : QThread(p_parent),
+      m_stop(0),
+      m_busy(false),
+      m_timeStamp(0)
+{
+}
+
+void VCodeBlockHighlightWorker::prepareHighlight(TimeStamp p_timeStamp,
+                                                 const QVector<Work> &p_works)
+{
+    Q_ASSERT(!m_busy);
+
+    m_busy = true;
+    m_timeStamp = p_timeStamp;
+    m_works = p_works;
+}
+
+void VCodeBlockHighlightWorker::reset()
+{
+    m_works.clear();
+    m_timeStamp = 0;
+    m_stop.store(0);
+    m_busy = false;
+}
+
+void VCodeBlockHighlightWorker::stop()
+{
+    m_stop.store(1);
+}
+
+void VCodeBlockHighlightWorker::run()
+{
+    for (auto &work : m_works) {
+        if (isAskedToStop()) {
+            return;
+        }
+
+        VCodeBlockTokenizer::highlight(work.m_lang, work.m_text, work.m_units);
+    }
+}
 
 VCodeBlockHighlightHelper::VCodeBlockHighlightHelper(PegMarkdownHighlighter *p_highlighter,
                                                      VDocument *p_vdoc,
@@ -14,8 +60,15 @@ VCodeBlockHighlightHelper::VCodeBlockHighlightHelper(PegMarkdownHighlighter *p_h
       m_highlighter(p_highlighter),
       m_vdocument(p_vdoc),
       m_type(p_type),
-      m_timeStamp(0)
+      m_timeStamp(0),
+      m_pendingTimeStamp(0)
 {
+    VCodeBlockHighlightCache::setCapacity(g_config->getCodeBlockHighlightCacheSize() * 1024 * 1024);
+
+    m_worker = new VCodeBlockHighlightWorker(this);
+    connect(m_worker, &VCodeBlockHighlightWorker::finished,
+            this, &VCodeBlockHighlightHelper::handleWorkerFinished);
+
     connect(m_highlighter, &PegMarkdownHighlighter::codeBlocksUpdated,
             this, &VCodeBlockHighlightHelper::handleCodeBlocksUpdated);
     connect(m_vdocument, &VDocument::textHighlighted,
@@ -26,6 +79,12 @@ VCodeBlockHighlightHelper::VCodeBlockHighlightHelper(PegMarkdownHighlighter *p_h
             m_highlighter, &PegMarkdownHighlighter::updateHighlight);
 }
 
+VCodeBlockHighlightHelper::~VCodeBlockHighlightHelper()
+{
+    m_worker->stop();
+    m_worker->wait();
+}
+
 QString VCodeBlockHighlightHelper::unindentCodeBlock(const QString &p_text)
 {
     if (p_text.isEmpty()) {
@@ -62,31 +121,77 @@ QString VCodeBlockHighlightHelper::unindentCodeBlock(const QString &p_text)
 void VCodeBlockHighlightHelper::handleCodeBlocksUpdated(TimeStamp p_timeStamp,
                                                         const QVector<VCodeBlock> &p_codeBlocks)
 {
-    if (!m_vdocument->isReadyToHighlight()) {
-        // Immediately return empty results.
-        QVector<HLUnitPos> emptyRes;
-        for (int i = 0; i < p_codeBlocks.size(); ++i) {
-            updateHighlightResults(p_timeStamp, 0, emptyRes);
-        }
-
-        return;
-    }
+    // Languages supported by VCodeBlockTokenizer are highlighted natively.
+    // Others fall back to the web side if it is ready.
+    bool webReady = m_vdocument->isReadyToHighlight();
 
     m_timeStamp = p_timeStamp;
     m_codeBlocks = p_codeBlocks;
+
+    QVector<VCodeBlockHighlightWorker::Work> works;
     for (int i = 0; i < m_codeBlocks.size(); ++i) {
         const VCodeBlock &block = m_codeBlocks[i];
-        auto it = m_cache.find(block.m_text);
-        if (it != m_cache.end()) {
-            // Hit cache.
-            qDebug() << "code block highlight hit cache" << p_timeStamp << i;
-            it.value().m_timeStamp = p_timeStamp;
-            updateHighlightResults(p_timeStamp, block.m_startPos, it.value().m_units);
-        } else {
+        QVector<HLUnitPos> units;
+        if (VCodeBlockHighlightCache::get(cacheKey(block), units)) {
+            updateHighlightResults(p_timeStamp, block.m_startPos, units);
+        } else if (VCodeBlockTokenizer::isLanguageSupported(block.m_lang)) {
+            VCodeBlockHighlightWorker::Work work;
+            work.m_index = i;
+            work.m_lang = block.m_lang;
+            work.m_text = block.m_text;
+            works.append(work);
+        } else if (webReady) {
             QString unindentedText = unindentCodeBlock(block.m_text);
             m_vdocument->highlightTextAsync(unindentedText, i, p_timeStamp);
+        } else {
+            // Immediately return empty results.
+            updateHighlightResults(p_timeStamp, 0, QVector<HLUnitPos>());
         }
     }
+
+    // Previous works are obsolete now.
+    m_pendingWorks = works;
+    m_pendingTimeStamp = p_timeStamp;
+    if (m_worker->isBusy() && m_worker->workTimeStamp() != p_timeStamp) {
+        m_worker->stop();
+    }
+
+    pickWork();
+}
+
+void VCodeBlockHighlightHelper::pickWork()
+{
+    if (m_pendingWorks.isEmpty() || m_worker->isBusy()) {
+        return;
+    }
+
+    m_worker->prepareHighlight(m_pendingTimeStamp, m_pendingWorks);
+    m_pendingWorks.clear();
+    m_worker->start();
+}
+
+void VCodeBlockHighlightHelper::handleWorkerFinished()
+{
+    TimeStamp ts = m_worker->workTimeStamp();
+    QVector<VCodeBlockHighlightWorker::Work> works;
+    if (!m_worker->isAskedToStop() && ts == m_timeStamp) {
+        works = m_worker->works();
+    }
+
+    m_worker->reset();
+
+    pickWork();
+
+    for (const auto &work : works) {
+        // Abandon obsolete result.
+        if (m_timeStamp != ts) {
+            return;
+        }
+
+        const VCodeBlock &block = m_codeBlocks.at(work.m_index);
+        VCodeBlockHighlightCache::insert(cacheKey(block), work.m_units);
+        updateHighlightResults(ts, block.m_startPos, work.m_units);
+    }
 }
 
 void VCodeBlockHighlightHelper::handleTextHighlightResult(const QString &p_html,
@@ -224,7 +329,7 @@ exit:
     }
 
     // Add it to cache.
-    addToHighlightCache(text, p_timeStamp, hlUnits);
+    VCodeBlockHighlightCache::insert(cacheKey(block), hlUnits);
 
     updateHighlightResults(p_timeStamp, startPos, hlUnits);
 }
@@ -285,23 +390,10 @@ bool VCodeBlockHighlightHelper::parseSpanElement(QXmlStreamReader &p_xml,
     return false;
 }
 
-void VCodeBlockHighlightHelper::addToHighlightCache(const QString &p_text,
-                                                    TimeStamp p_timeStamp,
-                                                    const QVector<HLUnitPos> &p_units)
+QByteArray VCodeBlockHighlightHelper::cacheKey(const VCodeBlock &p_block)
 {
-    const int c_maxEntries = 100;
-    const TimeStamp c_maxTimeStampSpan = 3;
-    if (m_cache.size() >= c_maxEntries) {
-        // Remove the oldest one.
-        TimeStamp ts = p_timeStamp - c_maxTimeStampSpan;
-        for (auto it = m_cache.begin(); it != m_cache.end();) {
-            if (it.value().m_timeStamp < ts) {
-                it = m_cache.erase(it);
-            } else {
-                ++it;
-            }
-        }
-    }
-
-    m_cache.insert(p_text, HLResult(p_timeStamp, p_units));
+    bool native = VCodeBlockTokenizer::isLanguageSupported(p_block.m_lang);
+    return VCodeBlockHighlightCache::key(p_block.m_text,
+                                         p_block.m_lang,
+                                         native ? "native" : "web");
 }
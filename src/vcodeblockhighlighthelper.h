@@ -5,13 +5,79 @@
 #include <QVector>
 #include <QAtomicInteger>
 #include <QXmlStreamReader>
-#include <QHash>
+#include <QThread>
 
 #include "vconfigmanager.h"
 
 class VDocument;
 class PegMarkdownHighlighter;
 
+// Highlight code blocks natively via VCodeBlockTokenizer in a thread.
+class VCodeBlockHighlightWorker : public QThread
+{
+    Q_OBJECT
+public:
+    struct Work
+    {
+        Work()
+            : m_index(-1)
+        {
+        }
+
+        // Index of the code block.
+        int m_index;
+
+        QString m_lang;
+
+        QString m_text;
+
+        // Relative position to the start of the code block.
+        QVector<HLUnitPos> m_units;
+    };
+
+    explicit VCodeBlockHighlightWorker(QObject *p_parent = nullptr);
+
+    void prepareHighlight(TimeStamp p_timeStamp, const QVector<Work> &p_works);
+
+    void reset();
+
+    // Busy from prepareHighlight() until reset().
+    bool isBusy() const
+    {
+        return m_busy;
+    }
+
+    TimeStamp workTimeStamp() const
+    {
+        return m_timeStamp;
+    }
+
+    const QVector<Work> &works() const
+    {
+        return m_works;
+    }
+
+    bool isAskedToStop() const
+    {
+        return m_stop.load() == 1;
+    }
+
+public slots:
+    void stop();
+
+protected:
+    void run() Q_DECL_OVERRIDE;
+
+private:
+    QAtomicInt m_stop;
+
+    bool m_busy;
+
+    TimeStamp m_timeStamp;
+
+    QVector<Work> m_works;
+};
+
 class VCodeBlockHighlightHelper : public QObject
 {
     Q_OBJECT
@@ -19,6 +85,8 @@ public:
     VCodeBlockHighlightHelper(PegMarkdownHighlighter *p_highlighter,
                               VDocument *p_vdoc, MarkdownConverterType p_type);
 
+    ~VCodeBlockHighlightHelper();
+
     // @p_text: text of fenced code block.
     // Get the indent level of the first line (fence) and unindent the whole block
     // to make the fence at the highest indent level.
@@ -32,23 +100,10 @@ private slots:
     void handleTextHighlightResult(const QString &p_html, int p_id, unsigned long long p_timeStamp);
 
 private:
-    struct HLResult
-    {
-        HLResult()
-            : m_timeStamp(0)
-        {
-        }
-
-        HLResult(TimeStamp p_timeStamp, const QVector<HLUnitPos> &p_units)
-            : m_timeStamp(p_timeStamp),
-              m_units(p_units)
-        {
-        }
+    void handleWorkerFinished();
 
-        TimeStamp m_timeStamp;
-
-        QVector<HLUnitPos> m_units;
-    };
+    // Start pending works if the worker is idle.
+    void pickWork();
 
     void parseHighlightResult(TimeStamp p_timeStamp, int p_idx, const QString &p_html);
 
@@ -61,9 +116,8 @@ private:
 
     void updateHighlightResults(TimeStamp p_timeStamp, int p_startPos, QVector<HLUnitPos> p_units);
 
-    void addToHighlightCache(const QString &p_text,
-                             TimeStamp p_timeStamp,
-                             const QVector<HLUnitPos> &p_units);
+    // Key of @p_block in VCodeBlockHighlightCache.
+    static QByteArray cacheKey(const VCodeBlock &p_block);
 
     PegMarkdownHighlighter *m_highlighter;
     VDocument *m_vdocument;
@@ -73,9 +127,12 @@ private:
 
     QVector<VCodeBlock> m_codeBlocks;
 
-    // Cache for highlight result, using the code block text as key.
-    // The HLResult has relative position only.
-    QHash<QString, HLResult> m_cache;
+    VCodeBlockHighlightWorker *m_worker;
+
+    // Works to be highlighted natively once the worker is idle.
+    QVector<VCodeBlockHighlightWorker::Work> m_pendingWorks;
+
+    TimeStamp m_pendingTimeStamp;
 };
 
 #endif // VCODEBLOCKHIGHLIGHTHELPER_H
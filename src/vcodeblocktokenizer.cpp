@@ -0,0 +1,612 @@
+#include "vcodeblocktokenizer.h"
+
+#include <QHash>
+#include <QSet>
+#include <QStringList>
+
+namespace
+{
+struct LanguageDef
+{
+    LanguageDef()
+        : m_caseInsensitive(false),
+          m_hashPreprocessor(false),
+          m_atMeta(false),
+          m_shellVariable(false),
+          m_tripleQuote(false)
+    {
+    }
+
+    QSet<QString> m_keywords;
+
+    QSet<QString> m_types;
+
+    QSet<QString> m_literals;
+
+    QSet<QString> m_builtins;
+
+    // Keywords followed by a name, such as "class" and "def".
+    QSet<QString> m_titleKeywords;
+
+    QStringList m_lineComments;
+
+    QString m_blockCommentStart;
+
+    QString m_blockCommentEnd;
+
+    QString m_stringDelimiters;
+
+    // Delimiters of strings which could span multiple lines.
+    QString m_multiLineDelimiters;
+
+    // Keywords are stored in lower case.
+    bool m_caseInsensitive;
+
+    // Lines beginning with # are preprocessor directives.
+    bool m_hashPreprocessor;
+
+    // @name is an annotation or decorator.
+    bool m_atMeta;
+
+    // $name and ${...} are variables, and # comments need a leading space.
+    bool m_shellVariable;
+
+    // Python-style """ and ''' strings.
+    bool m_tripleQuote;
+};
+}
+
+static QSet<QString> toSet(const char *p_words)
+{
+    QSet<QString> words;
+    const QStringList list = QString(p_words).split(' ', QString::SkipEmptyParts);
+    for (const auto &word : list) {
+        words.insert(word);
+    }
+
+    return words;
+}
+
+static LanguageDef cppDef()
+{
+    LanguageDef def;
+    def.m_keywords = toSet("alignas alignof asm auto break case catch class const "
+                           "constexpr const_cast continue decltype default delete do "
+                           "dynamic_cast else enum explicit export extern final for "
+                           "friend goto if inline mutable namespace new noexcept "
+                           "operator override private protected public register "
+                           "reinterpret_cast return sizeof static static_assert "
+                           "static_cast struct switch template this thread_local "
+                           "throw try typedef typeid typename union using virtual "
+                           "volatile while");
+    def.m_types = toSet("bool char char16_t char32_t double float int long short "
+                        "signed unsigned void wchar_t size_t ssize_t int8_t int16_t "
+                        "int32_t int64_t uint8_t uint16_t uint32_t uint64_t");
+    def.m_literals = toSet("true false nullptr NULL");
+    def.m_builtins = toSet("std string vector map set cout cin cerr endl printf "
+                           "fprintf sprintf malloc free memcpy memset strlen");
+    def.m_titleKeywords = toSet("class struct namespace enum union");
+    def.m_lineComments << "//";
+    def.m_blockCommentStart = "/*";
+    def.m_blockCommentEnd = "*/";
+    def.m_stringDelimiters = "\"'";
+    def.m_hashPreprocessor = true;
+    return def;
+}
+
+static LanguageDef javaDef()
+{
+    LanguageDef def;
+    def.m_keywords = toSet("abstract assert break case catch class continue default "
+                           "do else enum extends final finally for if implements "
+                           "import instanceof interface native new package private "
+                           "protected public return static strictfp super switch "
+                           "synchronized this throw throws transient try var "
+                           "volatile while");
+    def.m_types = toSet("boolean byte char double float int long short void");
+    def.m_literals = toSet("true false null");
+    def.m_builtins = toSet("String Object System Integer Long Double Boolean List "
+                           "Map Set ArrayList HashMap");
+    def.m_titleKeywords = toSet("class interface enum");
+    def.m_lineComments << "//";
+    def.m_blockCommentStart = "/*";
+    def.m_blockCommentEnd = "*/";
+    def.m_stringDelimiters = "\"'";
+    def.m_atMeta = true;
+    return def;
+}
+
+static LanguageDef csharpDef()
+{
+    LanguageDef def;
+    def.m_keywords = toSet("abstract as async await base break case catch checked "
+                           "class const continue default delegate do else enum event "
+                           "explicit extern finally fixed for foreach get goto if "
+                           "implicit in interface internal is lock namespace new "
+                           "operator out override params private protected public "
+                           "readonly ref return sealed set sizeof stackalloc static "
+                           "struct switch this throw try typeof unchecked unsafe "
+                           "using var virtual volatile while");
+    def.m_types = toSet("bool byte char decimal double dynamic float int long object "
+                        "sbyte short string uint ulong ushort void");
+    def.m_literals = toSet("true false null");
+    def.m_builtins = toSet("Console String Math List Dictionary Task");
+    def.m_titleKeywords = toSet("class interface struct enum namespace");
+    def.m_lineComments << "//";
+    def.m_blockCommentStart = "/*";
+    def.m_blockCommentEnd = "*/";
+    def.m_stringDelimiters = "\"'";
+    def.m_hashPreprocessor = true;
+    return def;
+}
+
+static LanguageDef javascriptDef()
+{
+    LanguageDef def;
+    def.m_keywords = toSet("abstract as async await break case catch class const "
+                           "continue debugger declare default delete do else enum "
+                           "export extends finally for from function get if "
+                           "implements import in instanceof interface keyof let "
+                           "namespace new of private protected public readonly return "
+                           "set static super switch this throw try type typeof var "
+                           "void while with yield");
+    def.m_types = toSet("any boolean never number object string symbol unknown");
+    def.m_literals = toSet("true false null undefined NaN Infinity");
+    def.m_builtins = toSet("console window document Math JSON Object Array String "
+                           "Number Promise Map Set require module exports");
+    def.m_titleKeywords = toSet("function class interface");
+    def.m_lineComments << "//";
+    def.m_blockCommentStart = "/*";
+    def.m_blockCommentEnd = "*/";
+    def.m_stringDelimiters = "\"'`";
+    def.m_multiLineDelimiters = "`";
+    def.m_atMeta = true;
+    return def;
+}
+
+static LanguageDef pythonDef()
+{
+    LanguageDef def;
+    def.m_keywords = toSet("and as assert async await break class continue def del "
+                           "elif else except finally for from global if import in "
+                           "is lambda nonlocal not or pass raise return try while "
+                           "with yield");
+    def.m_literals = toSet("True False None");
+    def.m_builtins = toSet("abs all any bool dict enumerate filter float int "
+                           "isinstance len list map max min open print range self "
+                           "set sorted str sum super tuple type zip");
+    def.m_titleKeywords = toSet("def class");
+    def.m_lineComments << "#";
+    def.m_stringDelimiters = "\"'";
+    def.m_atMeta = true;
+    def.m_tripleQuote = true;
+    return def;
+}
+
+static LanguageDef goDef()
+{
+    LanguageDef def;
+    def.m_keywords = toSet("break case chan const continue default defer else "
+                           "fallthrough for func go goto if import interface map "
+                           "package range return select struct switch type var");
+    def.m_types = toSet("bool byte complex64 complex128 error float32 float64 int "
+                        "int8 int16 int32 int64 rune string uint uint8 uint16 "
+                        "uint32 uint64 uintptr");
+    def.m_literals = toSet("true false nil iota");
+    def.m_builtins = toSet("append cap close copy delete len make new panic print "
+                           "println recover");
+    def.m_titleKeywords = toSet("func type");
+    def.m_lineComments << "//";
+    def.m_blockCommentStart = "/*";
+    def.m_blockCommentEnd = "*/";
+    def.m_stringDelimiters = "\"'`";
+    def.m_multiLineDelimiters = "`";
+    return def;
+}
+
+static LanguageDef rustDef()
+{
+    LanguageDef def;
+    def.m_keywords = toSet("as async await break const continue crate dyn else enum "
+                           "extern fn for if impl in let loop match mod move mut pub "
+                           "ref return self Self static struct super trait type "
+                           "unsafe use where while");
+    def.m_types = toSet("bool char f32 f64 i8 i16 i32 i64 i128 isize str u8 u16 u32 "
+                        "u64 u128 usize String Vec Option Result Box");
+    def.m_literals = toSet("true false Some None Ok Err");
+    def.m_builtins = toSet("println print format vec panic assert assert_eq");
+    def.m_titleKeywords = toSet("fn struct enum trait mod");
+    def.m_lineComments << "//";
+    def.m_blockCommentStart = "/*";
+    def.m_blockCommentEnd = "*/";
+    def.m_stringDelimiters = "\"'";
+    def.m_multiLineDelimiters = "\"";
+    return def;
+}
+
+static LanguageDef shellDef()
+{
+    LanguageDef def;
+    def.m_keywords = toSet("if then else elif fi case esac for while until do done "
+                           "in function select return break continue exit local "
+                           "export readonly declare unset shift source alias");
+    def.m_literals = toSet("true false");
+    def.m_builtins = toSet("echo cd pwd ls cat grep sed awk printf read test set "
+                           "eval exec trap kill mkdir rm cp mv chmod sudo");
+    def.m_titleKeywords = toSet("function");
+    def.m_lineComments << "#";
+    def.m_stringDelimiters = "\"'";
+    def.m_multiLineDelimiters = "\"'";
+    def.m_shellVariable = true;
+    return def;
+}
+
+static LanguageDef jsonDef()
+{
+    LanguageDef def;
+    def.m_literals = toSet("true false null");
+    def.m_stringDelimiters = "\"";
+    return def;
+}
+
+static LanguageDef sqlDef()
+{
+    LanguageDef def;
+    def.m_keywords = toSet("select from where insert into values update set delete "
+                           "create table drop alter index view join inner left right "
+                           "outer full on as and or not is in exists between like "
+                           "order by group having limit offset union all distinct "
+                           "primary key foreign references default case when then "
+                           "else end begin commit rollback");
+    def.m_types = toSet("int integer bigint smallint varchar char text date datetime "
+                        "timestamp float double decimal boolean blob");
+    def.m_literals = toSet("true false null");
+    def.m_builtins = toSet("count sum avg min max coalesce");
+    def.m_lineComments << "--";
+    def.m_blockCommentStart = "/*";
+    def.m_blockCommentEnd = "*/";
+    def.m_stringDelimiters = "'\"";
+    def.m_caseInsensitive = true;
+    return def;
+}
+
+// Map from language name or alias to its definition.
+static const QHash<QString, const LanguageDef *> &languages()
+{
+    static const LanguageDef cpp = cppDef();
+    static const LanguageDef java = javaDef();
+    static const LanguageDef csharp = csharpDef();
+    static const LanguageDef javascript = javascriptDef();
+    static const LanguageDef python = pythonDef();
+    static const LanguageDef go = goDef();
+    static const LanguageDef rust = rustDef();
+    static const LanguageDef shell = shellDef();
+    static const LanguageDef json = jsonDef();
+    static const LanguageDef sql = sqlDef();
+
+    static const QHash<QString, const LanguageDef *> langs = []() {
+        QHash<QString, const LanguageDef *> hash;
+        auto add = [&hash](const char *p_names, const LanguageDef *p_def) {
+            for (const auto &name : toSet(p_names)) {
+                hash.insert(name, p_def);
+            }
+        };
+
+        add("c cpp c++ cc cxx h hpp hh", &cpp);
+        add("java", &java);
+        add("cs csharp c#", &csharp);
+        add("js javascript jsx ts typescript tsx", &javascript);
+        add("py python python3", &python);
+        add("go golang", &go);
+        add("rs rust", &rust);
+        add("sh bash shell zsh", &shell);
+        add("json", &json);
+        add("sql", &sql);
+        return hash;
+    }();
+
+    return langs;
+}
+
+static const LanguageDef *findLanguage(const QString &p_lang)
+{
+    const auto &langs = languages();
+    auto it = langs.find(p_lang.toLower());
+    if (it == langs.end()) {
+        return NULL;
+    }
+
+    return it.value();
+}
+
+bool VCodeBlockTokenizer::isLanguageSupported(const QString &p_lang)
+{
+    return findLanguage(p_lang) != NULL;
+}
+
+static bool isIdentifierStart(QChar p_ch)
+{
+    return p_ch.isLetter() || p_ch == '_';
+}
+
+static bool isIdentifierChar(QChar p_ch)
+{
+    return p_ch.isLetterOrNumber() || p_ch == '_';
+}
+
+static int skipToLineEnd(const QString &p_text, int p_idx, int p_end)
+{
+    int idx = p_text.indexOf('\n', p_idx);
+    return (idx == -1 || idx > p_end) ? p_end : idx;
+}
+
+// Return the end of the string started at @p_idx, or -1 if it is not closed.
+static int scanString(const QString &p_text,
+                      int p_idx,
+                      int p_end,
+                      const QString &p_delimiter,
+                      bool p_multiLine)
+{
+    int idx = p_idx + p_delimiter.size();
+    while (idx < p_end) {
+        QChar ch = p_text[idx];
+        if (ch == '\\') {
+            idx += 2;
+            continue;
+        }
+
+        if (ch == '\n' && !p_multiLine) {
+            return -1;
+        }
+
+        if (p_text.midRef(idx, p_delimiter.size()) == p_delimiter) {
+            return idx + p_delimiter.size();
+        }
+
+        ++idx;
+    }
+
+    return -1;
+}
+
+// Return the end of a shell variable started at @p_idx, or -1 if it is not one.
+static int scanShellVariable(const QString &p_text, int p_idx, int p_end)
+{
+    int idx = p_idx + 1;
+    if (idx >= p_end) {
+        return -1;
+    }
+
+    QChar ch = p_text[idx];
+    if (ch == '{') {
+        int close = p_text.indexOf('}', idx);
+        int lineEnd = skipToLineEnd(p_text, idx, p_end);
+        return (close == -1 || close > lineEnd) ? -1 : close + 1;
+    } else if (isIdentifierStart(ch)) {
+        while (idx < p_end && isIdentifierChar(p_text[idx])) {
+            ++idx;
+        }
+
+        return idx;
+    } else if (ch.isDigit() || QString("#?@*!$-").contains(ch)) {
+        return idx + 1;
+    }
+
+    return -1;
+}
+
+static int scanNumber(const QString &p_text, int p_idx, int p_end)
+{
+    int idx = p_idx;
+    while (idx < p_end) {
+        QChar ch = p_text[idx];
+        if (ch.isLetterOrNumber() || ch == '_' || ch == '.') {
+            QChar lower = ch.toLower();
+            ++idx;
+            // Exponent sign, like 1e-5.
+            if ((lower == 'e' || lower == 'p')
+                && idx < p_end
+                && (p_text[idx] == '+' || p_text[idx] == '-')) {
+                ++idx;
+            }
+        } else {
+            break;
+        }
+    }
+
+    return idx;
+}
+
+// Get the range of the code within the fences.
+static void codeRange(const QString &p_text, int &p_start, int &p_end)
+{
+    p_start = p_text.indexOf('\n');
+    if (p_start == -1) {
+        p_start = p_end = p_text.size();
+        return;
+    }
+
+    ++p_start;
+    p_end = p_text.size();
+
+    int lastLine = p_text.lastIndexOf('\n') + 1;
+    if (lastLine >= p_start) {
+        QStringRef line = p_text.midRef(lastLine).trimmed();
+        if (line.startsWith("```") || line.startsWith("~~~")) {
+            p_end = lastLine;
+        }
+    }
+}
+
+bool VCodeBlockTokenizer::highlight(const QString &p_lang,
+                                    const QString &p_text,
+                                    QVector<HLUnitPos> &p_units)
+{
+    const LanguageDef *def = findLanguage(p_lang);
+    if (!def) {
+        return false;
+    }
+
+    int idx, end;
+    codeRange(p_text, idx, end);
+
+    bool lineStart = true;
+    bool expectTitle = false;
+    while (idx < end) {
+        QChar ch = p_text[idx];
+        if (ch == '\n') {
+            lineStart = true;
+            ++idx;
+            continue;
+        }
+
+        if (ch.isSpace()) {
+            ++idx;
+            continue;
+        }
+
+        bool atLineStart = lineStart;
+        lineStart = false;
+
+        // Preprocessor directive.
+        if (atLineStart && def->m_hashPreprocessor && ch == '#') {
+            int next = skipToLineEnd(p_text, idx, end);
+            p_units.append(HLUnitPos(idx, next - idx, "hljs-meta"));
+            idx = next;
+            continue;
+        }
+
+        // Line comment.
+        bool matched = false;
+        for (const auto &token : def->m_lineComments) {
+            if (p_text.midRef(idx, token.size()) != token) {
+                continue;
+            }
+
+            if (def->m_shellVariable && idx > 0 && !p_text[idx - 1].isSpace()) {
+                continue;
+            }
+
+            int next = skipToLineEnd(p_text, idx, end);
+            p_units.append(HLUnitPos(idx, next - idx, "hljs-comment"));
+            idx = next;
+            matched = true;
+            break;
+        }
+
+        if (matched) {
+            continue;
+        }
+
+        // Block comment.
+        if (!def->m_blockCommentStart.isEmpty()
+            && p_text.midRef(idx, def->m_blockCommentStart.size()) == def->m_blockCommentStart) {
+            int next = p_text.indexOf(def->m_blockCommentEnd,
+                                      idx + def->m_blockCommentStart.size());
+            next = (next == -1 || next >= end) ? end : next + def->m_blockCommentEnd.size();
+            p_units.append(HLUnitPos(idx, next - idx, "hljs-comment"));
+            idx = next;
+            continue;
+        }
+
+        // String.
+        if (def->m_stringDelimiters.contains(ch)) {
+            QString delimiter(ch);
+            bool multiLine = def->m_multiLineDelimiters.contains(ch);
+            if (def->m_tripleQuote && p_text.midRef(idx, 3) == QString(3, ch)) {
+                delimiter = QString(3, ch);
+                multiLine = true;
+            }
+
+            int next = scanString(p_text, idx, end, delimiter, multiLine);
+            if (next != -1) {
+                p_units.append(HLUnitPos(idx, next - idx, "hljs-string"));
+                idx = next;
+            } else {
+                // Not closed, such as Rust lifetime 'a.
+                ++idx;
+            }
+
+            continue;
+        }
+
+        // Shell variable.
+        if (def->m_shellVariable && ch == '$') {
+            int next = scanShellVariable(p_text, idx, end);
+            if (next != -1) {
+                p_units.append(HLUnitPos(idx, next - idx, "hljs-variable"));
+                idx = next;
+            } else {
+                ++idx;
+            }
+
+            continue;
+        }
+
+        // Annotation or decorator.
+        if (def->m_atMeta
+            && ch == '@'
+            && idx + 1 < end
+            && isIdentifierStart(p_text[idx + 1])) {
+            int next = idx + 1;
+            while (next < end && (isIdentifierChar(p_text[next]) || p_text[next] == '.')) {
+                ++next;
+            }
+
+            p_units.append(HLUnitPos(idx, next - idx, "hljs-meta"));
+            idx = next;
+            continue;
+        }
+
+        // Number.
+        if (ch.isDigit()
+            || (ch == '.' && idx + 1 < end && p_text[idx + 1].isDigit())) {
+            int next = scanNumber(p_text, idx, end);
+            p_units.append(HLUnitPos(idx, next - idx, "hljs-number"));
+            idx = next;
+            expectTitle = false;
+            continue;
+        }
+
+        // Identifier.
+        if (isIdentifierStart(ch)) {
+            int next = idx + 1;
+            while (next < end && isIdentifierChar(p_text[next])) {
+                ++next;
+            }
+
+            QString word = p_text.mid(idx, next - idx);
+            if (def->m_caseInsensitive) {
+                word = word.toLower();
+            }
+
+            const char *style = NULL;
+            if (def->m_keywords.contains(word)) {
+                style = "hljs-keyword";
+                expectTitle = def->m_titleKeywords.contains(word);
+            } else if (expectTitle) {
+                style = "hljs-title";
+                expectTitle = false;
+            } else if (def->m_types.contains(word)) {
+                style = "hljs-type";
+            } else if (def->m_literals.contains(word)) {
+                style = "hljs-literal";
+            } else if (def->m_builtins.contains(word)) {
+                style = "hljs-built_in";
+            }
+
+            if (style) {
+                p_units.append(HLUnitPos(idx, next - idx, style));
+            }
+
+            idx = next;
+            continue;
+        }
+
+        // Punctuation.
+        expectTitle = false;
+        ++idx;
+    }
+
+    return true;
+}
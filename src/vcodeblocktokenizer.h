@@ -0,0 +1,28 @@
+#ifndef VCODEBLOCKTOKENIZER_H
+#define VCODEBLOCKTOKENIZER_H
+
+#include <QString>
+#include <QVector>
+
+#include "markdownhighlighterdata.h"
+
+// Native highlighter for fenced code blocks of common languages.
+// It scans the code with a simple table-driven tokenizer and produces
+// highlight units using the same style names as highlight.js (hljs-*), so the
+// result could be rendered with the code block styles of the theme.
+// It is stateless and could be used from any thread.
+class VCodeBlockTokenizer
+{
+public:
+    // Whether @p_lang could be highlighted natively.
+    static bool isLanguageSupported(const QString &p_lang);
+
+    // @p_text: the raw text of the fenced code block, including the fences.
+    // Append the highlight units to @p_units, using positions relative to @p_text.
+    // Return false if @p_lang is not supported.
+    static bool highlight(const QString &p_lang,
+                          const QString &p_text,
+                          QVector<HLUnitPos> &p_units);
+};
+
+#endif // VCODEBLOCKTOKENIZER_H
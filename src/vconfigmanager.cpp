@@ -46,6 +46,8 @@ const QString VConfigManager::c_snippetConfigFolder = QString("snippets");
 
 const QString VConfigManager::c_resourceConfigFolder = QString("resources");
 
+const QString VConfigManager::c_cacheConfigFolder = QString("cache");
+
 const QString VConfigManager::c_warningTextStyle = QString("color: #C9302C; font: bold");
 
 const QString VConfigManager::c_dataTextStyle = QString("font: bold");
@@ -208,6 +210,30 @@ void VConfigManager::initialize()
     m_markdownHighlightInterval = getConfigFromSettings("global",
                                                         "markdown_highlight_interval").toInt();
 
+    m_markdownHighlightIntervalMin = getConfigFromSettings("global",
+                                                           "markdown_highlight_interval_min").toInt();
+
+    m_markdownHighlightIntervalMax = getConfigFromSettings("global",
+                                                           "markdown_highlight_interval_max").toInt();
+
+    m_markdownHighlightCacheSize = getConfigFromSettings("global",
+                                                         "markdown_highlight_cache_size").toInt();
+
+    m_codeBlockHighlightCacheSize = getConfigFromSettings("global",
+                                                          "code_block_highlight_cache_size").toInt();
+
+    m_previewImageCacheSize = getConfigFromSettings("global",
+                                                    "preview_image_cache_size").toInt();
+
+    m_previewThumbnailCacheSize = getConfigFromSettings("global",
+                                                        "preview_thumbnail_cache_size").toInt();
+
+    m_downloadCacheSize = getConfigFromSettings("global",
+                                                "download_cache_size").toInt();
+
+    m_renderCacheSize = getConfigFromSettings("global",
+                                              "render_cache_size").toInt();
+
     m_lineDistanceHeight = getConfigFromSettings("global",
                                                  "line_distance_height").toInt();
 
@@ -406,6 +432,10 @@ void VConfigManager::initEditorConfigs()
     m_enableSmartTable = getConfigFromSettings(section, "enable_smart_table").toBool();
 
     m_tableFormatIntervalMS = getConfigFromSettings(section, "table_format_interval").toInt();
+
+    m_lazyLayoutBlockNumber = getConfigFromSettings(section, "lazy_layout_block_number").toInt();
+
+    m_blockTileCacheSize = getConfigFromSettings(section, "block_tile_cache_size").toInt();
 }
 
 void VConfigManager::initMarkdownConfigs()
@@ -920,6 +950,11 @@ QString VConfigManager::getResourceConfigFolder() const
     return QDir(getConfigFolder()).filePath(c_resourceConfigFolder);
 }
 
+QString VConfigManager::getCacheConfigFolder() const
+{
+    return QDir(getConfigFolder()).filePath(c_cacheConfigFolder);
+}
+
 const QString &VConfigManager::getCommonCssUrl() const
 {
     static QString cssPath;
@@ -359,6 +359,22 @@ public:
 
     int getMarkdownHighlightInterval() const;
 
+    int getMarkdownHighlightIntervalMin() const;
+
+    int getMarkdownHighlightIntervalMax() const;
+
+    int getMarkdownHighlightCacheSize() const;
+
+    int getCodeBlockHighlightCacheSize() const;
+
+    int getPreviewImageCacheSize() const;
+
+    int getPreviewThumbnailCacheSize() const;
+
+    int getDownloadCacheSize() const;
+
+    int getRenderCacheSize() const;
+
     int getLineDistanceHeight() const;
 
     bool getInsertTitleFromNoteName() const;
@@ -480,6 +496,9 @@ public:
     // Get the folder c_resourceConfigFolder in the config folder.
     QString getResourceConfigFolder() const;
 
+    // Get the folder c_cacheConfigFolder in the config folder.
+    QString getCacheConfigFolder() const;
+
     const QString &getCommonCssUrl() const;
 
     // All the editor styles.
@@ -646,6 +665,10 @@ public:
 
     int getTableFormatInterval() const;
 
+    int getLazyLayoutBlockNumber() const;
+
+    int getBlockTileCacheSize() const;
+
     bool getEnableCodeBlockCopyButton() const;
     void setEnableCodeBlockCopyButton(bool p_enabled);
 
@@ -996,6 +1019,29 @@ private:
     // Interval for PegMarkdownHighlighter highlight timer (milliseconds).
     int m_markdownHighlightInterval;
 
+    // Bounds of the adaptive highlight timer interval (milliseconds).
+    int m_markdownHighlightIntervalMin;
+
+    int m_markdownHighlightIntervalMax;
+
+    // Memory budget of the highlight results cache (MB).
+    int m_markdownHighlightCacheSize;
+
+    // Memory budget of the code block highlight cache (MB).
+    int m_codeBlockHighlightCacheSize;
+
+    // Memory budget of the preview image cache (MB).
+    int m_previewImageCacheSize;
+
+    // Disk budget of the preview thumbnail cache (MB).
+    int m_previewThumbnailCacheSize;
+
+    // Disk budget of the download cache (MB).
+    int m_downloadCacheSize;
+
+    // Disk budget of the render cache (MB).
+    int m_renderCacheSize;
+
     // Line distance height in pixel.
     int m_lineDistanceHeight;
 
@@ -1237,6 +1283,15 @@ private:
     // Interval (milliseconds) to format table.
     int m_tableFormatIntervalMS;
 
+    // Layout only the visible blocks of a document with more blocks than this
+    // and estimate the heights of the others.
+    // 0 to disable it.
+    int m_lazyLayoutBlockNumber;
+
+    // Size (MB) of the cache of rasterized blocks shared by all the editors.
+    // 0 to disable it.
+    int m_blockTileCacheSize;
+
     // Whether enable copy button in code block in read mode.
     bool m_enableCodeBlockCopyButton;
 
@@ -1291,6 +1346,9 @@ private:
 
     // The folder name of resource files.
     static const QString c_resourceConfigFolder;
+
+    // The folder name of cache files.
+    static const QString c_cacheConfigFolder;
 };
 
 
@@ -2166,6 +2224,46 @@ inline int VConfigManager::getMarkdownHighlightInterval() const
     return m_markdownHighlightInterval;
 }
 
+inline int VConfigManager::getMarkdownHighlightIntervalMin() const
+{
+    return m_markdownHighlightIntervalMin;
+}
+
+inline int VConfigManager::getMarkdownHighlightIntervalMax() const
+{
+    return m_markdownHighlightIntervalMax;
+}
+
+inline int VConfigManager::getMarkdownHighlightCacheSize() const
+{
+    return m_markdownHighlightCacheSize;
+}
+
+inline int VConfigManager::getCodeBlockHighlightCacheSize() const
+{
+    return m_codeBlockHighlightCacheSize;
+}
+
+inline int VConfigManager::getPreviewImageCacheSize() const
+{
+    return m_previewImageCacheSize;
+}
+
+inline int VConfigManager::getPreviewThumbnailCacheSize() const
+{
+    return m_previewThumbnailCacheSize;
+}
+
+inline int VConfigManager::getDownloadCacheSize() const
+{
+    return m_downloadCacheSize;
+}
+
+inline int VConfigManager::getRenderCacheSize() const
+{
+    return m_renderCacheSize;
+}
+
 inline int VConfigManager::getLineDistanceHeight() const
 {
     return m_lineDistanceHeight;
@@ -3077,6 +3175,16 @@ inline int VConfigManager::getTableFormatInterval() const
     return m_tableFormatIntervalMS;
 }
 
+inline int VConfigManager::getLazyLayoutBlockNumber() const
+{
+    return m_lazyLayoutBlockNumber;
+}
+
+inline int VConfigManager::getBlockTileCacheSize() const
+{
+    return m_blockTileCacheSize;
+}
+
 inline bool VConfigManager::getEnableCodeBlockCopyButton() const
 {
     return m_enableCodeBlockCopyButton;
@@ -17,6 +17,7 @@ void VDownloader::handleDownloadFinished(QNetworkReply *reply)
 
     data = reply->readAll();
     reply->deleteLater();
+    emit downloadReplied(reply, data);
     // The url() of the reply may be redirected and different from that of the request.
     emit downloadFinished(data, reply->request().url().toString());
 }
@@ -36,13 +37,19 @@ static QNetworkRequest networkRequest(const QUrl &p_url)
     return request;
 }
 
-void VDownloader::download(const QUrl &p_url)
+void VDownloader::download(const QUrl &p_url,
+                           const QHash<QByteArray, QByteArray> &p_headers)
 {
     if (!p_url.isValid()) {
         return;
     }
 
-    webCtrl.get(networkRequest(p_url));
+    QNetworkRequest request = networkRequest(p_url);
+    for (auto it = p_headers.begin(); it != p_headers.end(); ++it) {
+        request.setRawHeader(it.key(), it.value());
+    }
+
+    webCtrl.get(request);
 }
 
 QByteArray VDownloader::downloadSync(const QUrl &p_url)
@@ -7,13 +7,17 @@
 #include <QNetworkAccessManager>
 #include <QNetworkRequest>
 #include <QNetworkReply>
+#include <QHash>
 
 class VDownloader : public QObject
 {
     Q_OBJECT
 public:
     explicit VDownloader(QObject *parent = 0);
-    void download(const QUrl &p_url);
+
+    // @p_headers: extra raw headers of the request.
+    void download(const QUrl &p_url,
+                  const QHash<QByteArray, QByteArray> &p_headers = QHash<QByteArray, QByteArray>());
 
     static QByteArray downloadSync(const QUrl &p_url);
 
@@ -21,6 +25,10 @@ signals:
     // Url is the original url of the request.
     void downloadFinished(const QByteArray &data, const QString &url);
 
+    // Emitted before downloadFinished() with the reply for status and headers.
+    // @p_reply will be deleted later.
+    void downloadReplied(QNetworkReply *p_reply, const QByteArray &p_data);
+
 private slots:
     void handleDownloadFinished(QNetworkReply *reply);
 
@@ -0,0 +1,252 @@
+#include "vdownloadscheduler.h"
+
+#include <QCryptographicHash>
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QNetworkReply>
+#include <QSaveFile>
+#include <QTimer>
+#include <QUrl>
+
+#include "vdownloader.h"
+#include "utils/vutils.h"
+
+#define MAX_CONCURRENT_DOWNLOADS 4
+
+#define MAX_DOWNLOAD_RETRIES 2
+
+// Delay of the first retry. Doubled for each retry.
+#define DOWNLOAD_RETRY_INTERVAL 1000
+
+VDownloadScheduler::VDownloadScheduler(const QString &p_cacheFolder,
+                                       qint64 p_cacheCapacity,
+                                       QObject *p_parent)
+    : QObject(p_parent),
+      m_cacheFolder(p_cacheFolder),
+      m_cacheCapacity(p_cacheCapacity),
+      m_maxConcurrency(MAX_CONCURRENT_DOWNLOADS),
+      m_numOfRunning(0)
+{
+    m_downloader = new VDownloader(this);
+    connect(m_downloader, &VDownloader::downloadReplied,
+            this, &VDownloadScheduler::handleDownloadReplied);
+
+    if (m_cacheCapacity <= 0) {
+        m_cacheFolder.clear();
+    }
+}
+
+void VDownloadScheduler::setMaxConcurrency(int p_max)
+{
+    m_maxConcurrency = qMax(1, p_max);
+    startRequests();
+}
+
+void VDownloadScheduler::download(const QString &p_url)
+{
+    if (m_inFlight.contains(p_url)) {
+        // Will be notified when the one in flight finishes.
+        return;
+    }
+
+    if (m_validatedUrls.contains(p_url)) {
+        QByteArray data, etag, lastModified;
+        if (readCache(p_url, &data, etag, lastModified)) {
+            // Notify later as the caller may not be ready.
+            QTimer::singleShot(0, this, [this, p_url, data]() {
+                        emit downloadFinished(data, p_url);
+                    });
+            return;
+        }
+
+        m_validatedUrls.remove(p_url);
+    }
+
+    m_inFlight.insert(p_url, 0);
+    m_queue.enqueue(p_url);
+    startRequests();
+}
+
+void VDownloadScheduler::startRequests()
+{
+    while (m_numOfRunning < m_maxConcurrency && !m_queue.isEmpty()) {
+        QString url = m_queue.dequeue();
+        QUrl qurl(url);
+        if (!qurl.isValid()) {
+            QTimer::singleShot(0, this, [this, url]() {
+                        finishRequest(url, QByteArray());
+                    });
+            continue;
+        }
+
+        // Ask the server whether the cached one is still valid.
+        QHash<QByteArray, QByteArray> headers;
+        QByteArray etag, lastModified;
+        if (readCache(url, NULL, etag, lastModified)) {
+            if (!etag.isEmpty()) {
+                headers.insert("If-None-Match", etag);
+            }
+
+            if (!lastModified.isEmpty()) {
+                headers.insert("If-Modified-Since", lastModified);
+            }
+        }
+
+        ++m_numOfRunning;
+        m_running.insert(qurl.toString(), url);
+        m_downloader->download(qurl, headers);
+    }
+}
+
+void VDownloadScheduler::handleDownloadReplied(QNetworkReply *p_reply, const QByteArray &p_data)
+{
+    // All the replies of m_downloader are requested by us.
+    --m_numOfRunning;
+
+    QString url;
+    auto it = m_running.find(p_reply->request().url().toString());
+    if (it != m_running.end()) {
+        url = it.value();
+        m_running.erase(it);
+    }
+
+    if (!m_inFlight.contains(url)) {
+        startRequests();
+        return;
+    }
+
+    int status = p_reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    QByteArray data, etag, lastModified;
+    if (status == 304) {
+        if (readCache(url, &data, etag, lastModified)) {
+            m_validatedUrls.insert(url);
+        }
+
+        finishRequest(url, data);
+    } else if (p_reply->error() == QNetworkReply::NoError) {
+        if (status == 200) {
+            writeCache(url, p_data, p_reply->rawHeader("ETag"), p_reply->rawHeader("Last-Modified"));
+            m_validatedUrls.insert(url);
+        }
+
+        finishRequest(url, p_data);
+    } else {
+        int &retries = m_inFlight[url];
+        // Retry on network and server errors of remote requests.
+        bool remote = p_reply->request().url().scheme().startsWith("http");
+        if (remote
+            && (status == 0 || status >= 500)
+            && retries < MAX_DOWNLOAD_RETRIES) {
+            int delay = DOWNLOAD_RETRY_INTERVAL << retries;
+            ++retries;
+            QTimer::singleShot(delay, this, [this, url]() {
+                        m_queue.enqueue(url);
+                        startRequests();
+                    });
+        } else {
+            // Fall back to the cached one if any.
+            readCache(url, &data, etag, lastModified);
+            finishRequest(url, data);
+        }
+    }
+
+    startRequests();
+}
+
+void VDownloadScheduler::finishRequest(const QString &p_url, const QByteArray &p_data)
+{
+    m_inFlight.remove(p_url);
+    emit downloadFinished(p_data, p_url);
+}
+
+QString VDownloadScheduler::cacheFilePath(const QString &p_url, const QString &p_suffix) const
+{
+    QByteArray hash = QCryptographicHash::hash(p_url.toUtf8(), QCryptographicHash::Sha1);
+    return QDir(m_cacheFolder).filePath(QString::fromLatin1(hash.toHex()) + p_suffix);
+}
+
+bool VDownloadScheduler::readCache(const QString &p_url,
+                                   QByteArray *p_data,
+                                   QByteArray &p_etag,
+                                   QByteArray &p_lastModified) const
+{
+    if (m_cacheFolder.isEmpty()) {
+        return false;
+    }
+
+    QFile metaFile(cacheFilePath(p_url, ".json"));
+    if (!metaFile.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+
+    QJsonObject meta = QJsonDocument::fromJson(metaFile.readAll()).object();
+    if (meta.value("url").toString() != p_url) {
+        return false;
+    }
+
+    QFile dataFile(cacheFilePath(p_url, ".data"));
+    if (!dataFile.exists()) {
+        return false;
+    }
+
+    if (p_data) {
+        if (!dataFile.open(QIODevice::ReadOnly)) {
+            return false;
+        }
+
+        *p_data = dataFile.readAll();
+    }
+
+    p_etag = meta.value("etag").toString().toLatin1();
+    p_lastModified = meta.value("last_modified").toString().toLatin1();
+    return true;
+}
+
+void VDownloadScheduler::writeCache(const QString &p_url,
+                                    const QByteArray &p_data,
+                                    const QByteArray &p_etag,
+                                    const QByteArray &p_lastModified)
+{
+    // Nothing to revalidate with.
+    if (m_cacheFolder.isEmpty()
+        || p_data.isEmpty()
+        || (p_etag.isEmpty() && p_lastModified.isEmpty())) {
+        return;
+    }
+
+    if (!QDir().mkpath(m_cacheFolder)) {
+        return;
+    }
+
+    QSaveFile dataFile(cacheFilePath(p_url, ".data"));
+    if (!dataFile.open(QIODevice::WriteOnly)
+        || dataFile.write(p_data) != p_data.size()
+        || !dataFile.commit()) {
+        qWarning() << "fail to write download cache of" << p_url;
+        return;
+    }
+
+    QJsonObject meta;
+    meta["url"] = p_url;
+    meta["etag"] = QString::fromLatin1(p_etag);
+    meta["last_modified"] = QString::fromLatin1(p_lastModified);
+
+    QSaveFile metaFile(cacheFilePath(p_url, ".json"));
+    if (!metaFile.open(QIODevice::WriteOnly)
+        || metaFile.write(QJsonDocument(meta).toJson(QJsonDocument::Compact)) < 0
+        || !metaFile.commit()) {
+        qWarning() << "fail to write download cache of" << p_url;
+        return;
+    }
+
+    evictCache();
+}
+
+void VDownloadScheduler::evictCache()
+{
+    VUtils::evictFilesByTime(m_cacheFolder, "*.data", m_cacheCapacity, ".json");
+}
@@ -0,0 +1,90 @@
+#ifndef VDOWNLOADSCHEDULER_H
+#define VDOWNLOADSCHEDULER_H
+
+#include <QObject>
+#include <QHash>
+#include <QQueue>
+#include <QSet>
+#include <QString>
+#include <QByteArray>
+
+class VDownloader;
+class QNetworkReply;
+
+// Fetch remote resources on top of VDownloader for all the editors.
+// - Requests for the same URL in flight are merged;
+// - At most m_maxConcurrency requests are fetched at the same time;
+// - Failed requests are retried on network and server errors;
+// - HTTP responses are kept in a disk cache and revalidated once per session
+// with ETag and Last-Modified.
+class VDownloadScheduler : public QObject
+{
+    Q_OBJECT
+public:
+    // @p_cacheFolder: folder of the disk cache. Empty to disable it.
+    // @p_cacheCapacity: disk budget of the cache in bytes.
+    VDownloadScheduler(const QString &p_cacheFolder,
+                       qint64 p_cacheCapacity,
+                       QObject *p_parent = nullptr);
+
+    // Fetch @p_url. downloadFinished() will be emitted later.
+    void download(const QString &p_url);
+
+    void setMaxConcurrency(int p_max);
+
+signals:
+    // @p_data will be empty if failed.
+    void downloadFinished(const QByteArray &p_data, const QString &p_url);
+
+private slots:
+    void handleDownloadReplied(QNetworkReply *p_reply, const QByteArray &p_data);
+
+private:
+    // Start queued requests within the concurrency limit.
+    void startRequests();
+
+    void finishRequest(const QString &p_url, const QByteArray &p_data);
+
+    QString cacheFilePath(const QString &p_url, const QString &p_suffix) const;
+
+    // Read the cached data and validators of @p_url.
+    // Returns false if not cached.
+    bool readCache(const QString &p_url,
+                   QByteArray *p_data,
+                   QByteArray &p_etag,
+                   QByteArray &p_lastModified) const;
+
+    void writeCache(const QString &p_url,
+                    const QByteArray &p_data,
+                    const QByteArray &p_etag,
+                    const QByteArray &p_lastModified);
+
+    // Remove the oldest entries until the budget is met.
+    void evictCache();
+
+    VDownloader *m_downloader;
+
+    QString m_cacheFolder;
+
+    qint64 m_cacheCapacity;
+
+    int m_maxConcurrency;
+
+    // Number of requests being fetched.
+    int m_numOfRunning;
+
+    // URLs waiting to be fetched.
+    QQueue<QString> m_queue;
+
+    // Retries of URLs queued or being fetched.
+    QHash<QString, int> m_inFlight;
+
+    // URLs of the callers being fetched by the normalized URLs of the requests,
+    // which are what the replies carry.
+    QMultiHash<QString, QString> m_running;
+
+    // URLs validated in this session, which could be served from the cache.
+    QSet<QString> m_validatedUrls;
+};
+
+#endif // VDOWNLOADSCHEDULER_H
@@ -13,7 +13,6 @@
 #include "vmainwindow.h"
 #include "vcaptain.h"
 #include "vfilelist.h"
-#include "vmathjaxpreviewhelper.h"
 #include "vmdtab.h"
 #include "vmdeditor.h"
 
@@ -46,8 +45,6 @@ VEditArea::VEditArea(QWidget *parent)
     timer->start();
 
     m_autoSave = g_config->getEnableAutoSave();
-
-    m_mathPreviewHelper = new VMathJaxPreviewHelper(this, this);
 }
 
 void VEditArea::setupUI()
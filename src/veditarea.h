@@ -23,7 +23,6 @@ class VDirectory;
 class VFindReplaceDialog;
 class QLabel;
 class VVim;
-class VMathJaxPreviewHelper;
 
 class VEditArea : public QWidget, public VNavigationMode
 {
@@ -92,8 +91,6 @@ public:
     // Return the rect not containing the tab bar.
     QRect editAreaRect() const;
 
-    VMathJaxPreviewHelper *getMathJaxPreviewHelper() const;
-
     // Maximize the width of current vertical split.
     void maximizeCurrentSplit();
 
@@ -263,8 +260,6 @@ private:
     // Whether auto save files.
     bool m_autoSave;
 
-    VMathJaxPreviewHelper *m_mathPreviewHelper;
-
     QSharedPointer<VTextEditCompleter> m_completer;
 };
 
@@ -284,11 +279,6 @@ inline VFindReplaceDialog *VEditArea::getFindReplaceDialog() const
     return m_findReplace;
 }
 
-inline VMathJaxPreviewHelper *VEditArea::getMathJaxPreviewHelper() const
-{
-    return m_mathPreviewHelper;
-}
-
 inline QSharedPointer<VTextEditCompleter> VEditArea::getCompleter() const
 {
     if (m_completer.isNull()) {
@@ -2,42 +2,139 @@
 
 #include <QDebug>
 #include <QThread>
+#include <QTimer>
+#include <QFileInfo>
+#include <QDateTime>
 
 #include "vconfigmanager.h"
 #include "utils/vprocessutils.h"
+#include "vrendercache.h"
+#include "vrenderscheduler.h"
+#include "vgvcrenderer.h"
 
 extern VConfigManager *g_config;
 
-#define TaskIdProperty "GraphvizTaskId"
-#define TaskFormatProperty "GraphvizTaskFormat"
-#define TaskTimeStampProperty "GraphvizTaskTimeStamp"
-
 VGraphvizHelper::VGraphvizHelper(QObject *p_parent)
-    : QObject(p_parent)
+    : QObject(p_parent),
+      m_latestTimeStamp(0)
 {
     prepareCommand(m_program, m_args);
+
+    connect(VRenderScheduler::inst(), &VRenderScheduler::renderFinished,
+            this, &VGraphvizHelper::handleRenderFinished);
+
+    if (VGvcRenderer::isAvailable()) {
+        connect(VGvcRenderer::inst(), &VGvcRenderer::renderFinished,
+                this, &VGraphvizHelper::handleGvcFinished);
+    }
 }
 
-void VGraphvizHelper::processAsync(int p_id, TimeStamp p_timeStamp, const QString &p_format, const QString &p_text)
+void VGraphvizHelper::processAsync(int p_id,
+                                   TimeStamp p_timeStamp,
+                                   const QString &p_format,
+                                   const QString &p_text,
+                                   int p_priority)
 {
-    QProcess *process = new QProcess(this);
-    process->setProperty(TaskIdProperty, p_id);
-    process->setProperty(TaskTimeStampProperty, p_timeStamp);
-    process->setProperty(TaskFormatProperty, p_format);
-    connect(process, SIGNAL(finished(int, QProcess::ExitStatus)),
-            this, SLOT(handleProcessFinished(int, QProcess::ExitStatus)));
+    if (p_timeStamp > m_latestTimeStamp) {
+        m_latestTimeStamp = p_timeStamp;
+        // Requests of the new timestamp come in a row.
+        QTimer::singleShot(0, this, &VGraphvizHelper::cancelObsoleteTasks);
+    }
+
+    QString key = VRenderCache::key("dot", p_text, p_format, rendererVersion());
+    QString format;
+    QByteArray data = VRenderCache::load(key, format);
+    if (!data.isEmpty()) {
+        // Keep it asynchronous as the callers expect.
+        QTimer::singleShot(0, this, [this, p_id, p_timeStamp, p_format, data]() {
+                    emitResult(p_id, p_timeStamp, p_format, data);
+                });
+        return;
+    }
 
+    Task task;
+    task.m_id = p_id;
+    task.m_timeStamp = p_timeStamp;
+    task.m_format = p_format;
+    task.m_cacheKey = key;
+    task.m_input = p_text.toUtf8();
+    task.m_priority = p_priority;
+
+    if (VGvcRenderer::isAvailable()) {
+        quint64 reqId = VGvcRenderer::inst()->renderAsync(p_format, task.m_input, p_priority);
+        m_gvcTasks.insert(reqId, task);
+    } else {
+        renderWithProgram(task);
+    }
+}
+
+void VGraphvizHelper::renderWithProgram(const Task &p_task)
+{
     QStringList args(m_args);
-    args << ("-T" + p_format);
+    args << ("-T" + p_task.m_format);
 
-    qDebug() << m_program << args;
+    quint64 reqId = VRenderScheduler::inst()->render("graphviz",
+                                                     m_program,
+                                                     args,
+                                                     p_task.m_input,
+                                                     p_task.m_priority);
+    m_tasks.insert(reqId, p_task);
+}
 
-    process->start(m_program, args);
-    if (process->write(p_text.toUtf8()) == -1) {
-        qWarning() << "fail to write to QProcess:" << process->errorString();
+void VGraphvizHelper::handleGvcFinished(quint64 p_reqId,
+                                        int p_result,
+                                        const QByteArray &p_out,
+                                        const QString &p_err)
+{
+    auto it = m_gvcTasks.find(p_reqId);
+    if (it == m_gvcTasks.end()) {
+        return;
     }
 
-    process->closeWriteChannel();
+    Task task = it.value();
+    m_gvcTasks.erase(it);
+
+    switch (p_result) {
+    case VGvcRenderer::Succeeded:
+        if (!p_err.isEmpty()) {
+            qDebug() << "Graphviz stderr:" << p_err;
+        }
+
+        VRenderCache::save(task.m_cacheKey, task.m_format, p_out);
+        emitResult(task.m_id, task.m_timeStamp, task.m_format, p_out);
+        break;
+
+    case VGvcRenderer::Failed:
+        qWarning() << "Graphviz fail" << p_err;
+        emit resultReady(task.m_id, task.m_timeStamp, task.m_format, "");
+        break;
+
+    default:
+        qDebug() << "fall back to the dot program" << p_err;
+        renderWithProgram(task);
+        break;
+    }
+}
+
+void VGraphvizHelper::cancelObsoleteTasks()
+{
+    for (auto it = m_tasks.begin(); it != m_tasks.end();) {
+        if (it.value().m_timeStamp < m_latestTimeStamp) {
+            VRenderScheduler::inst()->cancel(it.key());
+            it = m_tasks.erase(it);
+        } else {
+            ++it;
+        }
+    }
+
+    for (auto it = m_gvcTasks.begin(); it != m_gvcTasks.end();) {
+        if (it.value().m_timeStamp < m_latestTimeStamp) {
+            VGvcRenderer::inst()->cancel(it.key());
+            it = m_gvcTasks.erase(it);
+        } else {
+            ++it;
+        }
+    }
 }
 
 void VGraphvizHelper::prepareCommand(QString &p_program, QStringList &p_args) const
@@ -52,16 +149,48 @@ void VGraphvizHelper::prepareCommand(QString &p_program, QStringList &p_args) co
     p_args.clear();
 }
 
-void VGraphvizHelper::handleProcessFinished(int p_exitCode, QProcess::ExitStatus p_exitStatus)
+QString VGraphvizHelper::rendererVersion() const
+{
+    if (VGvcRenderer::isAvailable()) {
+        return "libgvc " + VGvcRenderer::version();
+    }
+
+    QFileInfo dot(m_program);
+    return m_program + " " + m_args.join(' ')
+           + "|" + QString::number(dot.size())
+           + "|" + QString::number(dot.lastModified().toMSecsSinceEpoch());
+}
+
+void VGraphvizHelper::emitResult(int p_id,
+                                 TimeStamp p_timeStamp,
+                                 const QString &p_format,
+                                 const QByteArray &p_data)
+{
+    if (p_format == "svg") {
+        emit resultReady(p_id, p_timeStamp, p_format, QString::fromLocal8Bit(p_data));
+    } else {
+        emit resultReady(p_id, p_timeStamp, p_format, QString::fromLocal8Bit(p_data.toBase64()));
+    }
+}
+
+void VGraphvizHelper::handleRenderFinished(quint64 p_reqId,
+                                           int p_exitCode,
+                                           QProcess::ExitStatus p_exitStatus,
+                                           const QByteArray &p_out,
+                                           const QByteArray &p_err)
 {
-    QProcess *process = static_cast<QProcess *>(sender());
-    int id = process->property(TaskIdProperty).toInt();
-    QString format = process->property(TaskFormatProperty).toString();
-    TimeStamp timeStamp = process->property(TaskTimeStampProperty).toULongLong();
+    auto it = m_tasks.find(p_reqId);
+    if (it == m_tasks.end()) {
+        return;
+    }
+
+    Task task = it.value();
+    m_tasks.erase(it);
+
     qDebug() << QString("Graphviz finished: id %1 timestamp %2 format %3 exitcode %4 exitstatus %5")
-                       .arg(id)
-                       .arg(timeStamp)
-                       .arg(format)
+                       .arg(task.m_id)
+                       .arg(task.m_timeStamp)
+                       .arg(task.m_format)
                        .arg(p_exitCode)
                        .arg(p_exitStatus);
     bool failed = true;
@@ -70,20 +199,18 @@ void VGraphvizHelper::handleProcessFinished(int p_exitCode, QProcess::ExitStatus
             qWarning() << "Graphviz fail" << p_exitCode;
         } else {
             failed = false;
-            QByteArray outBa = process->readAllStandardOutput();
-            if (format == "svg") {
-                emit resultReady(id, timeStamp, format, QString::fromLocal8Bit(outBa));
-            } else {
-                emit resultReady(id, timeStamp, format, QString::fromLocal8Bit(outBa.toBase64()));
+            if (p_exitCode == 0) {
+                VRenderCache::save(task.m_cacheKey, task.m_format, p_out);
             }
+
+            emitResult(task.m_id, task.m_timeStamp, task.m_format, p_out);
         }
     } else {
         qWarning() << "fail to start Graphviz process" << p_exitCode << p_exitStatus;
     }
 
-    QByteArray errBa = process->readAllStandardError();
-    if (!errBa.isEmpty()) {
-        QString errStr(QString::fromLocal8Bit(errBa));
+    if (!p_err.isEmpty()) {
+        QString errStr(QString::fromLocal8Bit(p_err));
         if (failed) {
             qWarning() << "Graphviz stderr:" << errStr;
         } else {
@@ -92,10 +219,8 @@ void VGraphvizHelper::handleProcessFinished(int p_exitCode, QProcess::ExitStatus
     }
 
     if (failed) {
-        emit resultReady(id, timeStamp, format, "");
+        emit resultReady(task.m_id, task.m_timeStamp, task.m_format, "");
     }
-
-    process->deleteLater();
 }
 
 bool VGraphvizHelper::testGraphviz(const QString &p_dot, QString &p_msg)
@@ -124,6 +249,27 @@ QByteArray VGraphvizHelper::process(const QString &p_format, const QString &p_te
 {
     VGraphvizHelper inst;
 
+    QString key = VRenderCache::key("dot", p_text, p_format, inst.rendererVersion());
+    QString format;
+    QByteArray data = VRenderCache::load(key, format);
+    if (!data.isEmpty()) {
+        return data;
+    }
+
+    if (VGvcRenderer::isAvailable()) {
+        QString errStr;
+        VGvcRenderer::Result ret = VGvcRenderer::render(p_format, p_text.toUtf8(), data, errStr);
+        if (ret == VGvcRenderer::Succeeded) {
+            VRenderCache::save(key, p_format, data);
+            return data;
+        } else if (ret == VGvcRenderer::Failed) {
+            qWarning() << "Graphviz fail" << errStr;
+            return QByteArray();
+        }
+
+        qDebug() << "fall back to the dot program" << errStr;
+    }
+
     int exitCode = -1;
     QByteArray out, err;
 
@@ -138,6 +284,8 @@ QByteArray VGraphvizHelper::process(const QString &p_format, const QString &p_te
 
     if (ret != 0 || exitCode < 0) {
         qWarning() << "Graphviz fail" << ret << exitCode << QString::fromLocal8Bit(err);
+    } else if (exitCode == 0) {
+        VRenderCache::save(key, p_format, out);
     }
 
     return out;
@@ -5,6 +5,7 @@
 
 #include <QStringList>
 #include <QProcess>
+#include <QHash>
 
 #include "vconstants.h"
 
@@ -14,7 +15,14 @@ class VGraphvizHelper : public QObject
 public:
     explicit VGraphvizHelper(QObject *p_parent = nullptr);
 
-    void processAsync(int p_id, TimeStamp p_timeStamp, const QString &p_format, const QString &p_text);
+    // Requests of older timestamps will be canceled once a request of a newer
+    // timestamp comes.
+    // @p_priority: VRenderScheduler::Priority.
+    void processAsync(int p_id,
+                      TimeStamp p_timeStamp,
+                      const QString &p_format,
+                      const QString &p_text,
+                      int p_priority = 0);
 
     static bool testGraphviz(const QString &p_dot, QString &p_msg);
 
@@ -24,13 +32,54 @@ signals:
     void resultReady(int p_id, TimeStamp p_timeStamp, const QString &p_format, const QString &p_result);
 
 private slots:
-    void handleProcessFinished(int p_exitCode, QProcess::ExitStatus p_exitStatus);
+    void handleRenderFinished(quint64 p_reqId,
+                              int p_exitCode,
+                              QProcess::ExitStatus p_exitStatus,
+                              const QByteArray &p_out,
+                              const QByteArray &p_err);
+
+    void handleGvcFinished(quint64 p_reqId, int p_result, const QByteArray &p_out, const QString &p_err);
+
+    void cancelObsoleteTasks();
 
 private:
+    struct Task
+    {
+        int m_id;
+
+        TimeStamp m_timeStamp;
+
+        QString m_format;
+
+        // Key in VRenderCache.
+        QString m_cacheKey;
+
+        // Kept to fall back to the dot program if libgvc fails.
+        QByteArray m_input;
+
+        int m_priority;
+    };
+
+    // Render @p_task with the dot program.
+    void renderWithProgram(const Task &p_task);
+
     void prepareCommand(QString &p_cmd, QStringList &p_args) const;
 
+    // Everything of the command affecting the output.
+    QString rendererVersion() const;
+
+    void emitResult(int p_id, TimeStamp p_timeStamp, const QString &p_format, const QByteArray &p_data);
+
     QString m_program;
     QStringList m_args;
+
+    // Tasks sent to VRenderScheduler by request id.
+    QHash<quint64, Task> m_tasks;
+
+    // Tasks sent to VGvcRenderer by request id.
+    QHash<quint64, Task> m_gvcTasks;
+
+    TimeStamp m_latestTimeStamp;
 };
 
 #endif // VGRAPHVIZHELPER_H
@@ -0,0 +1,216 @@
+#include "vgvcrenderer.h"
+
+#include <QCoreApplication>
+#include <QDebug>
+#include <QRunnable>
+
+#if defined(VNOTE_USE_LIBGVC)
+#include <graphviz/gvc.h>
+#endif
+
+class GvcRenderTask : public QRunnable
+{
+public:
+    GvcRenderTask(VGvcRenderer *p_renderer,
+                  quint64 p_id,
+                  const QString &p_format,
+                  const QByteArray &p_dot,
+                  const QSharedPointer<QAtomicInt> &p_canceled)
+        : m_renderer(p_renderer),
+          m_id(p_id),
+          m_format(p_format),
+          m_dot(p_dot),
+          m_canceled(p_canceled)
+    {
+    }
+
+    void run() Q_DECL_OVERRIDE
+    {
+        if (m_canceled->load()) {
+            return;
+        }
+
+        QByteArray out;
+        QString err;
+        VGvcRenderer::Result ret = VGvcRenderer::render(m_format, m_dot, out, err);
+        // The renderer waits for all the tasks before it is destroyed.
+        if (!m_canceled->load()) {
+            emit m_renderer->renderFinished(m_id, ret, out, err);
+        }
+    }
+
+private:
+    VGvcRenderer *m_renderer;
+
+    quint64 m_id;
+
+    QString m_format;
+
+    QByteArray m_dot;
+
+    QSharedPointer<QAtomicInt> m_canceled;
+};
+
+VGvcRenderer *VGvcRenderer::s_inst = NULL;
+
+QMutex VGvcRenderer::s_mutex;
+
+#if defined(VNOTE_USE_LIBGVC)
+static GVC_t *s_gvc = NULL;
+
+// Errors of the current rendering.
+static QString s_gvcErrors;
+
+static int gvcErrorHandler(char *p_msg)
+{
+    s_gvcErrors += QString::fromUtf8(p_msg);
+    return 0;
+}
+
+// Should be called with s_mutex locked.
+static GVC_t *gvcContext()
+{
+    if (!s_gvc) {
+        agseterrf(gvcErrorHandler);
+        agseterr(AGERR);
+        s_gvc = gvContext();
+    }
+
+    return s_gvc;
+}
+#endif
+
+VGvcRenderer *VGvcRenderer::inst()
+{
+    if (!s_inst) {
+        s_inst = new VGvcRenderer(QCoreApplication::instance());
+    }
+
+    return s_inst;
+}
+
+VGvcRenderer::VGvcRenderer(QObject *p_parent)
+    : QObject(p_parent),
+      m_nextId(0)
+{
+    m_pool.setMaxThreadCount(1);
+
+    // Drop the flags of finished requests.
+    connect(this, &VGvcRenderer::renderFinished,
+            this, [this](quint64 p_id) {
+                m_canceled.remove(p_id);
+            });
+}
+
+VGvcRenderer::~VGvcRenderer()
+{
+    for (auto &flag : m_canceled) {
+        flag->store(1);
+    }
+
+    m_pool.clear();
+    m_pool.waitForDone();
+
+    s_inst = NULL;
+}
+
+bool VGvcRenderer::isAvailable()
+{
+#if defined(VNOTE_USE_LIBGVC)
+    return true;
+#else
+    return false;
+#endif
+}
+
+QString VGvcRenderer::version()
+{
+#if defined(VNOTE_USE_LIBGVC)
+    static QString ver;
+    if (ver.isEmpty()) {
+        QMutexLocker locker(&s_mutex);
+        GVC_t *gvc = gvcContext();
+        if (gvc) {
+            ver = QString::fromUtf8(gvcVersion(gvc));
+        }
+    }
+
+    return ver;
+#else
+    return QString();
+#endif
+}
+
+quint64 VGvcRenderer::renderAsync(const QString &p_format, const QByteArray &p_dot, int p_priority)
+{
+    quint64 id = ++m_nextId;
+    QSharedPointer<QAtomicInt> canceled(new QAtomicInt(0));
+    m_canceled.insert(id, canceled);
+
+    m_pool.start(new GvcRenderTask(this, id, p_format, p_dot, canceled), p_priority);
+    return id;
+}
+
+void VGvcRenderer::cancel(quint64 p_id)
+{
+    auto flag = m_canceled.take(p_id);
+    if (flag) {
+        flag->store(1);
+    }
+}
+
+VGvcRenderer::Result VGvcRenderer::render(const QString &p_format,
+                                          const QByteArray &p_dot,
+                                          QByteArray &p_out,
+                                          QString &p_err)
+{
+#if defined(VNOTE_USE_LIBGVC)
+    QMutexLocker locker(&s_mutex);
+    GVC_t *gvc = gvcContext();
+    if (!gvc) {
+        p_err = "fail to create Graphviz context";
+        return Result::Unsupported;
+    }
+
+    s_gvcErrors.clear();
+
+    Agraph_t *graph = agmemread(p_dot.constData());
+    if (!graph) {
+        p_err = s_gvcErrors;
+        return Result::Failed;
+    }
+
+    // Respect the layout attribute like the dot program.
+    QByteArray engine("dot");
+    char *layout = agget(graph, const_cast<char *>("layout"));
+    if (layout && layout[0]) {
+        engine = layout;
+    }
+
+    Result ret = Result::Succeeded;
+    if (gvLayout(gvc, graph, engine.constData()) != 0) {
+        ret = Result::Unsupported;
+    } else {
+        char *data = NULL;
+        unsigned int len = 0;
+        if (gvRenderData(gvc, graph, p_format.toLatin1().constData(), &data, &len) != 0) {
+            ret = Result::Unsupported;
+        } else {
+            p_out = QByteArray(data, len);
+        }
+
+        gvFreeRenderData(data);
+        gvFreeLayout(gvc, graph);
+    }
+
+    agclose(graph);
+    p_err = s_gvcErrors;
+    return ret;
+#else
+    Q_UNUSED(p_format);
+    Q_UNUSED(p_dot);
+    Q_UNUSED(p_out);
+    p_err = "not built with libgvc";
+    return Result::Unsupported;
+#endif
+}
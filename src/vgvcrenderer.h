@@ -0,0 +1,71 @@
+#ifndef VGVCRENDERER_H
+#define VGVCRENDERER_H
+
+#include <QObject>
+#include <QByteArray>
+#include <QHash>
+#include <QMutex>
+#include <QSharedPointer>
+#include <QString>
+#include <QThreadPool>
+
+// Render DOT in process with libgvc on a worker thread, avoiding the cost of
+// starting a dot process for each graph.
+// Only available when built with VNOTE_USE_LIBGVC. Otherwise isAvailable()
+// returns false and callers should use the dot program.
+class VGvcRenderer : public QObject
+{
+    Q_OBJECT
+public:
+    enum Result
+    {
+        Succeeded = 0,
+        // Invalid DOT.
+        Failed,
+        // Not supported by libgvc, such as a missing plugin. Try the dot program.
+        Unsupported
+    };
+
+    static VGvcRenderer *inst();
+
+    static bool isAvailable();
+
+    // Version of Graphviz. Should be called in the GUI thread.
+    static QString version();
+
+    // Returns the request id. renderFinished() will be emitted later.
+    // Requests of higher @p_priority start first.
+    quint64 renderAsync(const QString &p_format, const QByteArray &p_dot, int p_priority = 0);
+
+    // The result of @p_id will not be emitted.
+    void cancel(quint64 p_id);
+
+    // Render in the calling thread.
+    static Result render(const QString &p_format,
+                         const QByteArray &p_dot,
+                         QByteArray &p_out,
+                         QString &p_err);
+
+signals:
+    // Emitted from the worker thread.
+    void renderFinished(quint64 p_id, int p_result, const QByteArray &p_out, const QString &p_err);
+
+private:
+    explicit VGvcRenderer(QObject *p_parent = nullptr);
+
+    ~VGvcRenderer();
+
+    static VGvcRenderer *s_inst;
+
+    // libgvc and libcgraph are not thread-safe.
+    static QMutex s_mutex;
+
+    quint64 m_nextId;
+
+    QThreadPool m_pool;
+
+    // Cancel flags of the requests in flight.
+    QHash<quint64, QSharedPointer<QAtomicInt>> m_canceled;
+};
+
+#endif // VGVCRENDERER_H
@@ -1,37 +1,161 @@
 #include "vimageresourcemanager2.h"
 
+#include "vpreviewimagecache.h"
+
 
 VImageResourceManager2::VImageResourceManager2()
 {
 }
 
+VImageResourceManager2::~VImageResourceManager2()
+{
+    clear();
+}
+
 void VImageResourceManager2::addImage(const QString &p_name,
                                       const QPixmap &p_image)
 {
+    removeImage(p_name);
     m_images.insert(p_name, p_image);
 }
 
+void VImageResourceManager2::addSharedImage(const QString &p_name,
+                                            const QString &p_key,
+                                            const QPixmap &p_image)
+{
+    VPreviewImageCache::insert(p_key, p_image);
+    VPreviewImageCache::ref(p_key);
+
+    // Pin it before removing the old one, which may evict images.
+    bool visible = m_visibleImages.contains(p_name);
+    if (visible) {
+        VPreviewImageCache::pin(p_key);
+    }
+
+    removeImage(p_name);
+
+    SharedImage img;
+    img.m_key = p_key;
+    img.m_size = p_image.size();
+    m_sharedImages.insert(p_name, img);
+
+    if (visible) {
+        m_pinnedImages.insert(p_name, p_key);
+    }
+}
+
+void VImageResourceManager2::addPlaceholder(const QString &p_name,
+                                            const QSize &p_size)
+{
+    removeImage(p_name);
+    m_placeholders.insert(p_name, p_size);
+}
+
 bool VImageResourceManager2::contains(const QString &p_name) const
 {
-    return m_images.contains(p_name);
+    return m_images.contains(p_name)
+           || m_sharedImages.contains(p_name)
+           || m_placeholders.contains(p_name);
+}
+
+QPixmap VImageResourceManager2::findImage(const QString &p_name) const
+{
+    auto it = m_images.find(p_name);
+    if (it != m_images.end()) {
+        return it.value();
+    }
+
+    auto sit = m_sharedImages.find(p_name);
+    if (sit != m_sharedImages.end()) {
+        QPixmap image = VPreviewImageCache::find(sit->m_key);
+        if (image.isNull() && m_imageMissingHandler) {
+            m_imageMissingHandler(p_name);
+        }
+
+        return image;
+    }
+
+    return QPixmap();
 }
 
-const QPixmap *VImageResourceManager2::findImage(const QString &p_name) const
+QSize VImageResourceManager2::imageSize(const QString &p_name) const
 {
     auto it = m_images.find(p_name);
     if (it != m_images.end()) {
-        return &it.value();
+        return it.value().size();
+    }
+
+    auto sit = m_sharedImages.find(p_name);
+    if (sit != m_sharedImages.end()) {
+        return sit->m_size;
+    }
+
+    return m_placeholders.value(p_name);
+}
+
+void VImageResourceManager2::setImageMissingHandler(const std::function<void(const QString &)> &p_handler)
+{
+    m_imageMissingHandler = p_handler;
+}
+
+void VImageResourceManager2::setVisibleImages(const QSet<QString> &p_names)
+{
+    for (auto it = m_pinnedImages.begin(); it != m_pinnedImages.end();) {
+        if (p_names.contains(it.key())) {
+            ++it;
+        } else {
+            VPreviewImageCache::unpin(it.value());
+            it = m_pinnedImages.erase(it);
+        }
     }
 
-    return NULL;
+    for (const auto &name : p_names) {
+        if (m_pinnedImages.contains(name)) {
+            continue;
+        }
+
+        auto sit = m_sharedImages.find(name);
+        if (sit != m_sharedImages.end()) {
+            VPreviewImageCache::pin(sit->m_key);
+            m_pinnedImages.insert(name, sit->m_key);
+        }
+    }
+
+    m_visibleImages = p_names;
 }
 
 void VImageResourceManager2::clear()
 {
+    for (auto it = m_pinnedImages.begin(); it != m_pinnedImages.end(); ++it) {
+        VPreviewImageCache::unpin(it.value());
+    }
+
+    for (auto it = m_sharedImages.begin(); it != m_sharedImages.end(); ++it) {
+        VPreviewImageCache::unref(it->m_key);
+    }
+
+    m_visibleImages.clear();
+    m_pinnedImages.clear();
+
     m_images.clear();
+    m_sharedImages.clear();
+    m_placeholders.clear();
 }
 
 void VImageResourceManager2::removeImage(const QString &p_name)
 {
+    auto pit = m_pinnedImages.find(p_name);
+    if (pit != m_pinnedImages.end()) {
+        VPreviewImageCache::unpin(pit.value());
+        m_pinnedImages.erase(pit);
+    }
+
+    auto it = m_sharedImages.find(p_name);
+    if (it != m_sharedImages.end()) {
+        VPreviewImageCache::unref(it->m_key);
+        m_sharedImages.erase(it);
+    }
+
     m_images.remove(p_name);
+    m_placeholders.remove(p_name);
 }
@@ -1,7 +1,10 @@
 #ifndef VIMAGERESOURCEMANAGER2_H
 #define VIMAGERESOURCEMANAGER2_H
 
+#include <functional>
+
 #include <QHash>
+#include <QSet>
 #include <QString>
 #include <QPixmap>
 
@@ -11,23 +14,68 @@ class VImageResourceManager2
 public:
     VImageResourceManager2();
 
+    ~VImageResourceManager2();
+
     // Add an image to the resource with @p_name as the key.
     // If @p_name already exists in the resources, it will update it.
     void addImage(const QString &p_name, const QPixmap &p_image);
 
+    // Add an image kept in VPreviewImageCache with key @p_key, which may be
+    // shared with other editors.
+    void addSharedImage(const QString &p_name, const QString &p_key, const QPixmap &p_image);
+
+    // Add a placeholder of size @p_size for image @p_name which is not ready yet.
+    // It will be replaced by addImage().
+    void addPlaceholder(const QString &p_name, const QSize &p_size);
+
     // Remove image @p_name.
     void removeImage(const QString &p_name);
 
-    // Whether the resources contains image with name @p_name.
+    // Whether the resources contains image or placeholder with name @p_name.
     bool contains(const QString &p_name) const;
 
-    const QPixmap *findImage(const QString &p_name) const;
+    // Returns a null pixmap for placeholders and shared images evicted from
+    // the cache.
+    QPixmap findImage(const QString &p_name) const;
+
+    // Size of image or placeholder @p_name.
+    QSize imageSize(const QString &p_name) const;
+
+    // @p_handler will be called with the name of a shared image which is
+    // needed but has been evicted from the cache.
+    void setImageMissingHandler(const std::function<void(const QString &)> &p_handler);
+
+    // Images @p_names are on screen. Pin the shared ones in VPreviewImageCache
+    // and unpin the others.
+    void setVisibleImages(const QSet<QString> &p_names);
 
     void clear();
 
 private:
+    struct SharedImage
+    {
+        // Key in VPreviewImageCache.
+        QString m_key;
+
+        QSize m_size;
+    };
+
     // All the images resources.
     QHash<QString, QPixmap> m_images;
+
+    // Images kept in VPreviewImageCache.
+    QHash<QString, SharedImage> m_sharedImages;
+
+    // Sizes of the images not ready yet.
+    QHash<QString, QSize> m_placeholders;
+
+    std::function<void(const QString &)> m_imageMissingHandler;
+
+    // Names of the images on screen.
+    QSet<QString> m_visibleImages;
+
+    // Keys in VPreviewImageCache pinned by this manager, indexed by name.
+    QHash<QString, QString> m_pinnedImages;
 };
 
 #endif // VIMAGERESOURCEMANAGER2_H
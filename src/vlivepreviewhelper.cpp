@@ -8,15 +8,12 @@
 #include "vconfigmanager.h"
 #include "vgraphvizhelper.h"
 #include "vplantumlhelper.h"
-#include "vmainwindow.h"
-#include "veditarea.h"
 #include "vmathjaxpreviewhelper.h"
+#include "vrenderscheduler.h"
 #include "utils/veditutils.h"
 
 extern VConfigManager *g_config;
 
-extern VMainWindow *g_mainWin;
-
 // Use the highest 4 bits (31-28) to indicate the lang.
 #define LANG_PREFIX_GRAPHVIZ 0x10000000UL
 #define LANG_PREFIX_PLANTUML 0x20000000UL
@@ -109,7 +106,7 @@ VLivePreviewHelper::VLivePreviewHelper(VEditor *p_editor,
     m_graphvizEnabled = g_config->getEnableGraphviz();
     m_mathjaxEnabled = g_config->getEnableMathjax();
 
-    m_mathJaxHelper = g_mainWin->getEditArea()->getMathJaxPreviewHelper();
+    m_mathJaxHelper = VMathJaxPreviewHelper::inst();
     m_mathJaxID = m_mathJaxHelper->registerIdentifier();
     connect(m_mathJaxHelper, &VMathJaxPreviewHelper::mathjaxPreviewResultReady,
             this, &VLivePreviewHelper::mathjaxPreviewResultReady);
@@ -285,7 +282,8 @@ void VLivePreviewHelper::updateLivePreview()
             m_graphvizHelper->processAsync(m_cbIndex | LANG_PREFIX_GRAPHVIZ | TYPE_LIVE_PREVIEW,
                                            m_timeStamp,
                                            "svg",
-                                           VEditUtils::removeCodeBlockFence(vcb.m_text));
+                                           VEditUtils::removeCodeBlockFence(vcb.m_text),
+                                           VRenderScheduler::Urgent);
         } else {
             m_document->setPreviewContent(vcb.m_lang, cb.imageData());
         }
@@ -300,7 +298,8 @@ void VLivePreviewHelper::updateLivePreview()
             m_plantUMLHelper->processAsync(m_cbIndex | LANG_PREFIX_PLANTUML | TYPE_LIVE_PREVIEW,
                                            m_timeStamp,
                                            "svg",
-                                           VEditUtils::removeCodeBlockFence(vcb.m_text));
+                                           VEditUtils::removeCodeBlockFence(vcb.m_text),
+                                           VRenderScheduler::Urgent);
         } else {
             m_document->setPreviewContent(vcb.m_lang, cb.imageData());
         }
@@ -415,6 +414,13 @@ void VLivePreviewHelper::processForInplacePreview(int p_idx)
     CodeBlockPreviewInfo &cb = m_codeBlocks[p_idx];
     const VCodeBlock &vcb = cb.codeBlock();
     Q_ASSERT(!cb.hasImageData());
+
+    // Render blocks in the viewport first.
+    int priority = VRenderScheduler::Low;
+    if (m_editor->isBlockVisible(m_doc->findBlockByNumber(vcb.m_endBlock))) {
+        priority = VRenderScheduler::Visible;
+    }
+
     if (vcb.m_lang == "dot") {
         if (!m_graphvizHelper) {
             m_graphvizHelper = new VGraphvizHelper(this);
@@ -425,7 +431,8 @@ void VLivePreviewHelper::processForInplacePreview(int p_idx)
         m_graphvizHelper->processAsync(p_idx | LANG_PREFIX_GRAPHVIZ | TYPE_INPLACE_PREVIEW,
                                        m_timeStamp,
                                        "svg",
-                                       VEditUtils::removeCodeBlockFence(vcb.m_text));
+                                       VEditUtils::removeCodeBlockFence(vcb.m_text),
+                                       priority);
     } else if (vcb.m_lang == "puml") {
         if (m_plantUMLMode == PlantUMLMode::LocalPlantUML) {
             if (!m_plantUMLHelper) {
@@ -437,7 +444,8 @@ void VLivePreviewHelper::processForInplacePreview(int p_idx)
             m_plantUMLHelper->processAsync(p_idx | LANG_PREFIX_PLANTUML | TYPE_INPLACE_PREVIEW,
                                            m_timeStamp,
                                            "svg",
-                                           VEditUtils::removeCodeBlockFence(vcb.m_text));
+                                           VEditUtils::removeCodeBlockFence(vcb.m_text),
+                                           priority);
         } else {
             m_mathJaxHelper->previewDiagram(m_mathJaxID,
                                             p_idx,
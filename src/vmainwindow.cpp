@@ -23,6 +23,8 @@
 #include "vmdtab.h"
 #include "vvimindicator.h"
 #include "vvimcmdlineedit.h"
+#include "vdownloadscheduler.h"
+#include "vrendercache.h"
 #include "vtabindicator.h"
 #include "dialog/vupdater.h"
 #include "vorphanfile.h"
@@ -63,6 +65,8 @@ VNote *g_vnote;
 
 VWebUtils *g_webUtils;
 
+VDownloadScheduler *g_downloadScheduler;
+
 const int VMainWindow::c_sharedMemTimerInterval = 1000;
 
 #if defined(QT_NO_DEBUG)
@@ -101,6 +105,13 @@ VMainWindow::VMainWindow(VSingleInstanceGuard *p_guard, QWidget *p_parent)
     m_webUtils.init();
     g_webUtils = &m_webUtils;
 
+    g_downloadScheduler = new VDownloadScheduler(QDir(g_config->getCacheConfigFolder()).filePath("downloads"),
+                                                 qint64(g_config->getDownloadCacheSize()) * 1024 * 1024,
+                                                 this);
+
+    VRenderCache::init(QDir(g_config->getCacheConfigFolder()).filePath("renders"),
+                       qint64(g_config->getRenderCacheSize()) * 1024 * 1024);
+
     initCaptain();
 
     setupUI();
@@ -1,14 +1,12 @@
 #include "vmathjaxinplacepreviewhelper.h"
 
 #include <QDebug>
+#include <QTimer>
 
 #include "veditor.h"
 #include "vdocument.h"
-#include "vmainwindow.h"
-#include "veditarea.h"
 #include "vmathjaxpreviewhelper.h"
-
-extern VMainWindow *g_mainWin;
+#include "vrendercache.h"
 
 MathjaxBlockPreviewInfo::MathjaxBlockPreviewInfo()
 {
@@ -53,6 +51,9 @@ void MathjaxBlockPreviewInfo::updateInplacePreview(const VEditor *p_editor,
 #define MATHJAX_IMAGE_CACHE_SIZE_DIFF 20
 #define MATHJAX_IMAGE_CACHE_TIME_DIFF 5
 
+// Max wait time in ms for the HTML of one batch.
+#define MATHJAX_BATCH_TIMEOUT 1000
+
 VMathJaxInplacePreviewHelper::VMathJaxInplacePreviewHelper(VEditor *p_editor,
                                                            VDocument *p_document,
                                                            QObject *p_parent)
@@ -62,12 +63,25 @@ VMathJaxInplacePreviewHelper::VMathJaxInplacePreviewHelper(VEditor *p_editor,
       m_doc(p_editor->documentW()),
       m_enabled(false),
       m_lastInplacePreviewSize(0),
-      m_timeStamp(0)
+      m_timeStamp(0),
+      m_numOfPendingHtmls(0)
 {
-    m_mathJaxHelper = g_mainWin->getEditArea()->getMathJaxPreviewHelper();
+    m_mathJaxHelper = VMathJaxPreviewHelper::inst();
     m_mathJaxID = m_mathJaxHelper->registerIdentifier();
-    connect(m_mathJaxHelper, &VMathJaxPreviewHelper::mathjaxPreviewResultReady,
-            this, &VMathJaxInplacePreviewHelper::mathjaxPreviewResultReady);
+    connect(m_mathJaxHelper, &VMathJaxPreviewHelper::mathjaxBatchPreviewResultReady,
+            this, &VMathJaxInplacePreviewHelper::mathjaxBatchPreviewResultReady);
+
+    m_batchTimer = new QTimer(this);
+    m_batchTimer->setSingleShot(true);
+    m_batchTimer->setInterval(MATHJAX_BATCH_TIMEOUT);
+    connect(m_batchTimer, &QTimer::timeout,
+            this, &VMathJaxInplacePreviewHelper::sendBatch);
+
+    m_updateTimer = new QTimer(this);
+    m_updateTimer->setSingleShot(true);
+    m_updateTimer->setInterval(0);
+    connect(m_updateTimer, &QTimer::timeout,
+            this, &VMathJaxInplacePreviewHelper::flushCacheHits);
 
     m_documentID = m_document->registerIdentifier();
     connect(m_document, &VDocument::textToHtmlFinished,
@@ -82,6 +96,7 @@ void VMathJaxInplacePreviewHelper::setEnabled(bool p_enabled)
         if (!m_enabled) {
             m_mathjaxBlocks.clear();
             m_cache.clear();
+            m_cacheHits.clear();
         }
 
         updateInplacePreview();
@@ -96,6 +111,12 @@ void VMathJaxInplacePreviewHelper::updateMathjaxBlocks(const QVector<VMathjaxBlo
 
     ++m_timeStamp;
 
+    m_batchIds.clear();
+    m_batchHtmls.clear();
+    m_numOfPendingHtmls = 0;
+    m_batchTimer->stop();
+    m_cacheHits.clear();
+
     m_mathjaxBlocks.clear();
     m_mathjaxBlocks.reserve(p_blocks.size());
     bool manualUpdate = true;
@@ -135,12 +156,36 @@ void VMathJaxInplacePreviewHelper::processForInplacePreview(int p_idx)
     MathjaxBlockPreviewInfo &mb = m_mathjaxBlocks[p_idx];
     const VMathjaxBlock &vmb = mb.mathjaxBlock();
     if (vmb.m_text.isEmpty()) {
-        updateInplacePreview();
-    } else {
-        if (!textToHtmlViaWebView(vmb.m_text, p_idx, m_timeStamp)) {
-            updateInplacePreview();
-        }
+        m_updateTimer->start();
+        return;
+    }
+
+    CacheHit hit;
+    hit.m_data = VRenderCache::load(cacheKey(vmb.m_text), hit.m_format);
+    if (!hit.m_data.isEmpty()) {
+        // Keep it asynchronous like the rendering.
+        hit.m_idx = p_idx;
+        m_cacheHits.append(hit);
+        m_updateTimer->start();
+        return;
+    }
+
+    if (!textToHtmlViaWebView(vmb.m_text, p_idx, m_timeStamp)) {
+        m_updateTimer->start();
+        return;
     }
+
+    ++m_numOfPendingHtmls;
+    m_batchTimer->start();
+}
+
+QString VMathJaxInplacePreviewHelper::cacheKey(const QString &p_text) const
+{
+    return VRenderCache::key("mathjax-inline",
+                             p_text,
+                             QString(),
+                             m_mathJaxHelper->rendererVersion(),
+                             m_mathJaxHelper->theme());
 }
 
 bool VMathJaxInplacePreviewHelper::textToHtmlViaWebView(const QString &p_text,
@@ -186,24 +231,36 @@ void VMathJaxInplacePreviewHelper::updateInplacePreview()
     }
 }
 
-void VMathJaxInplacePreviewHelper::mathjaxPreviewResultReady(int p_identitifer,
-                                                             int p_id,
-                                                             TimeStamp p_timeStamp,
-                                                             const QString &p_format,
-                                                             const QByteArray &p_data)
+void VMathJaxInplacePreviewHelper::mathjaxBatchPreviewResultReady(int p_identitifer,
+                                                                  TimeStamp p_timeStamp,
+                                                                  const QVector<int> &p_ids,
+                                                                  const QString &p_format,
+                                                                  const QVector<QByteArray> &p_data)
 {
     if (p_identitifer != m_mathJaxID || p_timeStamp != m_timeStamp) {
         return;
     }
 
-    if (p_id >= m_mathjaxBlocks.size() || p_data.isEmpty()) {
-        updateInplacePreview();
-        return;
+    for (int i = 0; i < p_ids.size() && i < p_data.size(); ++i) {
+        int idx = p_ids[i];
+        if (idx >= m_mathjaxBlocks.size() || p_data[i].isEmpty()) {
+            continue;
+        }
+
+        VRenderCache::save(cacheKey(m_mathjaxBlocks[idx].mathjaxBlock().m_text), p_format, p_data[i]);
+        setPreviewImage(idx, p_format, p_data[i]);
     }
 
-    MathjaxBlockPreviewInfo &mb = m_mathjaxBlocks[p_id];
+    updateInplacePreview();
+}
+
+void VMathJaxInplacePreviewHelper::setPreviewImage(int p_idx,
+                                                   const QString &p_format,
+                                                   const QByteArray &p_data)
+{
+    MathjaxBlockPreviewInfo &mb = m_mathjaxBlocks[p_idx];
     // Update the cache.
-    QSharedPointer<MathjaxImageCacheEntry> entry(new MathjaxImageCacheEntry(p_timeStamp,
+    QSharedPointer<MathjaxImageCacheEntry> entry(new MathjaxImageCacheEntry(m_timeStamp,
                                                                             p_data,
                                                                             p_format));
     m_cache.insert(mb.mathjaxBlock().m_text, entry);
@@ -212,8 +269,6 @@ void VMathJaxInplacePreviewHelper::mathjaxPreviewResultReady(int p_identitifer,
     if (mb.inplacePreview()) {
         entry->m_imageName = mb.inplacePreview()->m_name;
     }
-
-    updateInplacePreview();
 }
 
 void VMathJaxInplacePreviewHelper::textToHtmlFinished(int p_identitifer,
@@ -226,10 +281,43 @@ void VMathJaxInplacePreviewHelper::textToHtmlFinished(int p_identitifer,
     }
 
     Q_ASSERT(p_html.startsWith("<"));
-    m_mathJaxHelper->previewMathJaxFromHtml(m_mathJaxID,
-                                            p_id,
-                                            p_timeStamp,
-                                            p_html);
+    m_batchIds.append(p_id);
+    m_batchHtmls.append(p_html);
+    if (--m_numOfPendingHtmls <= 0) {
+        sendBatch();
+    } else if (!m_batchTimer->isActive()) {
+        // A partial batch has been sent by the timer. Do not let the late
+        // ones wait for a conversion which may never finish.
+        m_batchTimer->start();
+    }
+}
+
+void VMathJaxInplacePreviewHelper::sendBatch()
+{
+    m_batchTimer->stop();
+    if (m_batchIds.isEmpty()) {
+        return;
+    }
+
+    m_mathJaxHelper->previewMathJaxBatch(m_mathJaxID,
+                                         m_timeStamp,
+                                         m_batchIds,
+                                         m_batchHtmls,
+                                         true);
+    m_batchIds.clear();
+    m_batchHtmls.clear();
+}
+
+void VMathJaxInplacePreviewHelper::flushCacheHits()
+{
+    for (const auto &hit : m_cacheHits) {
+        if (hit.m_idx < m_mathjaxBlocks.size()) {
+            setPreviewImage(hit.m_idx, hit.m_format, hit.m_data);
+        }
+    }
+
+    m_cacheHits.clear();
+    updateInplacePreview();
 }
 
 void VMathJaxInplacePreviewHelper::clearObsoleteCache()
@@ -2,6 +2,8 @@
 #define VMATHJAXINPLACEPREVIEWHELPER_H
 
 #include <QObject>
+#include <QVector>
+#include <QStringList>
 
 #include "pegmarkdownhighlighter.h"
 #include "vpreviewmanager.h"
@@ -11,6 +13,7 @@ class VEditor;
 class VDocument;
 class QTextDocument;
 class VMathJaxPreviewHelper;
+class QTimer;
 
 class MathjaxBlockPreviewInfo
 {
@@ -76,11 +79,11 @@ signals:
     void checkBlocksForObsoletePreview(const QList<int> &p_blocks);
 
 private slots:
-    void mathjaxPreviewResultReady(int p_identitifer,
-                                   int p_id,
-                                   TimeStamp p_timeStamp,
-                                   const QString &p_format,
-                                   const QByteArray &p_data);
+    void mathjaxBatchPreviewResultReady(int p_identitifer,
+                                        TimeStamp p_timeStamp,
+                                        const QVector<int> &p_ids,
+                                        const QString &p_format,
+                                        const QVector<QByteArray> &p_data);
 
     void textToHtmlFinished(int p_identitifer, int p_id, int p_timeStamp, const QString &p_html);
 
@@ -110,6 +113,19 @@ private:
 
     void processForInplacePreview(int p_idx);
 
+    // Send the collected HTML of current time stamp to MathJax in one batch.
+    void sendBatch();
+
+    // Apply the collected cache hits and update inplace preview once.
+    void flushCacheHits();
+
+    // Update the preview of @p_idx with rendered @p_data.
+    // Need to call updateInplacePreview() after that.
+    void setPreviewImage(int p_idx, const QString &p_format, const QByteArray &p_data);
+
+    // Key in VRenderCache of the MathJax text @p_text.
+    QString cacheKey(const QString &p_text) const;
+
     // Emit signal to update inplace preview.
     void updateInplacePreview();
 
@@ -141,6 +157,31 @@ private:
 
     int m_documentID;
 
+    // Blocks converted to HTML and waiting to be sent to MathJax.
+    QVector<int> m_batchIds;
+
+    QStringList m_batchHtmls;
+
+    // Number of blocks of current time stamp still being converted to HTML.
+    int m_numOfPendingHtmls;
+
+    // Send the batch anyway if some conversions never finish.
+    QTimer *m_batchTimer;
+
+    struct CacheHit
+    {
+        int m_idx;
+        QString m_format;
+        QByteArray m_data;
+    };
+
+    // Results of current time stamp found in VRenderCache.
+    QVector<CacheHit> m_cacheHits;
+
+    // Zero-interval timer to update inplace preview once for all the blocks
+    // processed in one pass.
+    QTimer *m_updateTimer;
+
     // Indexed by content.
     QHash<QString, QSharedPointer<MathjaxImageCacheEntry>> m_cache;
 };
@@ -1,65 +1,238 @@
 #include "vmathjaxpreviewhelper.h"
 
-#include <QWebEngineView>
+#include <QWebEnginePage>
 #include <QWebChannel>
+#include <QCryptographicHash>
+#include <QCoreApplication>
+#include <QDir>
+#include <QFileInfo>
+#include <QDateTime>
+#include <QUrl>
+#include <QTimer>
+#include <QDebug>
 
 #include "utils/vutils.h"
 #include "vmathjaxwebdocument.h"
 #include "vconfigmanager.h"
+#include "vrendercache.h"
 
 extern VConfigManager *g_config;
 
-VMathJaxPreviewHelper::VMathJaxPreviewHelper(QWidget *p_parentWidget, QObject *p_parent)
+// Max number of hidden pages. A new page is created only when the others are full.
+#define MAX_PAGES 2
+
+// Max number of requests sent to one page at a time.
+#define MAX_REQUESTS_PER_PAGE 16
+
+// Requests not replied in time are given up.
+#define MATHJAX_REQUEST_TIMEOUT 60000
+
+// A page idle for a while is destroyed to release its renderer process.
+#define MATHJAX_IDLE_TIMEOUT (5 * 60 * 1000)
+
+VMathJaxPreviewHelper *VMathJaxPreviewHelper::s_inst = NULL;
+
+VMathJaxPreviewHelper *VMathJaxPreviewHelper::inst()
+{
+    if (!s_inst) {
+        s_inst = new VMathJaxPreviewHelper(QCoreApplication::instance());
+    }
+
+    return s_inst;
+}
+
+VMathJaxPreviewHelper::VMathJaxPreviewHelper(QObject *p_parent)
     : QObject(p_parent),
-      m_parentWidget(p_parentWidget),
-      m_initialized(false),
       m_nextID(0),
-      m_webView(NULL),
-      m_webReady(false)
+      m_nextBatchID(0)
 {
+    // Pages should be gone before the web engine is torn down.
+    connect(QCoreApplication::instance(), &QCoreApplication::aboutToQuit,
+            this, [this]() {
+                m_pending.clear();
+                for (auto page : m_pages) {
+                    destroyPage(page);
+                }
+
+                m_pages.clear();
+            });
 }
 
 VMathJaxPreviewHelper::~VMathJaxPreviewHelper()
 {
+    for (auto page : m_pages) {
+        destroyPage(page);
+    }
+
+    m_pages.clear();
+
+    s_inst = NULL;
+}
+
+void VMathJaxPreviewHelper::previewMathJax(int p_identifier,
+                                           int p_id,
+                                           TimeStamp p_timeStamp,
+                                           const QString &p_text)
+{
+    QString key = VRenderCache::key("mathjax", p_text, QString(), rendererVersion(), theme());
+    if (findCache(key, false, p_identifier, p_id, p_timeStamp)) {
+        return;
+    }
+
+    Request req;
+    req.m_type = MathJax;
+    req.m_identifier = p_identifier;
+    req.m_id = p_id;
+    req.m_timeStamp = p_timeStamp;
+    req.m_text = p_text;
+    req.m_cacheKey = key;
+    req.m_isHtml = false;
+    submit(req);
 }
 
-void VMathJaxPreviewHelper::doInit()
+void VMathJaxPreviewHelper::previewMathJaxBatch(int p_identifier,
+                                                TimeStamp p_timeStamp,
+                                                const QVector<int> &p_ids,
+                                                const QStringList &p_texts,
+                                                bool p_isHtml)
 {
-    Q_ASSERT(!m_initialized);
-    Q_ASSERT(m_parentWidget);
+    Q_ASSERT(p_ids.size() == p_texts.size());
+    if (p_ids.isEmpty()) {
+        return;
+    }
 
-    m_initialized = true;
+    // The caller saves the results to VRenderCache by its own keys.
+    Request req;
+    req.m_type = MathJaxBatch;
+    req.m_identifier = p_identifier;
+    req.m_id = m_nextBatchID++;
+    req.m_timeStamp = p_timeStamp;
+    req.m_ids = p_ids;
+    req.m_texts = p_texts;
+    req.m_isHtml = p_isHtml;
+    submit(req);
+}
 
-    m_webView = new QWebEngineView(m_parentWidget);
-    connect(m_webView, &QWebEngineView::loadFinished,
-            this, [this]() {
-                m_webReady = true;
-                for (auto const & it : m_pendingFunc) {
-                    it();
-                }
+void VMathJaxPreviewHelper::previewDiagram(int p_identifier,
+                                           int p_id,
+                                           TimeStamp p_timeStamp,
+                                           const QString &p_lang,
+                                           const QString &p_text)
+{
+    QString key = VRenderCache::key(p_lang, p_text, QString(), rendererVersion(), theme());
+    if (findCache(key, true, p_identifier, p_id, p_timeStamp)) {
+        return;
+    }
+
+    Request req;
+    req.m_type = Diagram;
+    req.m_identifier = p_identifier;
+    req.m_id = p_id;
+    req.m_timeStamp = p_timeStamp;
+    req.m_lang = p_lang;
+    req.m_text = p_text;
+    req.m_cacheKey = key;
+    req.m_isHtml = false;
+    submit(req);
+}
+
+void VMathJaxPreviewHelper::submit(const Request &p_req)
+{
+    // Callers only care about the latest time stamp, so pending requests of
+    // an older one could be dropped.
+    for (int i = m_pending.size() - 1; i >= 0; --i) {
+        const Request &req = m_pending[i];
+        if (req.m_identifier == p_req.m_identifier
+            && (req.m_timeStamp < p_req.m_timeStamp
+                || (req.m_timeStamp == p_req.m_timeStamp
+                    && req.m_id == p_req.m_id
+                    && req.m_type == p_req.m_type))) {
+            m_pending.removeAt(i);
+        }
+    }
+
+    m_pending.append(p_req);
+    dispatch();
+}
+
+void VMathJaxPreviewHelper::dispatch()
+{
+    while (!m_pending.isEmpty()) {
+        Page *page = pickPage();
+        if (!page) {
+            return;
+        }
+
+        sendRequest(page, m_pending.takeFirst());
+    }
+}
+
+VMathJaxPreviewHelper::Page *VMathJaxPreviewHelper::pickPage()
+{
+    Page *idlest = NULL;
+    for (auto page : m_pages) {
+        if (!idlest || page->m_requests.size() < idlest->m_requests.size()) {
+            idlest = page;
+        }
+    }
+
+    if (idlest && idlest->m_requests.size() < MAX_REQUESTS_PER_PAGE) {
+        return idlest;
+    }
+
+    if (m_pages.size() < MAX_PAGES) {
+        Page *page = createPage();
+        m_pages.append(page);
+        return page;
+    }
+
+    return NULL;
+}
+
+VMathJaxPreviewHelper::Page *VMathJaxPreviewHelper::createPage()
+{
+    Page *page = new Page();
+    page->m_ready = false;
 
-                m_pendingFunc.clear();
+    page->m_timer = new QTimer(this);
+    page->m_timer->setSingleShot(true);
+    connect(page->m_timer, &QTimer::timeout,
+            this, [this, page]() {
+                handleTimeout(page);
             });
-    m_webView->hide();
-    m_webView->setFocusPolicy(Qt::NoFocus);
-
-    m_webDoc = new VMathJaxWebDocument(m_webView);
-    connect(m_webDoc, &VMathJaxWebDocument::mathjaxPreviewResultReady,
-            this, [this](int p_identifier,
-                         int p_id,
-                         TimeStamp p_timeStamp,
-                         const QString &p_format,
-                         const QString &p_data) {
+
+    page->m_page = new QWebEnginePage(this);
+    connect(page->m_page, &QWebEnginePage::loadFinished,
+            this, [this, page]() {
+                handleLoadFinished(page);
+            });
+
+    page->m_doc = new VMathJaxWebDocument(page->m_page);
+    connect(page->m_doc, &VMathJaxWebDocument::mathjaxPreviewResultReady,
+            this, [this, page](int p_identifier,
+                               int p_id,
+                               TimeStamp p_timeStamp,
+                               const QString &p_format,
+                               const QString &p_data) {
                 QByteArray ba = QByteArray::fromBase64(p_data.toUtf8());
-                emit mathjaxPreviewResultReady(p_identifier, p_id, p_timeStamp, p_format, ba);
+                handleResult(page, false, p_identifier, p_id, p_timeStamp, p_format, ba);
+            });
+
+    connect(page->m_doc, &VMathJaxWebDocument::mathjaxBatchPreviewResultReady,
+            this, [this, page](int p_identifier,
+                               int p_batchId,
+                               TimeStamp p_timeStamp,
+                               const QString &p_format,
+                               const QStringList &p_data) {
+                handleBatchResult(page, p_identifier, p_batchId, p_timeStamp, p_format, p_data);
             });
 
-    connect(m_webDoc, &VMathJaxWebDocument::diagramPreviewResultReady,
-            this, [this](int p_identifier,
-                        int p_id,
-                        TimeStamp p_timeStamp,
-                        const QString &p_format,
-                        const QString &p_data) {
+    connect(page->m_doc, &VMathJaxWebDocument::diagramPreviewResultReady,
+            this, [this, page](int p_identifier,
+                               int p_id,
+                               TimeStamp p_timeStamp,
+                               const QString &p_format,
+                               const QString &p_data) {
                 QByteArray ba;
                 if (p_format == "png") {
                     ba = QByteArray::fromBase64(p_data.toUtf8());
@@ -67,80 +240,248 @@ void VMathJaxPreviewHelper::doInit()
                     ba = p_data.toUtf8();
                 }
 
-                emit diagramPreviewResultReady(p_identifier, p_id, p_timeStamp, p_format, ba);
+                handleResult(page, true, p_identifier, p_id, p_timeStamp, p_format, ba);
             });
 
-    QWebChannel *channel = new QWebChannel(m_webView);
-    channel->registerObject(QStringLiteral("content"), m_webDoc);
-    m_webView->page()->setWebChannel(channel);
+    QWebChannel *channel = new QWebChannel(page->m_page);
+    channel->registerObject(QStringLiteral("content"), page->m_doc);
+    page->m_page->setWebChannel(channel);
 
-    // setHtml() will change focus if it is not disabled.
-    m_webView->setEnabled(false);
     QUrl baseUrl(QUrl::fromLocalFile(g_config->getDocumentPathOrHomePath() + QDir::separator()));
-    m_webView->setHtml(VUtils::generateMathJaxPreviewTemplate(), baseUrl);
-    m_webView->setEnabled(true);
+    page->m_page->setHtml(VUtils::generateMathJaxPreviewTemplate(), baseUrl);
+
+    startTimer(page);
+    return page;
 }
 
-void VMathJaxPreviewHelper::previewMathJax(int p_identifier,
-                                           int p_id,
-                                           TimeStamp p_timeStamp,
-                                           const QString &p_text)
+void VMathJaxPreviewHelper::destroyPage(Page *p_page)
 {
-    init();
-
-    if (!m_webReady) {
-        auto func = std::bind(&VMathJaxWebDocument::previewMathJax,
-                              m_webDoc,
-                              p_identifier,
-                              p_id,
-                              p_timeStamp,
-                              p_text,
-                              false);
-        m_pendingFunc.append(func);
-    } else {
-        m_webDoc->previewMathJax(p_identifier, p_id, p_timeStamp, p_text, false);
+    p_page->m_timer->disconnect(this);
+    p_page->m_timer->stop();
+    p_page->m_timer->deleteLater();
+
+    // The document and the channel are children of the page.
+    p_page->m_page->disconnect(this);
+    p_page->m_doc->disconnect(this);
+    delete p_page->m_page;
+
+    delete p_page;
+}
+
+void VMathJaxPreviewHelper::sendRequest(Page *p_page, const Request &p_req)
+{
+    p_page->m_requests.append(p_req);
+    startTimer(p_page);
+
+    if (!p_page->m_ready) {
+        // Will be sent once loaded.
+        return;
+    }
+
+    switch (p_req.m_type) {
+    case MathJax:
+        p_page->m_doc->previewMathJax(p_req.m_identifier,
+                                      p_req.m_id,
+                                      p_req.m_timeStamp,
+                                      p_req.m_text,
+                                      false);
+        break;
+
+    case MathJaxBatch:
+        p_page->m_doc->previewMathJaxBatch(p_req.m_identifier,
+                                           p_req.m_id,
+                                           p_req.m_timeStamp,
+                                           p_req.m_texts,
+                                           p_req.m_isHtml);
+        break;
+
+    case Diagram:
+        p_page->m_doc->previewDiagram(p_req.m_identifier,
+                                      p_req.m_id,
+                                      p_req.m_timeStamp,
+                                      p_req.m_lang,
+                                      p_req.m_text);
+        break;
     }
 }
 
-void VMathJaxPreviewHelper::previewMathJaxFromHtml(int p_identifier,
-                                                   int p_id,
-                                                   TimeStamp p_timeStamp,
-                                                   const QString &p_html)
+void VMathJaxPreviewHelper::handleLoadFinished(Page *p_page)
 {
-    init();
+    if (p_page->m_ready) {
+        return;
+    }
 
-    if (!m_webReady) {
-        auto func = std::bind(&VMathJaxWebDocument::previewMathJax,
-                              m_webDoc,
-                              p_identifier,
-                              p_id,
-                              p_timeStamp,
-                              p_html,
-                              true);
-        m_pendingFunc.append(func);
-    } else {
-        m_webDoc->previewMathJax(p_identifier, p_id, p_timeStamp, p_html, true);
+    p_page->m_ready = true;
+
+    QList<Request> reqs = p_page->m_requests;
+    p_page->m_requests.clear();
+    for (const auto &req : reqs) {
+        sendRequest(p_page, req);
     }
 }
 
-void VMathJaxPreviewHelper::previewDiagram(int p_identifier,
-                                           int p_id,
-                                           TimeStamp p_timeStamp,
-                                           const QString &p_lang,
-                                           const QString &p_text)
+void VMathJaxPreviewHelper::handleResult(Page *p_page,
+                                         bool p_isDiagram,
+                                         int p_identifier,
+                                         int p_id,
+                                         TimeStamp p_timeStamp,
+                                         const QString &p_format,
+                                         const QByteArray &p_data)
+{
+    for (int i = 0; i < p_page->m_requests.size(); ++i) {
+        const Request &req = p_page->m_requests[i];
+        if (req.m_type != MathJaxBatch
+            && req.isDiagram() == p_isDiagram
+            && req.m_identifier == p_identifier
+            && req.m_id == p_id
+            && req.m_timeStamp == p_timeStamp) {
+            if (!req.m_cacheKey.isEmpty()) {
+                VRenderCache::save(req.m_cacheKey, p_format, p_data);
+            }
+
+            p_page->m_requests.removeAt(i);
+            break;
+        }
+    }
+
+    startTimer(p_page);
+
+    emitResult(p_isDiagram, p_identifier, p_id, p_timeStamp, p_format, p_data);
+
+    dispatch();
+}
+
+void VMathJaxPreviewHelper::handleBatchResult(Page *p_page,
+                                              int p_identifier,
+                                              int p_batchId,
+                                              TimeStamp p_timeStamp,
+                                              const QString &p_format,
+                                              const QStringList &p_data)
+{
+    QVector<int> ids;
+    for (int i = 0; i < p_page->m_requests.size(); ++i) {
+        const Request &req = p_page->m_requests[i];
+        if (req.m_type == MathJaxBatch
+            && req.m_identifier == p_identifier
+            && req.m_id == p_batchId) {
+            ids = req.m_ids;
+            p_page->m_requests.removeAt(i);
+            break;
+        }
+    }
+
+    startTimer(p_page);
+
+    if (ids.isEmpty()) {
+        // Already given up.
+        dispatch();
+        return;
+    }
+
+    QVector<QByteArray> data(ids.size());
+    for (int i = 0; i < p_data.size() && i < data.size(); ++i) {
+        data[i] = QByteArray::fromBase64(p_data[i].toUtf8());
+    }
+
+    emit mathjaxBatchPreviewResultReady(p_identifier, p_timeStamp, ids, p_format, data);
+
+    dispatch();
+}
+
+void VMathJaxPreviewHelper::handleTimeout(Page *p_page)
+{
+    if (p_page->m_requests.isEmpty()) {
+        qDebug() << "destroy idle MathJax preview page";
+        m_pages.removeAll(p_page);
+        destroyPage(p_page);
+        return;
+    }
+
+    // Some requests will never be replied, such as failed online PlantUML.
+    qWarning() << "MathJax preview requests timed out" << p_page->m_requests.size();
+    QList<Request> reqs = p_page->m_requests;
+    p_page->m_requests.clear();
+    startTimer(p_page);
+
+    for (const auto &req : reqs) {
+        if (req.m_type == MathJaxBatch) {
+            emit mathjaxBatchPreviewResultReady(req.m_identifier,
+                                                req.m_timeStamp,
+                                                req.m_ids,
+                                                "png",
+                                                QVector<QByteArray>(req.m_ids.size()));
+        } else {
+            emitResult(req.isDiagram(), req.m_identifier, req.m_id, req.m_timeStamp, "png", QByteArray());
+        }
+    }
+
+    dispatch();
+}
+
+void VMathJaxPreviewHelper::startTimer(Page *p_page)
+{
+    p_page->m_timer->start(p_page->m_requests.isEmpty() ? MATHJAX_IDLE_TIMEOUT
+                                                        : MATHJAX_REQUEST_TIMEOUT);
+}
+
+void VMathJaxPreviewHelper::emitResult(bool p_isDiagram,
+                                       int p_identifier,
+                                       int p_id,
+                                       TimeStamp p_timeStamp,
+                                       const QString &p_format,
+                                       const QByteArray &p_data)
 {
-    init();
-
-    if (!m_webReady) {
-        auto func = std::bind(&VMathJaxWebDocument::previewDiagram,
-                              m_webDoc,
-                              p_identifier,
-                              p_id,
-                              p_timeStamp,
-                              p_lang,
-                              p_text);
-        m_pendingFunc.append(func);
+    if (p_isDiagram) {
+        emit diagramPreviewResultReady(p_identifier, p_id, p_timeStamp, p_format, p_data);
     } else {
-        m_webDoc->previewDiagram(p_identifier, p_id, p_timeStamp, p_lang, p_text);
+        emit mathjaxPreviewResultReady(p_identifier, p_id, p_timeStamp, p_format, p_data);
     }
 }
+
+const QString &VMathJaxPreviewHelper::rendererVersion()
+{
+    if (m_rendererVersion.isEmpty()) {
+        QByteArray hash = QCryptographicHash::hash(VUtils::generateMathJaxPreviewTemplate().toUtf8(),
+                                                   QCryptographicHash::Sha256);
+        m_rendererVersion = QString::fromLatin1(hash.toHex());
+    }
+
+    return m_rendererVersion;
+}
+
+const QString &VMathJaxPreviewHelper::theme()
+{
+    if (m_theme.isEmpty() || m_themeStyle != g_config->getCssStyle()) {
+        // It will decide the style if not yet.
+        QString url = g_config->getCssStyleUrl();
+        m_themeStyle = g_config->getCssStyle();
+
+        m_theme = url;
+        QUrl cssUrl(url);
+        if (cssUrl.isLocalFile()) {
+            QFileInfo info(cssUrl.toLocalFile());
+            m_theme += "|" + QString::number(info.lastModified().toMSecsSinceEpoch());
+        }
+    }
+
+    return m_theme;
+}
+
+bool VMathJaxPreviewHelper::findCache(const QString &p_key,
+                                      bool p_isDiagram,
+                                      int p_identifier,
+                                      int p_id,
+                                      TimeStamp p_timeStamp)
+{
+    QString format;
+    QByteArray data = VRenderCache::load(p_key, format);
+    if (data.isEmpty()) {
+        return false;
+    }
+
+    // Keep it asynchronous as the callers expect.
+    QTimer::singleShot(0, this, [this, p_isDiagram, p_identifier, p_id, p_timeStamp, format, data]() {
+                emitResult(p_isDiagram, p_identifier, p_id, p_timeStamp, format, data);
+            });
+    return true;
+}
@@ -2,24 +2,27 @@
 #define VMATHJAXPREVIEWHELPER_H
 
 #include <QObject>
-#include <functional>
 #include <QVector>
+#include <QList>
+#include <QStringList>
+#include <QByteArray>
 
 #include "vconstants.h"
 
-class QWebEngineView;
+class QWebEnginePage;
+class QTimer;
 class VMathJaxWebDocument;
-class QWidget;
-
-typedef std::function<void(void)> PendingFunc;
 
+// Renders MathJax and diagrams into images via hidden web pages shared by all
+// the editors, since each page costs a whole renderer process.
+// Requests are queued and sent to a small pool of pages, a few at a time, so
+// that requests superseded by a newer time stamp could be dropped before
+// sending. Results are routed back by the identifier of the caller.
 class VMathJaxPreviewHelper : public QObject
 {
     Q_OBJECT
 public:
-    explicit VMathJaxPreviewHelper(QWidget *p_parentWidget, QObject *p_parent = nullptr);
-
-    ~VMathJaxPreviewHelper();
+    static VMathJaxPreviewHelper *inst();
 
     // Get an ID for identification.
     int registerIdentifier();
@@ -30,7 +33,15 @@ public:
     // @p_text: raw text of the MathJax script.
     void previewMathJax(int p_identifier, int p_id, TimeStamp p_timeStamp, const QString &p_text);
 
-    void previewMathJaxFromHtml(int p_identitifer, int p_id, TimeStamp p_timeStamp, const QString &p_html);
+    // Preview all the @p_texts in one MathJax pass and return PNG data of them
+    // asynchronously in one mathjaxBatchPreviewResultReady().
+    // @p_ids: internal ids of @p_texts for the caller;
+    // @p_isHtml: whether @p_texts are HTML instead of raw text.
+    void previewMathJaxBatch(int p_identifier,
+                             TimeStamp p_timeStamp,
+                             const QVector<int> &p_ids,
+                             const QStringList &p_texts,
+                             bool p_isHtml);
 
     // Preview @p_text and return PNG data asynchronously.
     // @p_identifier: identifier the caller registered;
@@ -43,6 +54,14 @@ public:
                         const QString &p_lang,
                         const QString &p_text);
 
+    // Hash of the web page rendering the previews, used as the renderer
+    // version in VRenderCache.
+    const QString &rendererVersion();
+
+    // CSS style of the web page and its modification time, used as the theme
+    // in VRenderCache since the style decides the colors of the output.
+    const QString &theme();
+
 signals:
     void mathjaxPreviewResultReady(int p_identifier,
                                    int p_id,
@@ -50,6 +69,13 @@ signals:
                                    const QString &p_format,
                                    const QByteArray &p_data);
 
+    // @p_data is in the order of @p_ids and empty for failed ones.
+    void mathjaxBatchPreviewResultReady(int p_identifier,
+                                        TimeStamp p_timeStamp,
+                                        const QVector<int> &p_ids,
+                                        const QString &p_format,
+                                        const QVector<QByteArray> &p_data);
+
     void diagramPreviewResultReady(int p_identifier,
                                    int p_id,
                                    TimeStamp p_timeStamp,
@@ -57,34 +83,135 @@ signals:
                                    const QByteArray &p_data);
 
 private:
-    void init();
+    enum RequestType
+    {
+        MathJax = 0,
+        MathJaxBatch,
+        Diagram
+    };
+
+    struct Request
+    {
+        bool isDiagram() const
+        {
+            return m_type == Diagram;
+        }
+
+        RequestType m_type;
+
+        int m_identifier;
+
+        // Id of the caller, or the batch id for MathJaxBatch.
+        int m_id;
+
+        TimeStamp m_timeStamp;
 
-    void doInit();
+        QString m_lang;
 
-    QWidget *m_parentWidget;
+        QString m_text;
 
-    int m_initialized;
+        // VRenderCache key to save the result. Empty if not cacheable.
+        QString m_cacheKey;
+
+        // For MathJaxBatch.
+        QVector<int> m_ids;
+
+        QStringList m_texts;
+
+        bool m_isHtml;
+    };
+
+    struct Page
+    {
+        QWebEnginePage *m_page;
+
+        VMathJaxWebDocument *m_doc;
+
+        // Whether the template has been loaded.
+        bool m_ready;
+
+        // Timer for the request timeout and the idle timeout.
+        QTimer *m_timer;
+
+        // Requests sent to this page, in order.
+        QList<Request> m_requests;
+    };
+
+    explicit VMathJaxPreviewHelper(QObject *p_parent = nullptr);
+
+    ~VMathJaxPreviewHelper();
+
+    void submit(const Request &p_req);
+
+    // Send pending requests to the pages.
+    void dispatch();
+
+    // Pick or create a page which could take one more request.
+    // Returns NULL if all are busy.
+    Page *pickPage();
+
+    Page *createPage();
+
+    void destroyPage(Page *p_page);
+
+    void sendRequest(Page *p_page, const Request &p_req);
+
+    void handleLoadFinished(Page *p_page);
+
+    void handleResult(Page *p_page,
+                      bool p_isDiagram,
+                      int p_identifier,
+                      int p_id,
+                      TimeStamp p_timeStamp,
+                      const QString &p_format,
+                      const QByteArray &p_data);
+
+    void handleBatchResult(Page *p_page,
+                           int p_identifier,
+                           int p_batchId,
+                           TimeStamp p_timeStamp,
+                           const QString &p_format,
+                           const QStringList &p_data);
+
+    void handleTimeout(Page *p_page);
+
+    void startTimer(Page *p_page);
+
+    void emitResult(bool p_isDiagram,
+                    int p_identifier,
+                    int p_id,
+                    TimeStamp p_timeStamp,
+                    const QString &p_format,
+                    const QByteArray &p_data);
+
+    // Emit the cached result of @p_key asynchronously if there is one.
+    bool findCache(const QString &p_key,
+                   bool p_isDiagram,
+                   int p_identifier,
+                   int p_id,
+                   TimeStamp p_timeStamp);
+
+    static VMathJaxPreviewHelper *s_inst;
 
     int m_nextID;
 
-    QWebEngineView *m_webView;
+    int m_nextBatchID;
 
-    VMathJaxWebDocument *m_webDoc;
+    QVector<Page *> m_pages;
 
-    bool m_webReady;
+    // Requests not sent to any page yet, in the order of submission.
+    QList<Request> m_pending;
 
-    QVector<PendingFunc> m_pendingFunc;
+    QString m_rendererVersion;
+
+    // CSS style used to compute m_theme.
+    QString m_themeStyle;
+
+    QString m_theme;
 };
 
 inline int VMathJaxPreviewHelper::registerIdentifier()
 {
     return m_nextID++;
 }
-
-inline void VMathJaxPreviewHelper::init()
-{
-    if (!m_initialized) {
-        doInit();
-    }
-}
 #endif // VMATHJAXPREVIEWHELPER_H
@@ -16,6 +16,15 @@ void VMathJaxWebDocument::previewMathJax(int p_identifier,
     emit requestPreviewMathJax(p_identifier, p_id, p_timeStamp, p_text, p_isHtml);
 }
 
+void VMathJaxWebDocument::previewMathJaxBatch(int p_identifier,
+                                              int p_batchId,
+                                              TimeStamp p_timeStamp,
+                                              const QStringList &p_texts,
+                                              bool p_isHtml)
+{
+    emit requestPreviewMathJaxBatch(p_identifier, p_batchId, p_timeStamp, p_texts, p_isHtml);
+}
+
 void VMathJaxWebDocument::mathjaxResultReady(int p_identifier,
                                              int p_id,
                                              unsigned long long p_timeStamp,
@@ -25,6 +34,15 @@ void VMathJaxWebDocument::mathjaxResultReady(int p_identifier,
     emit mathjaxPreviewResultReady(p_identifier, p_id, p_timeStamp, p_format, p_data);
 }
 
+void VMathJaxWebDocument::mathjaxBatchResultReady(int p_identifier,
+                                                  int p_batchId,
+                                                  unsigned long long p_timeStamp,
+                                                  const QString &p_format,
+                                                  const QStringList &p_data)
+{
+    emit mathjaxBatchPreviewResultReady(p_identifier, p_batchId, p_timeStamp, p_format, p_data);
+}
+
 void VMathJaxWebDocument::diagramResultReady(int p_identifier,
                                              int p_id,
                                              unsigned long long p_timeStamp,
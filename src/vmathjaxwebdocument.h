@@ -2,6 +2,7 @@
 #define VMATHJAXWEBDOCUMENT_H
 
 #include <QObject>
+#include <QStringList>
 
 #include "vconstants.h"
 
@@ -17,6 +18,13 @@ public:
                         const QString &p_text,
                         bool p_isHtml);
 
+    // Typeset @p_texts in one pass.
+    void previewMathJaxBatch(int p_identifier,
+                             int p_batchId,
+                             TimeStamp p_timeStamp,
+                             const QStringList &p_texts,
+                             bool p_isHtml);
+
     void previewDiagram(int p_identifier,
                         int p_id,
                         TimeStamp p_timeStamp,
@@ -32,6 +40,13 @@ public slots:
                             const QString &p_format,
                             const QString &p_data);
 
+    // @p_data: base64 PNG data in the order of the requested texts.
+    void mathjaxBatchResultReady(int p_identifier,
+                                 int p_batchId,
+                                 unsigned long long p_timeStamp,
+                                 const QString &p_format,
+                                 const QStringList &p_data);
+
     void diagramResultReady(int p_identifier,
                             int p_id,
                             unsigned long long p_timeStamp,
@@ -47,6 +62,12 @@ signals:
                                const QString &p_text,
                                bool p_isHtml);
 
+    void requestPreviewMathJaxBatch(int p_identifier,
+                                    int p_batchId,
+                                    unsigned long long p_timeStamp,
+                                    const QStringList &p_texts,
+                                    bool p_isHtml);
+
     void requestPreviewDiagram(int p_identifier,
                                int p_id,
                                unsigned long long p_timeStamp,
@@ -59,6 +80,12 @@ signals:
                                    const QString &p_format,
                                    const QString &p_data);
 
+    void mathjaxBatchPreviewResultReady(int p_identifier,
+                                        int p_batchId,
+                                        TimeStamp p_timeStamp,
+                                        const QString &p_format,
+                                        const QStringList &p_data);
+
     void diagramPreviewResultReady(int p_identifier,
                                    int p_id,
                                    TimeStamp p_timeStamp,
@@ -85,7 +85,9 @@ VMdEditor::VMdEditor(VFile *p_file,
     m_pegHighlighter->init(g_config->getMdHighlightingStyles(),
                            g_config->getCodeBlockStyles(),
                            g_config->getEnableMathjax(),
-                           g_config->getMarkdownHighlightInterval());
+                           g_config->getMarkdownHighlightInterval(),
+                           g_config->getMarkdownHighlightIntervalMin(),
+                           g_config->getMarkdownHighlightIntervalMax());
     connect(m_pegHighlighter, &PegMarkdownHighlighter::headersUpdated,
             this, &VMdEditor::updateHeaders);
 
@@ -1040,6 +1042,10 @@ void VMdEditor::updateTextEditConfig()
 
     setEnableExtraBuffer(g_config->getEnableExtraBuffer());
 
+    setLazyLayoutBlockNumber(g_config->getLazyLayoutBlockNumber());
+
+    setBlockTileCacheSize(g_config->getBlockTileCacheSize() * 1024);
+
     int lineNumber = g_config->getEditorLineNumber();
     if (lineNumber < (int)LineNumberType::None || lineNumber >= (int)LineNumberType::Invalid) {
         lineNumber = (int)LineNumberType::None;
@@ -1623,9 +1629,8 @@ bool VMdEditor::initInPlacePreviewMenu(QAction *p_before,
         const VPreviewedImageInfo &pii = info->m_imageInfo;
         if (pii.contains(pib)
             || (pii.contains(pib - 1) && pib == p_block.length() - 1)) {
-            const QPixmap *img = findImage(pii.m_imageName);
-            if (img) {
-                image = *img;
+            image = findImage(pii.m_imageName);
+            if (!image.isNull()) {
                 background = pii.m_background;
             }
 
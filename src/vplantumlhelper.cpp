@@ -2,27 +2,73 @@
 
 #include <QDebug>
 #include <QThread>
+#include <QTimer>
+#include <QFileInfo>
+#include <QDateTime>
 
 #include "vconfigmanager.h"
 #include "utils/vprocessutils.h"
+#include "vplantumlserver.h"
+#include "vrendercache.h"
+#include "vrenderscheduler.h"
 
 extern VConfigManager *g_config;
 
-#define TaskIdProperty "PlantUMLTaskId"
-#define TaskFormatProperty "PlantUMLTaskFormat"
-#define TaskTimeStampProperty "PlantUMLTaskTimeStamp"
+// Everything of the command affecting the output.
+static QString rendererVersion(const QString &p_customCmd)
+{
+    if (!p_customCmd.isEmpty()) {
+        return p_customCmd;
+    }
+
+    QString program;
+    QStringList args;
+    VPlantUMLHelper::prepareCommand(program, args);
+
+    QFileInfo jar(g_config->getPlantUMLJar());
+    return program + " " + args.join(' ')
+           + "|" + QString::number(jar.size())
+           + "|" + QString::number(jar.lastModified().toMSecsSinceEpoch());
+}
+
+// Skin parameters in the -config file of PlantUML, used as the theme in
+// VRenderCache. The custom command is opaque to us.
+static QString skinVersion(const QString &p_customCmd)
+{
+    if (!p_customCmd.isEmpty()) {
+        return QString();
+    }
+
+    const QStringList &args = g_config->getPlantUMLArgs();
+    int idx = args.indexOf("-config");
+    if (idx == -1 || idx + 1 >= args.size()) {
+        return QString();
+    }
+
+    QFileInfo config(args[idx + 1]);
+    return config.absoluteFilePath()
+           + "|" + QString::number(config.size())
+           + "|" + QString::number(config.lastModified().toMSecsSinceEpoch());
+}
 
 VPlantUMLHelper::VPlantUMLHelper(QObject *p_parent)
-    : QObject(p_parent)
+    : QObject(p_parent),
+      m_latestTimeStamp(0)
 {
     m_customCmd = g_config->getPlantUMLCmd();
     if (m_customCmd.isEmpty()) {
         prepareCommand(m_program, m_args);
     }
+
+    connect(VPlantUMLServer::inst(), &VPlantUMLServer::resultReady,
+            this, &VPlantUMLHelper::handleServerResult);
+    connect(VRenderScheduler::inst(), &VRenderScheduler::renderFinished,
+            this, &VPlantUMLHelper::handleRenderFinished);
 }
 
 VPlantUMLHelper::VPlantUMLHelper(const QString &p_jar, QObject *p_parent)
-    : QObject(p_parent)
+    : QObject(p_parent),
+      m_latestTimeStamp(0)
 {
     m_customCmd = g_config->getPlantUMLCmd();
     if (m_customCmd.isEmpty()) {
@@ -33,37 +79,76 @@ VPlantUMLHelper::VPlantUMLHelper(const QString &p_jar, QObject *p_parent)
 void VPlantUMLHelper::processAsync(int p_id,
                                    TimeStamp p_timeStamp,
                                    const QString &p_format,
-                                   const QString &p_text)
+                                   const QString &p_text,
+                                   int p_priority)
 {
-    QProcess *process = new QProcess(this);
-    process->setProperty(TaskIdProperty, p_id);
-    process->setProperty(TaskTimeStampProperty, p_timeStamp);
-    process->setProperty(TaskFormatProperty, p_format);
-    connect(process, SIGNAL(finished(int, QProcess::ExitStatus)),
-            this, SLOT(handleProcessFinished(int, QProcess::ExitStatus)));
+    if (p_timeStamp > m_latestTimeStamp) {
+        m_latestTimeStamp = p_timeStamp;
+        // Requests of the new timestamp come in a row.
+        QTimer::singleShot(0, this, &VPlantUMLHelper::cancelObsoleteTasks);
+    }
+
+    Task task;
+    task.m_id = p_id;
+    task.m_timeStamp = p_timeStamp;
+    task.m_format = p_format;
+    task.m_cacheKey = VRenderCache::key("puml",
+                                        p_text,
+                                        p_format,
+                                        rendererVersion(m_customCmd),
+                                        skinVersion(m_customCmd));
+
+    QString format;
+    QByteArray data = VRenderCache::load(task.m_cacheKey, format);
+    if (!data.isEmpty()) {
+        // Keep it asynchronous as the callers expect.
+        QTimer::singleShot(0, this, [this, task, data]() {
+                    emitResult(task, data);
+                });
+        return;
+    }
 
     if (m_customCmd.isEmpty()) {
-        QStringList args(m_args);
-        args << ("-t" + p_format);
-        qDebug() << m_program << args;
-        process->start(m_program, refineArgsForUse(args));
-    } else {
-        QString cmd(m_customCmd);
-        cmd.replace("%0", p_format);
-        qDebug() << cmd;
-        process->start(cmd);
-    }
+        // Reuse the running PlantUML processes.
+        m_tasks.insert(VPlantUMLServer::inst()->render(p_format, p_text, p_priority), task);
+        return;
+    }
+
+    // The custom command may not support multiple diagrams in one process.
+    QString cmd(m_customCmd);
+    cmd.replace("%0", p_format);
+    quint64 reqId = VRenderScheduler::inst()->render("plantuml",
+                                                     cmd,
+                                                     QStringList(),
+                                                     p_text.toUtf8(),
+                                                     p_priority);
+    m_customTasks.insert(reqId, task);
+}
 
-    if (process->write(p_text.toUtf8()) == -1) {
-        qWarning() << "fail to write to QProcess:" << process->errorString();
+void VPlantUMLHelper::cancelObsoleteTasks()
+{
+    for (auto it = m_tasks.begin(); it != m_tasks.end();) {
+        if (it.value().m_timeStamp < m_latestTimeStamp) {
+            VPlantUMLServer::inst()->cancel(it.key());
+            it = m_tasks.erase(it);
+        } else {
+            ++it;
+        }
     }
 
-    process->closeWriteChannel();
+    for (auto it = m_customTasks.begin(); it != m_customTasks.end();) {
+        if (it.value().m_timeStamp < m_latestTimeStamp) {
+            VRenderScheduler::inst()->cancel(it.key());
+            it = m_customTasks.erase(it);
+        } else {
+            ++it;
+        }
+    }
 }
 
 void VPlantUMLHelper::prepareCommand(QString &p_program,
                                      QStringList &p_args,
-                                     const QString &p_jar) const
+                                     const QString &p_jar)
 {
 #if defined(Q_OS_WIN)
     p_program = "java";
@@ -91,16 +176,24 @@ void VPlantUMLHelper::prepareCommand(QString &p_program,
     p_args << g_config->getPlantUMLArgs();
 }
 
-void VPlantUMLHelper::handleProcessFinished(int p_exitCode, QProcess::ExitStatus p_exitStatus)
+void VPlantUMLHelper::handleRenderFinished(quint64 p_reqId,
+                                           int p_exitCode,
+                                           QProcess::ExitStatus p_exitStatus,
+                                           const QByteArray &p_out,
+                                           const QByteArray &p_err)
 {
-    QProcess *process = static_cast<QProcess *>(sender());
-    int id = process->property(TaskIdProperty).toInt();
-    QString format = process->property(TaskFormatProperty).toString();
-    TimeStamp timeStamp = process->property(TaskTimeStampProperty).toULongLong();
+    auto it = m_customTasks.find(p_reqId);
+    if (it == m_customTasks.end()) {
+        return;
+    }
+
+    Task task = it.value();
+    m_customTasks.erase(it);
+
     qDebug() << QString("PlantUML finished: id %1 timestamp %2 format %3 exitcode %4 exitstatus %5")
-                       .arg(id)
-                       .arg(timeStamp)
-                       .arg(format)
+                       .arg(task.m_id)
+                       .arg(task.m_timeStamp)
+                       .arg(task.m_format)
                        .arg(p_exitCode)
                        .arg(p_exitStatus);
     bool failed = true;
@@ -109,20 +202,18 @@ void VPlantUMLHelper::handleProcessFinished(int p_exitCode, QProcess::ExitStatus
             qWarning() << "PlantUML fail" << p_exitCode;
         } else {
             failed = false;
-            QByteArray outBa = process->readAllStandardOutput();
-            if (format == "svg") {
-                emit resultReady(id, timeStamp, format, QString::fromLocal8Bit(outBa));
-            } else {
-                emit resultReady(id, timeStamp, format, QString::fromLocal8Bit(outBa.toBase64()));
+            if (p_exitCode == 0) {
+                VRenderCache::save(task.m_cacheKey, task.m_format, p_out);
             }
+
+            emitResult(task, p_out);
         }
     } else {
         qWarning() << "fail to start PlantUML process" << p_exitCode << p_exitStatus;
     }
 
-    QByteArray errBa = process->readAllStandardError();
-    if (!errBa.isEmpty()) {
-        QString errStr(QString::fromLocal8Bit(errBa));
+    if (!p_err.isEmpty()) {
+        QString errStr(QString::fromLocal8Bit(p_err));
         if (failed) {
             qWarning() << "PlantUML stderr:" << errStr;
         } else {
@@ -131,10 +222,36 @@ void VPlantUMLHelper::handleProcessFinished(int p_exitCode, QProcess::ExitStatus
     }
 
     if (failed) {
-        emit resultReady(id, timeStamp, format, "");
+        emit resultReady(task.m_id, task.m_timeStamp, task.m_format, "");
+    }
+}
+
+void VPlantUMLHelper::handleServerResult(quint64 p_reqId, const QByteArray &p_data)
+{
+    auto it = m_tasks.find(p_reqId);
+    if (it == m_tasks.end()) {
+        return;
     }
 
-    process->deleteLater();
+    Task task = it.value();
+    m_tasks.erase(it);
+
+    if (p_data.isEmpty()) {
+        qWarning() << "PlantUML fail" << task.m_id << task.m_timeStamp;
+        emit resultReady(task.m_id, task.m_timeStamp, task.m_format, "");
+    } else {
+        VRenderCache::save(task.m_cacheKey, task.m_format, p_data);
+        emitResult(task, p_data);
+    }
+}
+
+void VPlantUMLHelper::emitResult(const Task &p_task, const QByteArray &p_data)
+{
+    if (p_task.m_format == "svg") {
+        emit resultReady(p_task.m_id, p_task.m_timeStamp, p_task.m_format, QString::fromLocal8Bit(p_data));
+    } else {
+        emit resultReady(p_task.m_id, p_task.m_timeStamp, p_task.m_format, QString::fromLocal8Bit(p_data.toBase64()));
+    }
 }
 
 bool VPlantUMLHelper::testPlantUMLJar(const QString &p_jar, QString &p_msg)
@@ -167,23 +284,37 @@ bool VPlantUMLHelper::testPlantUMLJar(const QString &p_jar, QString &p_msg)
 
 QByteArray VPlantUMLHelper::process(const QString &p_format, const QString &p_text)
 {
-    VPlantUMLHelper inst;
+    QString customCmd = g_config->getPlantUMLCmd();
+    QString key = VRenderCache::key("puml",
+                                    p_text,
+                                    p_format,
+                                    rendererVersion(customCmd),
+                                    skinVersion(customCmd));
+    QString format;
+    QByteArray data = VRenderCache::load(key, format);
+    if (!data.isEmpty()) {
+        return data;
+    }
 
     int exitCode = -1;
     QByteArray out, err;
     int ret = -1;
-    if (inst.m_customCmd.isEmpty()) {
-        QStringList args(inst.m_args);
+    if (customCmd.isEmpty()) {
+        // Use a one-shot process instead of the shared servers, which could
+        // only be waited for in a nested event loop.
+        QString program;
+        QStringList args;
+        prepareCommand(program, args);
         args << ("-t" + p_format);
         args = refineArgsForUse(args);
-        ret = VProcessUtils::startProcess(inst.m_program,
+        ret = VProcessUtils::startProcess(program,
                                           args,
                                           p_text.toUtf8(),
                                           exitCode,
                                           out,
                                           err);
     } else {
-        QString cmd(inst.m_customCmd);
+        QString cmd(customCmd);
         cmd.replace("%0", p_format);
         ret = VProcessUtils::startProcess(cmd,
                                           p_text.toUtf8(),
@@ -194,6 +325,8 @@ QByteArray VPlantUMLHelper::process(const QString &p_format, const QString &p_te
 
     if (ret != 0 || exitCode < 0) {
         qWarning() << "PlantUML fail" << ret << exitCode << QString::fromLocal8Bit(err);
+    } else if (exitCode == 0) {
+        VRenderCache::save(key, p_format, out);
     }
 
     return out;
@@ -5,6 +5,7 @@
 
 #include <QStringList>
 #include <QProcess>
+#include <QHash>
 
 #include "vconstants.h"
 
@@ -14,10 +15,14 @@ class VPlantUMLHelper : public QObject
 public:
     explicit VPlantUMLHelper(QObject *p_parent = nullptr);
 
+    // Requests of older timestamps will be canceled once a request of a newer
+    // timestamp comes.
+    // @p_priority: VRenderScheduler::Priority.
     void processAsync(int p_id,
                       TimeStamp p_timeStamp,
                       const QString &p_format,
-                      const QString &p_text);
+                      const QString &p_text,
+                      int p_priority = 0);
 
     static bool testPlantUMLJar(const QString &p_jar, QString &p_msg);
 
@@ -27,6 +32,12 @@ public:
                                               QString &p_hints,
                                               bool &p_isRegex);
 
+    static void prepareCommand(QString &p_program,
+                               QStringList &p_args,
+                               const QString &p_jar = QString());
+
+    static QStringList refineArgsForUse(const QStringList &p_args);
+
 signals:
     void resultReady(int p_id,
                      TimeStamp p_timeStamp,
@@ -34,14 +45,32 @@ signals:
                      const QString &p_result);
 
 private slots:
-    void handleProcessFinished(int p_exitCode, QProcess::ExitStatus p_exitStatus);
+    void handleRenderFinished(quint64 p_reqId,
+                              int p_exitCode,
+                              QProcess::ExitStatus p_exitStatus,
+                              const QByteArray &p_out,
+                              const QByteArray &p_err);
+
+    void handleServerResult(quint64 p_reqId, const QByteArray &p_data);
+
+    void cancelObsoleteTasks();
 
 private:
-    VPlantUMLHelper(const QString &p_jar, QObject *p_parent = nullptr);
+    struct Task
+    {
+        int m_id;
 
-    void prepareCommand(QString &p_cmd, QStringList &p_args, const QString &p_jar= QString()) const;
+        TimeStamp m_timeStamp;
 
-    static QStringList refineArgsForUse(const QStringList &p_args);
+        QString m_format;
+
+        // Key in VRenderCache.
+        QString m_cacheKey;
+    };
+
+    VPlantUMLHelper(const QString &p_jar, QObject *p_parent = nullptr);
+
+    void emitResult(const Task &p_task, const QByteArray &p_data);
 
     QString m_program;
 
@@ -49,6 +78,14 @@ private:
 
     // When not empty, @m_program and @m_args will be ignored.
     QString m_customCmd;
+
+    // Tasks sent to VPlantUMLServer by request id.
+    QHash<quint64, Task> m_tasks;
+
+    // Tasks of the custom command sent to VRenderScheduler by request id.
+    QHash<quint64, Task> m_customTasks;
+
+    TimeStamp m_latestTimeStamp;
 };
 
 #endif // VPLANTUMLHELPER_H
@@ -0,0 +1,476 @@
+#include "vplantumlserver.h"
+
+#include <QDebug>
+#include <QProcess>
+#include <QRegularExpression>
+#include <QTimer>
+#include <QCoreApplication>
+#include <QSet>
+
+#include "vplantumlhelper.h"
+
+// Printed by PlantUML after each image. Should be safe in a shell command.
+#define PLANTUML_DELIMITER "VNOTE_PLANTUML_END_OF_IMAGE"
+
+// Max number of processes for one format.
+#define MAX_WORKERS_PER_FORMAT 2
+
+// Max number of requests written to one process at a time.
+#define MAX_REQUESTS_PER_WORKER 2
+
+// A process with requests not replied in time is restarted.
+#define PLANTUML_REQUEST_TIMEOUT 60000
+
+// A process idle for a while is stopped to release the memory of the JVM.
+#define PLANTUML_IDLE_TIMEOUT (5 * 60 * 1000)
+
+// Max number of restarts caused by one request before giving it up.
+#define MAX_REQUEST_RETRIES 1
+
+// Max size of stderr kept for one request.
+#define MAX_ERROR_SIZE 4096
+
+VPlantUMLServer *VPlantUMLServer::s_inst = NULL;
+
+VPlantUMLServer *VPlantUMLServer::inst()
+{
+    if (!s_inst) {
+        s_inst = new VPlantUMLServer(QCoreApplication::instance());
+    }
+
+    return s_inst;
+}
+
+VPlantUMLServer::VPlantUMLServer(QObject *p_parent)
+    : QObject(p_parent),
+      m_nextId(0)
+{
+}
+
+VPlantUMLServer::~VPlantUMLServer()
+{
+    // Processes and timers are children of this object. Kill all the
+    // processes first so that they exit in parallel.
+    for (auto worker : m_workers) {
+        if (worker->m_process) {
+            worker->m_process->disconnect(this);
+            worker->m_process->kill();
+        }
+
+        delete worker;
+    }
+
+    m_workers.clear();
+
+    s_inst = NULL;
+}
+
+quint64 VPlantUMLServer::render(const QString &p_format, const QString &p_text, int p_priority)
+{
+    quint64 id = ++m_nextId;
+    submit(id, p_format, p_text, p_priority);
+    return id;
+}
+
+void VPlantUMLServer::cancel(quint64 p_id)
+{
+    for (int i = 0; i < m_pending.size(); ++i) {
+        Request &req = m_pending[i];
+        if (req.m_ids.removeOne(p_id)) {
+            if (req.m_ids.isEmpty()) {
+                m_pending.removeAt(i);
+            }
+
+            return;
+        }
+    }
+
+    // Requests written could not be taken back. Just drop the result.
+    for (auto worker : m_workers) {
+        for (auto &req : worker->m_requests) {
+            if (req.m_ids.removeOne(p_id)) {
+                return;
+            }
+        }
+    }
+}
+
+void VPlantUMLServer::submit(quint64 p_id,
+                             const QString &p_format,
+                             const QString &p_text,
+                             int p_priority)
+{
+    updateCommand();
+
+    QByteArray text = prepareText(p_text);
+
+    // Merge into an identical request.
+    for (auto &req : m_pending) {
+        if (req.m_format == p_format && req.m_text == text) {
+            req.m_ids.append(p_id);
+            req.m_priority = qMax(req.m_priority, p_priority);
+            return;
+        }
+    }
+
+    for (auto worker : m_workers) {
+        if (worker->m_format != p_format) {
+            continue;
+        }
+
+        for (auto &req : worker->m_requests) {
+            if (req.m_text == text) {
+                req.m_ids.append(p_id);
+                return;
+            }
+        }
+    }
+
+    Request req;
+    req.m_ids.append(p_id);
+    req.m_format = p_format;
+    req.m_text = text;
+    req.m_priority = p_priority;
+    req.m_retries = 0;
+    m_pending.append(req);
+
+    dispatch(p_format);
+}
+
+void VPlantUMLServer::dispatch(const QString &p_format)
+{
+    while (true) {
+        // The first one of the highest priority.
+        int idx = -1;
+        for (int i = 0; i < m_pending.size(); ++i) {
+            const Request &req = m_pending[i];
+            if (req.m_format == p_format
+                && (idx == -1 || req.m_priority > m_pending[idx].m_priority)) {
+                idx = i;
+            }
+        }
+
+        if (idx == -1) {
+            break;
+        }
+
+        Worker *worker = pickWorker(p_format);
+        if (!worker) {
+            break;
+        }
+
+        writeRequest(worker, m_pending.takeAt(idx));
+    }
+}
+
+void VPlantUMLServer::updateCommand()
+{
+    QString program;
+    QStringList args;
+    VPlantUMLHelper::prepareCommand(program, args);
+    if (program == m_program && args == m_args) {
+        return;
+    }
+
+    m_program = program;
+    m_args = args;
+
+    // Requests in flight go back to the front of the pending ones.
+    QList<Request> reqs;
+    QSet<QString> formats;
+    for (auto worker : m_workers) {
+        formats.insert(worker->m_format);
+        for (const auto &req : worker->m_requests) {
+            reqs.append(req);
+        }
+
+        worker->m_requests.clear();
+        destroyWorker(worker);
+    }
+
+    m_workers.clear();
+
+    m_pending = reqs + m_pending;
+    for (const auto &format : formats) {
+        dispatch(format);
+    }
+}
+
+VPlantUMLServer::Worker *VPlantUMLServer::pickWorker(const QString &p_format)
+{
+    Worker *idlest = NULL;
+    int cnt = 0;
+    for (auto worker : m_workers) {
+        if (worker->m_format != p_format) {
+            continue;
+        }
+
+        ++cnt;
+        if (!idlest || worker->m_requests.size() < idlest->m_requests.size()) {
+            idlest = worker;
+        }
+    }
+
+    if (idlest && idlest->m_requests.isEmpty()) {
+        return idlest;
+    }
+
+    if (cnt < MAX_WORKERS_PER_FORMAT) {
+        return createWorker(p_format);
+    }
+
+    if (idlest && idlest->m_requests.size() < MAX_REQUESTS_PER_WORKER) {
+        return idlest;
+    }
+
+    return NULL;
+}
+
+VPlantUMLServer::Worker *VPlantUMLServer::createWorker(const QString &p_format)
+{
+    Worker *worker = new Worker();
+    worker->m_format = p_format;
+    worker->m_process = NULL;
+    worker->m_timer = new QTimer(this);
+    worker->m_timer->setSingleShot(true);
+    connect(worker->m_timer, &QTimer::timeout,
+            this, [this, worker]() {
+                handleTimeout(worker);
+            });
+
+    m_workers.append(worker);
+    startWorker(worker);
+    return worker;
+}
+
+void VPlantUMLServer::startWorker(Worker *p_worker)
+{
+    Q_ASSERT(!p_worker->m_process);
+    QStringList args(m_args);
+    args << ("-t" + p_worker->m_format);
+    args << "-pipedelimitor" << PLANTUML_DELIMITER;
+
+#if !defined(Q_OS_WIN)
+    // Replace the shell to make the JVM the process we manage.
+    int idx = args.indexOf("java");
+    if (idx > -1) {
+        args[idx] = "exec java";
+    }
+#endif
+
+    args = VPlantUMLHelper::refineArgsForUse(args);
+    qDebug() << "start PlantUML server" << m_program << args;
+
+    QProcess *process = new QProcess(this);
+    p_worker->m_process = process;
+    p_worker->m_output.clear();
+    p_worker->m_error.clear();
+
+    connect(process, &QProcess::readyReadStandardOutput,
+            this, [this, p_worker]() {
+                handleOutput(p_worker);
+            });
+    // Stderr is reported only if a request fails.
+    connect(process, &QProcess::readyReadStandardError,
+            this, [p_worker, process]() {
+                p_worker->m_error.append(process->readAllStandardError());
+                if (p_worker->m_error.size() > MAX_ERROR_SIZE) {
+                    p_worker->m_error = p_worker->m_error.right(MAX_ERROR_SIZE);
+                }
+            });
+    connect(process, static_cast<void (QProcess::*)(int, QProcess::ExitStatus)>(&QProcess::finished),
+            this, [this, p_worker](int p_exitCode, QProcess::ExitStatus p_exitStatus) {
+                qWarning() << "PlantUML server exited" << p_exitCode << p_exitStatus
+                           << QString::fromLocal8Bit(p_worker->m_error);
+                handleWorkerFailure(p_worker, false);
+            });
+    connect(process, &QProcess::errorOccurred,
+            this, [this, p_worker, process](QProcess::ProcessError p_error) {
+                if (p_error != QProcess::FailedToStart) {
+                    return;
+                }
+
+                qWarning() << "fail to start PlantUML server";
+                // It may be emitted within start().
+                QTimer::singleShot(0, this, [this, p_worker, process]() {
+                    if (m_workers.contains(p_worker) && p_worker->m_process == process) {
+                        handleWorkerFailure(p_worker, true);
+                    }
+                });
+            });
+
+    process->start(m_program, args);
+}
+
+void VPlantUMLServer::destroyWorker(Worker *p_worker)
+{
+    releaseProcess(p_worker);
+
+    for (const auto &req : p_worker->m_requests) {
+        emitResult(req, QByteArray());
+    }
+
+    p_worker->m_timer->deleteLater();
+    delete p_worker;
+}
+
+void VPlantUMLServer::releaseProcess(Worker *p_worker)
+{
+    QProcess *process = p_worker->m_process;
+    if (!process) {
+        return;
+    }
+
+    p_worker->m_process = NULL;
+    process->disconnect(this);
+    if (process->state() == QProcess::NotRunning) {
+        process->deleteLater();
+        return;
+    }
+
+    // Deleting a running QProcess blocks until it exits.
+    connect(process, static_cast<void (QProcess::*)(int, QProcess::ExitStatus)>(&QProcess::finished),
+            process, &QObject::deleteLater);
+    process->kill();
+}
+
+void VPlantUMLServer::writeRequest(Worker *p_worker, const Request &p_req)
+{
+    p_worker->m_requests.enqueue(p_req);
+    if (p_worker->m_requests.size() == 1) {
+        startTimer(p_worker);
+    }
+
+    if (p_worker->m_process->write(p_req.m_text) == -1) {
+        qWarning() << "fail to write to PlantUML server:" << p_worker->m_process->errorString();
+    }
+}
+
+void VPlantUMLServer::handleOutput(Worker *p_worker)
+{
+    p_worker->m_output.append(p_worker->m_process->readAllStandardOutput());
+
+    const QByteArray delimiter(PLANTUML_DELIMITER);
+    while (true) {
+        int idx = p_worker->m_output.indexOf(delimiter);
+        if (idx == -1) {
+            break;
+        }
+
+        // Wait for the end of the delimiter line.
+        int end = p_worker->m_output.indexOf('\n', idx + delimiter.size());
+        if (end == -1) {
+            break;
+        }
+
+        QByteArray data = p_worker->m_output.left(idx);
+        while (data.endsWith('\n') || data.endsWith('\r')) {
+            data.chop(1);
+        }
+
+        p_worker->m_output.remove(0, end + 1);
+
+        if (p_worker->m_requests.isEmpty()) {
+            qWarning() << "unexpected PlantUML server output";
+            continue;
+        }
+
+        Request req = p_worker->m_requests.dequeue();
+        if (data.isEmpty() && !p_worker->m_error.isEmpty()) {
+            qWarning() << "PlantUML fail" << QString::fromLocal8Bit(p_worker->m_error);
+        }
+
+        p_worker->m_error.clear();
+        startTimer(p_worker);
+        emitResult(req, data);
+    }
+
+    dispatch(p_worker->m_format);
+}
+
+void VPlantUMLServer::handleWorkerFailure(Worker *p_worker, bool p_failedToStart)
+{
+    releaseProcess(p_worker);
+
+    // The oldest request may be the culprit.
+    if (!p_failedToStart && !p_worker->m_requests.isEmpty()) {
+        Request &req = p_worker->m_requests.head();
+        if (++req.m_retries > MAX_REQUEST_RETRIES) {
+            emitResult(p_worker->m_requests.dequeue(), QByteArray());
+        }
+    }
+
+    QString format = p_worker->m_format;
+    if (p_failedToStart) {
+        // No need to try the pending ones.
+        for (int i = m_pending.size() - 1; i >= 0; --i) {
+            if (m_pending[i].m_format == format) {
+                p_worker->m_requests.append(m_pending.takeAt(i));
+            }
+        }
+    }
+
+    if (p_failedToStart || p_worker->m_requests.isEmpty()) {
+        m_workers.removeAll(p_worker);
+        destroyWorker(p_worker);
+        dispatch(format);
+        return;
+    }
+
+    // Restart and resend pending requests.
+    QQueue<Request> reqs = p_worker->m_requests;
+    p_worker->m_requests.clear();
+    startWorker(p_worker);
+
+    for (const auto &req : reqs) {
+        writeRequest(p_worker, req);
+    }
+}
+
+void VPlantUMLServer::handleTimeout(Worker *p_worker)
+{
+    if (p_worker->m_requests.isEmpty()) {
+        qDebug() << "stop idle PlantUML server" << p_worker->m_format;
+        m_workers.removeAll(p_worker);
+        destroyWorker(p_worker);
+        return;
+    }
+
+    qWarning() << "PlantUML server timed out" << QString::fromLocal8Bit(p_worker->m_error);
+    handleWorkerFailure(p_worker, false);
+}
+
+void VPlantUMLServer::emitResult(const Request &p_req, const QByteArray &p_data)
+{
+    for (auto id : p_req.m_ids) {
+        emit resultReady(id, p_data);
+    }
+}
+
+void VPlantUMLServer::startTimer(Worker *p_worker)
+{
+    p_worker->m_timer->start(p_worker->m_requests.isEmpty() ? PLANTUML_IDLE_TIMEOUT
+                                                            : PLANTUML_REQUEST_TIMEOUT);
+}
+
+QByteArray VPlantUMLServer::prepareText(const QString &p_text)
+{
+    // PlantUML splits requests by the @end lines.
+    QRegularExpression startReg("^\\s*@start(\\w+)", QRegularExpression::MultilineOption);
+    QRegularExpressionMatch startMatch = startReg.match(p_text);
+    if (!startMatch.hasMatch()) {
+        return ("@startuml\n" + p_text + "\n@enduml\n").toUtf8();
+    }
+
+    QString type = startMatch.captured(1);
+    QRegularExpression endReg("^\\s*@end" + type + "\\b[^\\n]*",
+                              QRegularExpression::MultilineOption);
+    QRegularExpressionMatch endMatch = endReg.match(p_text, startMatch.capturedEnd());
+    if (!endMatch.hasMatch()) {
+        return (p_text.mid(startMatch.capturedStart()) + "\n@end" + type + "\n").toUtf8();
+    }
+
+    // Only the first diagram to keep the results in order.
+    return (p_text.mid(startMatch.capturedStart(),
+                       endMatch.capturedEnd() - startMatch.capturedStart()) + "\n").toUtf8();
+}
@@ -0,0 +1,129 @@
+#ifndef VPLANTUMLSERVER_H
+#define VPLANTUMLSERVER_H
+
+#include <QObject>
+#include <QByteArray>
+#include <QList>
+#include <QQueue>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+class QProcess;
+class QTimer;
+
+// Long-lived PlantUML processes in -pipe mode shared by all the helpers to
+// avoid starting a JVM for each diagram.
+// Requests of the same format are pipelined to the same processes and the
+// results come back in order, separated by a delimiter. Only a few requests
+// are written to a process at a time so that requests of higher priority
+// could go first and canceled requests could be dropped.
+class VPlantUMLServer : public QObject
+{
+    Q_OBJECT
+public:
+    static VPlantUMLServer *inst();
+
+    // Returns the id of the request. resultReady() will be emitted later.
+    // Requests of higher @p_priority are sent first.
+    quint64 render(const QString &p_format, const QString &p_text, int p_priority = 0);
+
+    // The result of @p_id will not be emitted.
+    void cancel(quint64 p_id);
+
+signals:
+    // @p_data will be empty if failed.
+    void resultReady(quint64 p_id, const QByteArray &p_data);
+
+private:
+    struct Request
+    {
+        // Ids waiting for this request. Identical requests are merged.
+        QList<quint64> m_ids;
+
+        QString m_format;
+
+        QByteArray m_text;
+
+        int m_priority;
+
+        // Number of times the process died while handling this request.
+        int m_retries;
+    };
+
+    struct Worker
+    {
+        QString m_format;
+
+        QProcess *m_process;
+
+        // Timer for the request timeout and the idle timeout.
+        QTimer *m_timer;
+
+        QByteArray m_output;
+
+        // Stderr since the last finished request.
+        QByteArray m_error;
+
+        // Requests written to the process, in order.
+        QQueue<Request> m_requests;
+    };
+
+    explicit VPlantUMLServer(QObject *p_parent = nullptr);
+
+    ~VPlantUMLServer();
+
+    void submit(quint64 p_id, const QString &p_format, const QString &p_text, int p_priority);
+
+    // Write pending requests of @p_format to the workers.
+    void dispatch(const QString &p_format);
+
+    // Restart the workers if the PlantUML command changed.
+    void updateCommand();
+
+    // Pick or create a worker for @p_format which could take one more request.
+    // Returns NULL if all are busy.
+    Worker *pickWorker(const QString &p_format);
+
+    Worker *createWorker(const QString &p_format);
+
+    void startWorker(Worker *p_worker);
+
+    // Requests in flight of @p_worker will fail.
+    void destroyWorker(Worker *p_worker);
+
+    // Kill the process of @p_worker and delete it once it exits.
+    void releaseProcess(Worker *p_worker);
+
+    void writeRequest(Worker *p_worker, const Request &p_req);
+
+    void handleOutput(Worker *p_worker);
+
+    // The process died or timed out.
+    void handleWorkerFailure(Worker *p_worker, bool p_failedToStart);
+
+    void handleTimeout(Worker *p_worker);
+
+    void startTimer(Worker *p_worker);
+
+    void emitResult(const Request &p_req, const QByteArray &p_data);
+
+    // Make sure @p_text is a single diagram ended with an @end line.
+    static QByteArray prepareText(const QString &p_text);
+
+    static VPlantUMLServer *s_inst;
+
+    quint64 m_nextId;
+
+    QVector<Worker *> m_workers;
+
+    // Requests not written to any process yet, in the order of submission.
+    QList<Request> m_pending;
+
+    // Command of the running workers.
+    QString m_program;
+
+    QStringList m_args;
+};
+
+#endif // VPLANTUMLSERVER_H
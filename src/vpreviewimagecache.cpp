@@ -0,0 +1,160 @@
+#include "vpreviewimagecache.h"
+
+#include <QDateTime>
+#include <QFileInfo>
+
+QHash<QString, VPreviewImageCache::Entry> VPreviewImageCache::s_entries;
+
+std::list<QString> VPreviewImageCache::s_lru;
+
+QHash<QString, int> VPreviewImageCache::s_refs;
+
+QHash<QString, int> VPreviewImageCache::s_pins;
+
+// 256MB by default.
+qint64 VPreviewImageCache::s_capacity = 256 * 1024 * 1024;
+
+qint64 VPreviewImageCache::s_size = 0;
+
+int VPreviewImageCache::s_hits = 0;
+
+int VPreviewImageCache::s_misses = 0;
+
+int VPreviewImageCache::s_evictions = 0;
+
+QString VPreviewImageCache::key(const QString &p_path,
+                                int p_width,
+                                int p_height,
+                                qreal p_scaleFactor,
+                                int p_maxWidth)
+{
+    QFileInfo info(p_path);
+    return QString("%1|%2|%3x%4|%5|%6").arg(info.absoluteFilePath())
+                                       .arg(info.lastModified().toMSecsSinceEpoch())
+                                       .arg(p_width)
+                                       .arg(p_height)
+                                       .arg(p_scaleFactor)
+                                       .arg(p_maxWidth);
+}
+
+QPixmap VPreviewImageCache::find(const QString &p_key)
+{
+    auto it = s_entries.find(p_key);
+    if (it == s_entries.end()) {
+        ++s_misses;
+        return QPixmap();
+    }
+
+    ++s_hits;
+    s_lru.splice(s_lru.begin(), s_lru, it->m_lruIt);
+    return it->m_image;
+}
+
+qint64 VPreviewImageCache::imageCost(const QPixmap &p_image)
+{
+    return qint64(p_image.width()) * p_image.height() * qMax(p_image.depth() / 8, 1);
+}
+
+void VPreviewImageCache::insert(const QString &p_key, const QPixmap &p_image)
+{
+    auto it = s_entries.find(p_key);
+    if (it != s_entries.end()) {
+        s_size -= it->m_cost;
+        s_lru.erase(it->m_lruIt);
+        s_entries.erase(it);
+    }
+
+    if (p_image.isNull()) {
+        return;
+    }
+
+    s_lru.push_front(p_key);
+
+    Entry entry;
+    entry.m_image = p_image;
+    entry.m_cost = imageCost(p_image);
+    entry.m_lruIt = s_lru.begin();
+    s_entries.insert(p_key, entry);
+    s_size += entry.m_cost;
+
+    evict(p_key);
+}
+
+void VPreviewImageCache::ref(const QString &p_key)
+{
+    ++s_refs[p_key];
+}
+
+void VPreviewImageCache::unref(const QString &p_key)
+{
+    auto it = s_refs.find(p_key);
+    if (it == s_refs.end()) {
+        return;
+    }
+
+    if (--it.value() <= 0) {
+        s_refs.erase(it);
+        evict();
+    }
+}
+
+void VPreviewImageCache::pin(const QString &p_key)
+{
+    ++s_pins[p_key];
+}
+
+void VPreviewImageCache::unpin(const QString &p_key)
+{
+    auto it = s_pins.find(p_key);
+    if (it == s_pins.end()) {
+        return;
+    }
+
+    if (--it.value() <= 0) {
+        s_pins.erase(it);
+        evict();
+    }
+}
+
+void VPreviewImageCache::clear()
+{
+    s_entries.clear();
+    s_lru.clear();
+    s_size = 0;
+}
+
+void VPreviewImageCache::setCapacity(qint64 p_bytes)
+{
+    s_capacity = qMax(qint64(0), p_bytes);
+    evict();
+}
+
+void VPreviewImageCache::evict(const QString &p_key)
+{
+    if (s_size <= s_capacity) {
+        return;
+    }
+
+    // Evict the unreferenced images first, then the referenced ones not pinned.
+    for (int pass = 0; pass < 2 && s_size > s_capacity; ++pass) {
+        auto it = s_lru.end();
+        while (it != s_lru.begin() && s_size > s_capacity) {
+            --it;
+            if (*it == p_key
+                || s_refs.contains(*it) != (pass == 1)
+                || s_pins.contains(*it)) {
+                continue;
+            }
+
+            auto entryIt = s_entries.find(*it);
+            Q_ASSERT(entryIt != s_entries.end());
+
+            s_size -= entryIt->m_cost;
+            s_entries.erase(entryIt);
+
+            // Points to the next one, which has been checked.
+            it = s_lru.erase(it);
+            ++s_evictions;
+        }
+    }
+}
@@ -0,0 +1,112 @@
+#ifndef VPREVIEWIMAGECACHE_H
+#define VPREVIEWIMAGECACHE_H
+
+#include <QHash>
+#include <QPixmap>
+#include <QString>
+
+#include <list>
+
+// Process-wide LRU cache of preview images decoded from local files, shared
+// by all the editors, with a memory budget in bytes.
+// Editors reference the images they preview. Unreferenced images are evicted
+// first. Referenced images could be evicted too when the budget is exceeded,
+// and the editors should load them again on demand. Editors pin the images of
+// the blocks on screen, which are never evicted, even if they exceed the
+// budget; otherwise loading one of them would evict another one on screen
+// and the repaint would load that one again, forever.
+// Should be accessed in the main thread only.
+class VPreviewImageCache
+{
+public:
+    // Key of image file @p_path scaled to preview with the size in the link
+    // (@p_width and @p_height, -1 for not specified) and scale factor @p_scaleFactor,
+    // no wider than @p_maxWidth (0 for unlimited).
+    // The modification time of the file is part of the key.
+    static QString key(const QString &p_path,
+                       int p_width,
+                       int p_height,
+                       qreal p_scaleFactor,
+                       int p_maxWidth);
+
+    // Returns a null pixmap if not found.
+    static QPixmap find(const QString &p_key);
+
+    static void insert(const QString &p_key, const QPixmap &p_image);
+
+    static void ref(const QString &p_key);
+
+    static void unref(const QString &p_key);
+
+    // Pinned images are on screen and will not be evicted.
+    static void pin(const QString &p_key);
+
+    static void unpin(const QString &p_key);
+
+    // Drop all the images.
+    static void clear();
+
+    // Set the memory budget in bytes.
+    static void setCapacity(qint64 p_bytes);
+
+    // Bytes of all the images in the cache.
+    static qint64 size()
+    {
+        return s_size;
+    }
+
+    static int hits()
+    {
+        return s_hits;
+    }
+
+    static int misses()
+    {
+        return s_misses;
+    }
+
+    static int evictions()
+    {
+        return s_evictions;
+    }
+
+private:
+    struct Entry
+    {
+        QPixmap m_image;
+
+        qint64 m_cost;
+
+        // Position in s_lru.
+        std::list<QString>::iterator m_lruIt;
+    };
+
+    static qint64 imageCost(const QPixmap &p_image);
+
+    // Evict images until the budget is met, sparing @p_key and the pinned
+    // images.
+    static void evict(const QString &p_key = QString());
+
+    static QHash<QString, Entry> s_entries;
+
+    // Keys from the most recently used to the least.
+    static std::list<QString> s_lru;
+
+    // Reference counts of keys, including the ones not in the cache.
+    static QHash<QString, int> s_refs;
+
+    // Pin counts of keys, including the ones not in the cache.
+    static QHash<QString, int> s_pins;
+
+    static qint64 s_capacity;
+
+    static qint64 s_size;
+
+    static int s_hits;
+
+    static int s_misses;
+
+    static int s_evictions;
+};
+
+#endif // VPREVIEWIMAGECACHE_H
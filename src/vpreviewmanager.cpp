@@ -5,14 +5,205 @@
 #include <QUrl>
 #include <QVector>
 #include <QTextLayout>
+#include <QDebug>
+#include <QFile>
+#include <QImageReader>
+#include <QRunnable>
+#include <QThread>
+#include <QGuiApplication>
+#include <QScreen>
+#include <QtMath>
 
 #include "vconfigmanager.h"
 #include "utils/vutils.h"
-#include "vdownloader.h"
+#include "vdownloadscheduler.h"
 #include "pegmarkdownhighlighter.h"
+#include "vpreviewimagecache.h"
+#include "vthumbnailcache.h"
 
 extern VConfigManager *g_config;
 
+extern VDownloadScheduler *g_downloadScheduler;
+
+// Size of an image of @p_size to preview with the size specified in the link,
+// no wider than @p_maxWidth if it is not 0.
+static QSize scaledPreviewSize(const QSize &p_size,
+                               int p_width,
+                               int p_height,
+                               qreal p_scaleFactor,
+                               int p_maxWidth)
+{
+    if (p_size.isEmpty()) {
+        return p_size;
+    }
+
+    QSize size;
+    if (p_width > 0) {
+        int width = p_width * p_scaleFactor;
+        if (p_height > 0) {
+            size = QSize(width, p_height * p_scaleFactor);
+        } else {
+            size = QSize(width, qMax(qRound(qreal(p_size.height()) * width / p_size.width()), 1));
+        }
+    } else if (p_height > 0) {
+        int height = p_height * p_scaleFactor;
+        size = QSize(qMax(qRound(qreal(p_size.width()) * height / p_size.height()), 1), height);
+    } else {
+        if (p_scaleFactor < 1.1) {
+            size = p_size;
+        } else {
+            int width = p_size.width() * p_scaleFactor;
+            size = QSize(width, qMax(qRound(qreal(p_size.height()) * width / p_size.width()), 1));
+        }
+    }
+
+    if (p_maxWidth > 0 && size.width() > p_maxWidth) {
+        size = QSize(p_maxWidth, qMax(qRound(qreal(size.height()) * p_maxWidth / size.width()), 1));
+    }
+
+    return size;
+}
+
+// Decode and scale an image to preview in the image pool.
+class ImageLoadTask : public QRunnable
+{
+public:
+    // @p_thumbnailKey: key in VThumbnailCache. Empty to bypass it.
+    ImageLoadTask(QObject *p_receiver,
+                  const QString &p_name,
+                  const QString &p_path,
+                  const QByteArray &p_data,
+                  int p_width,
+                  int p_height,
+                  qreal p_scaleFactor,
+                  int p_maxWidth,
+                  const QString &p_thumbnailKey,
+                  TS p_timeStamp)
+        : m_receiver(p_receiver),
+          m_name(p_name),
+          m_path(p_path),
+          m_data(p_data),
+          m_width(p_width),
+          m_height(p_height),
+          m_scaleFactor(p_scaleFactor),
+          m_maxWidth(p_maxWidth),
+          m_thumbnailKey(p_thumbnailKey),
+          m_timeStamp(p_timeStamp)
+    {
+    }
+
+    void run() Q_DECL_OVERRIDE
+    {
+        QImage image = VPreviewManager::loadPreviewImage(m_path,
+                                                         m_data,
+                                                         m_width,
+                                                         m_height,
+                                                         m_scaleFactor,
+                                                         m_maxWidth,
+                                                         m_thumbnailKey);
+
+        // The receiver waits for all the tasks before it is destroyed.
+        QMetaObject::invokeMethod(m_receiver,
+                                  "imageLoaded",
+                                  Qt::QueuedConnection,
+                                  Q_ARG(QString, m_name),
+                                  Q_ARG(QImage, image),
+                                  Q_ARG(qlonglong, m_timeStamp));
+    }
+
+private:
+    QObject *m_receiver;
+
+    QString m_name;
+
+    QString m_path;
+
+    QByteArray m_data;
+
+    int m_width;
+
+    int m_height;
+
+    qreal m_scaleFactor;
+
+    int m_maxWidth;
+
+    QString m_thumbnailKey;
+
+    TS m_timeStamp;
+};
+
+QImage VPreviewManager::loadPreviewImage(const QString &p_path,
+                                         const QByteArray &p_data,
+                                         int p_width,
+                                         int p_height,
+                                         qreal p_scaleFactor,
+                                         int p_maxWidth,
+                                         const QString &p_thumbnailKey,
+                                         bool *p_decoded)
+{
+    if (p_decoded) {
+        *p_decoded = false;
+    }
+
+    QImage image;
+    if (!p_thumbnailKey.isEmpty()) {
+        image = VThumbnailCache::load(p_thumbnailKey);
+        if (!image.isNull()) {
+            return image;
+        }
+    }
+
+    // Decode the original image and scale it.
+    if (p_path.isEmpty()) {
+        image.loadFromData(p_data);
+    } else {
+        QFile file(p_path);
+        if (file.open(QIODevice::ReadOnly)) {
+            image.loadFromData(file.readAll());
+        } else {
+            qWarning() << "fail to open image file" << p_path;
+        }
+    }
+
+    if (p_decoded) {
+        *p_decoded = true;
+    }
+
+    if (image.isNull()) {
+        return image;
+    }
+
+    QSize size = scaledPreviewSize(image.size(), p_width, p_height, p_scaleFactor, p_maxWidth);
+    if (size != image.size()) {
+        // Only a scaled down image saves decoding next time.
+        bool smaller = qint64(size.width()) * size.height()
+                       < qint64(image.width()) * image.height();
+        image = image.scaled(size, Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
+        if (smaller && !p_thumbnailKey.isEmpty()) {
+            VThumbnailCache::save(p_thumbnailKey, image);
+        }
+    }
+
+    return image;
+}
+
+int VPreviewManager::previewMaxWidth()
+{
+    if (!g_config->getEnablePreviewImageConstraint()) {
+        return 0;
+    }
+
+    // Images are shrunk to the width of the editor, which could not be wider
+    // than the screens. Keep the pixels for high DPI screens.
+    int width = 0;
+    for (auto screen : QGuiApplication::screens()) {
+        width = qMax(width, qCeil(screen->availableGeometry().width() * screen->devicePixelRatio()));
+    }
+
+    return width;
+}
+
 VPreviewManager::VPreviewManager(VMdEditor *p_editor, PegMarkdownHighlighter *p_highlighter)
     : QObject(p_editor),
       m_editor(p_editor),
@@ -24,9 +215,26 @@ VPreviewManager::VPreviewManager(VMdEditor *p_editor, PegMarkdownHighlighter *p_
         m_timeStamps[i] = 0;
     }
 
-    m_downloader = new VDownloader(this);
-    connect(m_downloader, &VDownloader::downloadFinished,
+    connect(g_downloadScheduler, &VDownloadScheduler::downloadFinished,
             this, &VPreviewManager::imageDownloaded);
+
+    // Leave some cores to the GUI thread and the highlighter.
+    m_imagePool.setMaxThreadCount(qMax(1, QThread::idealThreadCount() / 2));
+
+    VPreviewImageCache::setCapacity(qint64(g_config->getPreviewImageCacheSize()) * 1024 * 1024);
+
+    VThumbnailCache::init(QDir(g_config->getCacheConfigFolder()).filePath("thumbnails"),
+                          qint64(g_config->getPreviewThumbnailCacheSize()) * 1024 * 1024);
+
+    m_editor->setImageMissingHandler([this](const QString &p_name) {
+                reloadImage(p_name);
+            });
+}
+
+VPreviewManager::~VPreviewManager()
+{
+    m_imagePool.clear();
+    m_imagePool.waitForDone();
 }
 
 void VPreviewManager::updateImageLinks(const QVector<VElementRegion> &p_imageRegions)
@@ -39,30 +247,6 @@ void VPreviewManager::updateImageLinks(const QVector<VElementRegion> &p_imageReg
     previewImages(ts, p_imageRegions);
 }
 
-static QPixmap scalePreviewImage(const QPixmap &p_img, int p_width, int p_height)
-{
-    const Qt::TransformationMode tMode = Qt::SmoothTransformation;
-    qreal sf = VUtils::calculateScaleFactor();
-    if (p_width > 0) {
-        if (p_height > 0) {
-            return p_img.scaled(p_width * sf,
-                                p_height * sf,
-                                Qt::IgnoreAspectRatio,
-                                tMode);
-        } else {
-            return p_img.scaledToWidth(p_width * sf, tMode);
-        }
-    } else if (p_height > 0) {
-        return p_img.scaledToHeight(p_height * sf, tMode);
-    } else {
-        if (sf < 1.1) {
-            return p_img;
-        } else {
-            return p_img.scaledToWidth(p_img.width() * sf, tMode);
-        }
-    }
-}
-
 void VPreviewManager::imageDownloaded(const QByteArray &p_data, const QString &p_url)
 {
     if (!m_previewEnabled) {
@@ -77,17 +261,166 @@ void VPreviewManager::imageDownloaded(const QByteArray &p_data, const QString &p
     QSharedPointer<UrlImageInfo> info = it.value();
     m_urlMap.erase(it);
 
-    if (m_editor->containsImage(info->m_name) || info->m_name.isEmpty()) {
+    if (m_editor->containsImage(info->m_name)
+        || info->m_name.isEmpty()
+        || m_pendingImages.contains(info->m_name)) {
         return;
     }
 
-    QPixmap image;
-    image.loadFromData(p_data);
-    if (!image.isNull()) {
-        m_editor->addImage(info->m_name,
-                           scalePreviewImage(image, info->m_width, info->m_height));
+    loadImage(info->m_name,
+              QString(),
+              p_data,
+              info->m_width,
+              info->m_height,
+              QSize(),
+              QString());
+}
+
+void VPreviewManager::loadImage(const QString &p_name,
+                                const QString &p_path,
+                                const QByteArray &p_data,
+                                int p_width,
+                                int p_height,
+                                const QSize &p_placeholderSize,
+                                const QString &p_key)
+{
+    PendingImage pending;
+    pending.m_timeStamp = timeStamp(PreviewSource::ImageLink);
+    pending.m_placeholderSize = p_placeholderSize;
+    pending.m_key = p_key;
+    m_pendingImages.insert(p_name, pending);
+
+    qreal scaleFactor = VUtils::calculateScaleFactor();
+    int maxWidth = previewMaxWidth();
+
+    // Cache the scaled local images on disk.
+    QString thumbnailKey;
+    if (!p_path.isEmpty()) {
+        thumbnailKey = VThumbnailCache::key(p_path, p_width, p_height, scaleFactor, maxWidth);
+    }
+
+    m_imagePool.start(new ImageLoadTask(this,
+                                        p_name,
+                                        p_path,
+                                        p_data,
+                                        p_width,
+                                        p_height,
+                                        scaleFactor,
+                                        maxWidth,
+                                        thumbnailKey,
+                                        pending.m_timeStamp));
+}
+
+void VPreviewManager::imageLoaded(const QString &p_name,
+                                  const QImage &p_image,
+                                  qlonglong p_timeStamp)
+{
+    auto it = m_pendingImages.find(p_name);
+    if (it == m_pendingImages.end() || it->m_timeStamp != p_timeStamp) {
+        // Obsolete request.
+        return;
+    }
+
+    bool hasPlaceholder = it->m_placeholderSize.isValid();
+    QString key = it->m_key;
+    m_pendingImages.erase(it);
+
+    if (!m_previewEnabled) {
+        return;
+    }
+
+    if (p_image.isNull()) {
+        m_failedImages.insert(p_name);
+        if (hasPlaceholder && m_editor->containsImage(p_name)) {
+            // Drop the previews of the placeholder.
+            m_editor->removeImage(p_name);
+            emit requestUpdateImageLinks();
+        }
+
+        return;
+    }
+
+    if (!hasPlaceholder) {
+        // No preview has been added for it yet.
+        addImageToEditor(p_name, key, QPixmap::fromImage(p_image));
         emit requestUpdateImageLinks();
+        return;
+    }
+
+    if (!m_editor->containsImage(p_name)) {
+        // The placeholder has been cleared as obsolete.
+        return;
+    }
+
+    addImageToEditor(p_name, key, QPixmap::fromImage(p_image));
+
+    // Relayout only the blocks previewing this image.
+    OrderedIntSet affectedBlocks;
+    const QSet<int> &blocks = m_highlighter->getPossiblePreviewBlocks();
+    for (auto i : blocks) {
+        QTextBlock block = m_document->findBlockByNumber(i);
+        if (!block.isValid()) {
+            continue;
+        }
+
+        VTextBlockData *blockData = static_cast<VTextBlockData *>(block.userData());
+        if (!blockData) {
+            continue;
+        }
+
+        for (auto info : blockData->getPreviews()) {
+            if (info->m_imageInfo.m_imageName == p_name) {
+                info->m_imageInfo.m_imageSize = p_image.size();
+                affectedBlocks.insert(i, QMapDummyValue());
+            }
+        }
     }
+
+    relayout(affectedBlocks);
+}
+
+void VPreviewManager::addImageToEditor(const QString &p_name,
+                                       const QString &p_key,
+                                       const QPixmap &p_image)
+{
+    if (p_key.isEmpty()) {
+        m_editor->addImage(p_name, p_image);
+    } else {
+        m_editor->addSharedImage(p_name, p_key, p_image);
+    }
+}
+
+void VPreviewManager::reloadImage(const QString &p_name)
+{
+    if (!m_previewEnabled || m_pendingImages.contains(p_name)) {
+        return;
+    }
+
+    auto it = m_localImages.find(p_name);
+    if (it == m_localImages.end()) {
+        return;
+    }
+
+    // Keep its space while loading.
+    const LocalImageInfo &info = it.value();
+    loadImage(p_name,
+              info.m_path,
+              QByteArray(),
+              info.m_width,
+              info.m_height,
+              m_editor->imageSize(p_name),
+              VPreviewImageCache::key(info.m_path,
+                                      info.m_width,
+                                      info.m_height,
+                                      VUtils::calculateScaleFactor(),
+                                      previewMaxWidth()));
+}
+
+void VPreviewManager::clearPendingImages()
+{
+    m_imagePool.clear();
+    m_pendingImages.clear();
+    m_failedImages.clear();
 }
 
 void VPreviewManager::setPreviewEnabled(bool p_enabled)
@@ -107,6 +440,8 @@ void VPreviewManager::setPreviewEnabled(bool p_enabled)
 
 void VPreviewManager::clearPreview()
 {
+    clearPendingImages();
+
     OrderedIntSet affectedBlocks;
     for (int i = 0; i < (int)PreviewSource::MaxNumberOfSources; ++i) {
         TS ts = ++timeStamp(static_cast<PreviewSource>(i));
@@ -245,18 +580,65 @@ QString VPreviewManager::imageResourceName(const ImageLinkInfo &p_link)
     }
 
     // Add it to the resource.
-    QPixmap image;
     QString imgPath = p_link.m_linkUrl;
     if (QFileInfo::exists(imgPath)) {
-        // Local file.
-        image = VUtils::pixmapFromFile(imgPath);
-        if (image.isNull()) {
+        // Local file. Decode it in the image pool and reserve its space with a
+        // placeholder if its size could be read from the header.
+        if (m_failedImages.contains(name)) {
             return QString();
         }
+
+        LocalImageInfo localInfo;
+        localInfo.m_path = imgPath;
+        localInfo.m_width = p_link.m_width;
+        localInfo.m_height = p_link.m_height;
+        m_localImages.insert(name, localInfo);
+
+        // It may have been decoded by other editors.
+        int maxWidth = previewMaxWidth();
+        QString key = VPreviewImageCache::key(imgPath,
+                                              p_link.m_width,
+                                              p_link.m_height,
+                                              VUtils::calculateScaleFactor(),
+                                              maxWidth);
+        QPixmap cachedImage = VPreviewImageCache::find(key);
+        if (!cachedImage.isNull()) {
+            m_editor->addSharedImage(name, key, cachedImage);
+            return name;
+        }
+
+        auto it = m_pendingImages.find(name);
+        if (it != m_pendingImages.end()) {
+            if (!it->m_placeholderSize.isValid()) {
+                return QString();
+            }
+
+            m_editor->addImagePlaceholder(name, it->m_placeholderSize);
+            return name;
+        }
+
+        QSize size = QImageReader(imgPath).size();
+        if (size.isEmpty()) {
+            size = QSize();
+        } else {
+            size = scaledPreviewSize(size,
+                                     p_link.m_width,
+                                     p_link.m_height,
+                                     VUtils::calculateScaleFactor(),
+                                     maxWidth);
+        }
+
+        loadImage(name, imgPath, QByteArray(), p_link.m_width, p_link.m_height, size, key);
+        if (!size.isValid()) {
+            return QString();
+        }
+
+        m_editor->addImagePlaceholder(name, size);
+        return name;
     } else {
         // URL. Try to download it.
         // qrc:// files will touch this path.
-        m_downloader->download(imgPath);
+        g_downloadScheduler->download(imgPath);
 
         QSharedPointer<UrlImageInfo> info(new UrlImageInfo(name,
                                                            p_link.m_width,
@@ -265,10 +647,6 @@ QString VPreviewManager::imageResourceName(const ImageLinkInfo &p_link)
 
         return QString();
     }
-
-    m_editor->addImage(name,
-                       scalePreviewImage(image, p_link.m_width, p_link.m_height));
-    return name;
 }
 
 QString VPreviewManager::imageResourceNameForSource(PreviewSource p_source,
@@ -423,6 +801,7 @@ void VPreviewManager::clearObsoleteImages(long long p_timeStamp, PreviewSource p
     for (auto it = cache.begin(); it != cache.end();) {
         if (it.value() < p_timeStamp) {
             m_editor->removeImage(it.key());
+            m_localImages.remove(it.key());
             it = cache.erase(it);
         } else {
             ++it;
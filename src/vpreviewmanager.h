@@ -5,15 +5,16 @@
 #include <QString>
 #include <QTextBlock>
 #include <QHash>
+#include <QSet>
 #include <QVector>
 #include <QSharedPointer>
+#include <QThreadPool>
+#include <QImage>
 
 #include "markdownhighlighterdata.h"
 #include "vmdeditor.h"
 #include "vtextblockdata.h"
 
-class VDownloader;
-
 typedef long long TS;
 
 // Info about image to preview.
@@ -61,6 +62,8 @@ class VPreviewManager : public QObject
 public:
     VPreviewManager(VMdEditor *p_editor, PegMarkdownHighlighter *p_highlighter);
 
+    ~VPreviewManager();
+
     void setPreviewEnabled(bool p_enabled);
 
     // Clear all the preview.
@@ -78,6 +81,23 @@ public:
     // Calculate the block margin (prefix spaces) in pixels.
     static int calculateBlockMargin(const QTextBlock &p_block, int p_tabStopWidth);
 
+    // Load image file @p_path or image data @p_data to preview, scaled to the
+    // size in the link and no wider than @p_maxWidth (0 for unlimited).
+    // Could be called in any thread.
+    // @p_thumbnailKey: key in VThumbnailCache. Empty to bypass it.
+    // @p_decoded: set to whether the original image is decoded.
+    static QImage loadPreviewImage(const QString &p_path,
+                                   const QByteArray &p_data,
+                                   int p_width,
+                                   int p_height,
+                                   qreal p_scaleFactor,
+                                   int p_maxWidth,
+                                   const QString &p_thumbnailKey,
+                                   bool *p_decoded = NULL);
+
+    // Max width in pixels of the images to preview. 0 for unlimited.
+    static int previewMaxWidth();
+
 public slots:
     // Image links were updated from the highlighter.
     void updateImageLinks(const QVector<VElementRegion> &p_imageRegions);
@@ -96,6 +116,10 @@ private slots:
     // Non-local image downloaded for preview.
     void imageDownloaded(const QByteArray &p_data, const QString &p_url);
 
+    // Image @p_name decoded and scaled by the image pool.
+    // @p_timeStamp: timestamp of the load request.
+    void imageLoaded(const QString &p_name, const QImage &p_image, qlonglong p_timeStamp);
+
 private:
     struct ImageLinkInfo
     {
@@ -172,6 +196,27 @@ private:
         int m_height;
     };
 
+    // Image being decoded in the image pool.
+    struct PendingImage
+    {
+        TS m_timeStamp;
+
+        // Size of the placeholder in the resources. Invalid if there is no placeholder.
+        QSize m_placeholderSize;
+
+        // Key in VPreviewImageCache. Empty if it is not a local image.
+        QString m_key;
+    };
+
+    // Local image file previewed, to load it again once it is evicted from
+    // the cache.
+    struct LocalImageInfo
+    {
+        QString m_path;
+        int m_width;
+        int m_height;
+    };
+
     struct UrlImageInfo {
         UrlImageInfo(const QString &p_name, int p_width, int p_height)
             : m_name(p_name),
@@ -212,6 +257,25 @@ private:
     // Returns empty if fail to add the image to the resource manager.
     QString imageResourceName(const ImageLinkInfo &p_link);
 
+    // Decode and scale the image from file @p_path or @p_data in the image pool.
+    // @p_key: key in VPreviewImageCache for local images.
+    void loadImage(const QString &p_name,
+                   const QString &p_path,
+                   const QByteArray &p_data,
+                   int p_width,
+                   int p_height,
+                   const QSize &p_placeholderSize,
+                   const QString &p_key);
+
+    // Load local image @p_name again since it is evicted from the cache.
+    void reloadImage(const QString &p_name);
+
+    // Add a loaded image to the editor.
+    void addImageToEditor(const QString &p_name, const QString &p_key, const QPixmap &p_image);
+
+    // Drop all the pending image loads and forget the failed ones.
+    void clearPendingImages();
+
     QString imageResourceNameForSource(PreviewSource p_source, const QSharedPointer<VImageToPreview> &p_image);
 
     QHash<QString, long long> &imageCache(PreviewSource p_source);
@@ -234,8 +298,6 @@ private:
 
     PegMarkdownHighlighter *m_highlighter;
 
-    VDownloader *m_downloader;
-
     // Whether preview is enabled.
     bool m_previewEnabled;
 
@@ -248,6 +310,18 @@ private:
 
     // Used to discard obsolete images. One per each preview source.
     QHash<QString, long long> m_imageCaches[(int)PreviewSource::MaxNumberOfSources];
+
+    // Decode and scale images off the GUI thread.
+    QThreadPool m_imagePool;
+
+    // Images being loaded in the image pool by name.
+    QHash<QString, PendingImage> m_pendingImages;
+
+    // Local images failed to load.
+    QSet<QString> m_failedImages;
+
+    // Local images previewed by name.
+    QHash<QString, LocalImageInfo> m_localImages;
 };
 
 inline QHash<QString, long long> &VPreviewManager::imageCache(PreviewSource p_source)
@@ -0,0 +1,111 @@
+#include "vrendercache.h"
+
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+
+#include "utils/vutils.h"
+
+QString VRenderCache::s_folder;
+
+qint64 VRenderCache::s_capacity = 0;
+
+qint64 VRenderCache::s_size = -1;
+
+void VRenderCache::init(const QString &p_folder, qint64 p_capacity)
+{
+    if (s_folder != p_folder) {
+        s_folder = p_folder;
+        s_size = -1;
+    }
+
+    s_capacity = qMax(qint64(0), p_capacity);
+}
+
+QString VRenderCache::key(const QString &p_lang,
+                          const QString &p_text,
+                          const QString &p_format,
+                          const QString &p_renderer,
+                          const QString &p_theme)
+{
+    QCryptographicHash hash(QCryptographicHash::Sha256);
+    const QString fields[] = { p_lang, p_format, p_renderer, p_theme, p_text };
+    for (const auto &field : fields) {
+        QByteArray ba = field.toUtf8();
+        // Prefix the length to keep the fields apart.
+        hash.addData(QByteArray::number(ba.size()) + ':');
+        hash.addData(ba);
+    }
+
+    return QString::fromLatin1(hash.result().toHex());
+}
+
+QString VRenderCache::filePath(const QString &p_key)
+{
+    return QDir(s_folder).filePath(p_key + ".cache");
+}
+
+QByteArray VRenderCache::load(const QString &p_key, QString &p_format)
+{
+    if (s_capacity == 0 || s_folder.isEmpty()) {
+        return QByteArray();
+    }
+
+    QFile file(filePath(p_key));
+    if (!file.open(QIODevice::ReadOnly)) {
+        return QByteArray();
+    }
+
+    // The first line is the format.
+    p_format = QString::fromLatin1(file.readLine()).trimmed();
+    QByteArray data = file.readAll();
+
+#if QT_VERSION >= QT_VERSION_CHECK(5, 10, 0)
+    // Mark it as recently used.
+    file.setFileTime(QDateTime::currentDateTime(), QFileDevice::FileModificationTime);
+#endif
+
+    return data;
+}
+
+void VRenderCache::save(const QString &p_key, const QString &p_format, const QByteArray &p_data)
+{
+    if (s_capacity == 0 || s_folder.isEmpty() || p_data.isEmpty()) {
+        return;
+    }
+
+    if (!QDir().mkpath(s_folder)) {
+        return;
+    }
+
+    QString path = filePath(p_key);
+    QByteArray header = p_format.toLatin1() + '\n';
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly)
+        || file.write(header) != header.size()
+        || file.write(p_data) != p_data.size()
+        || !file.commit()) {
+        qWarning() << "fail to save render cache" << path;
+        return;
+    }
+
+    if (s_size >= 0) {
+        s_size += header.size() + p_data.size();
+    }
+
+    evict();
+}
+
+void VRenderCache::evict()
+{
+    if (s_size >= 0 && s_size <= s_capacity) {
+        return;
+    }
+
+    // Files are touched once loaded, so the oldest is the least recently used.
+    s_size = VUtils::evictFilesByTime(s_folder, "*.cache", s_capacity);
+}
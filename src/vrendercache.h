@@ -0,0 +1,48 @@
+#ifndef VRENDERCACHE_H
+#define VRENDERCACHE_H
+
+#include <QByteArray>
+#include <QString>
+
+// Disk cache of rendered diagrams and formulas, so that reopening notes does
+// not run PlantUML, Graphviz or MathJax again for unchanged blocks.
+// Entries are addressed by the SHA-256 of everything affecting the output and
+// evicted from the least recently used one once the budget is exceeded.
+// Should be used in the GUI thread.
+class VRenderCache
+{
+public:
+    // Set the folder to store the files and the budget in bytes.
+    // 0 to disable the cache.
+    static void init(const QString &p_folder, qint64 p_capacity);
+
+    // @p_lang: language of the source, such as puml;
+    // @p_format: requested output format, could be empty if decided by the renderer;
+    // @p_renderer: version or command line of the renderer;
+    // @p_theme: theme or background affecting the output.
+    static QString key(const QString &p_lang,
+                       const QString &p_text,
+                       const QString &p_format,
+                       const QString &p_renderer,
+                       const QString &p_theme = QString());
+
+    // Returns empty data if not found. @p_format will be set to the format of data.
+    static QByteArray load(const QString &p_key, QString &p_format);
+
+    static void save(const QString &p_key, const QString &p_format, const QByteArray &p_data);
+
+private:
+    static QString filePath(const QString &p_key);
+
+    // Remove the least recently used files until the budget is met.
+    static void evict();
+
+    static QString s_folder;
+
+    static qint64 s_capacity;
+
+    // Bytes of all the files. -1 if not counted yet.
+    static qint64 s_size;
+};
+
+#endif // VRENDERCACHE_H
@@ -0,0 +1,222 @@
+#include "vrenderscheduler.h"
+
+#include <QCoreApplication>
+#include <QDebug>
+#include <QThread>
+#include <QTimer>
+
+VRenderScheduler *VRenderScheduler::s_inst = NULL;
+
+VRenderScheduler *VRenderScheduler::inst()
+{
+    if (!s_inst) {
+        s_inst = new VRenderScheduler(QCoreApplication::instance());
+    }
+
+    return s_inst;
+}
+
+VRenderScheduler::VRenderScheduler(QObject *p_parent)
+    : QObject(p_parent),
+      m_nextId(0),
+      m_nextSeq(0)
+{
+    // Leave one core to the GUI thread.
+    m_maxJobsPerTool = qMax(1, QThread::idealThreadCount() - 1);
+}
+
+VRenderScheduler::~VRenderScheduler()
+{
+    // Processes are children of this object.
+    for (auto job : m_jobs) {
+        if (job->m_process) {
+            job->m_process->disconnect(this);
+        }
+
+        delete job;
+    }
+
+    m_jobs.clear();
+    m_pending.clear();
+    m_requests.clear();
+
+    s_inst = NULL;
+}
+
+QString VRenderScheduler::jobKey(const Job *p_job)
+{
+    return p_job->m_tool + '\n'
+           + p_job->m_program + '\n'
+           + p_job->m_args.join('\n') + '\n'
+           + QString::fromUtf8(p_job->m_input);
+}
+
+quint64 VRenderScheduler::render(const QString &p_tool,
+                                 const QString &p_program,
+                                 const QStringList &p_args,
+                                 const QByteArray &p_input,
+                                 int p_priority)
+{
+    quint64 id = ++m_nextId;
+
+    Job *job = new Job();
+    job->m_tool = p_tool;
+    job->m_program = p_program;
+    job->m_args = p_args;
+    job->m_input = p_input;
+    job->m_priority = p_priority;
+    job->m_seq = ++m_nextSeq;
+    job->m_process = NULL;
+
+    QString key = jobKey(job);
+    auto it = m_jobs.find(key);
+    if (it != m_jobs.end()) {
+        // Wait for the identical one.
+        delete job;
+        job = it.value();
+        job->m_priority = qMax(job->m_priority, p_priority);
+    } else {
+        m_jobs.insert(key, job);
+        m_pending.append(job);
+    }
+
+    job->m_ids.append(id);
+    m_requests.insert(id, job);
+
+    startJobs(p_tool);
+    return id;
+}
+
+void VRenderScheduler::cancel(quint64 p_id)
+{
+    Job *job = m_requests.take(p_id);
+    if (!job) {
+        return;
+    }
+
+    job->m_ids.removeAll(p_id);
+    if (!job->m_ids.isEmpty()) {
+        return;
+    }
+
+    m_jobs.remove(jobKey(job));
+
+    QString tool = job->m_tool;
+    if (job->m_process) {
+        qDebug() << "kill canceled render job" << tool;
+        job->m_process->disconnect(this);
+        job->m_process->kill();
+        job->m_process->deleteLater();
+        --m_running[tool];
+    } else {
+        m_pending.removeOne(job);
+    }
+
+    delete job;
+
+    startJobs(tool);
+}
+
+void VRenderScheduler::startJobs(const QString &p_tool)
+{
+    while (m_running.value(p_tool, 0) < m_maxJobsPerTool) {
+        // The first one of the highest priority.
+        int idx = -1;
+        for (int i = 0; i < m_pending.size(); ++i) {
+            const Job *job = m_pending[i];
+            if (job->m_tool == p_tool
+                && (idx == -1 || job->m_priority > m_pending[idx]->m_priority)) {
+                idx = i;
+            }
+        }
+
+        if (idx == -1) {
+            break;
+        }
+
+        Job *job = m_pending.takeAt(idx);
+        ++m_running[p_tool];
+        startJob(job);
+    }
+}
+
+void VRenderScheduler::startJob(Job *p_job)
+{
+    QProcess *process = new QProcess(this);
+    p_job->m_process = process;
+
+    quint64 seq = p_job->m_seq;
+    connect(process, static_cast<void (QProcess::*)(int, QProcess::ExitStatus)>(&QProcess::finished),
+            this, [this, seq](int p_exitCode, QProcess::ExitStatus p_exitStatus) {
+                Job *job = findJob(seq);
+                if (job) {
+                    finishJob(job, p_exitCode, p_exitStatus);
+                }
+            });
+    connect(process, &QProcess::errorOccurred,
+            this, [this, seq](QProcess::ProcessError p_error) {
+                if (p_error != QProcess::FailedToStart) {
+                    return;
+                }
+
+                // It may be emitted within start().
+                QTimer::singleShot(0, this, [this, seq]() {
+                    Job *job = findJob(seq);
+                    if (job) {
+                        finishJob(job, -1, QProcess::CrashExit);
+                    }
+                });
+            });
+
+    if (p_job->m_args.isEmpty()) {
+        process->start(p_job->m_program);
+    } else {
+        process->start(p_job->m_program, p_job->m_args);
+    }
+
+    if (process->write(p_job->m_input) == -1) {
+        qWarning() << "fail to write to QProcess:" << process->errorString();
+    }
+
+    process->closeWriteChannel();
+}
+
+void VRenderScheduler::finishJob(Job *p_job, int p_exitCode, QProcess::ExitStatus p_exitStatus)
+{
+    QByteArray out, err;
+    QProcess *process = p_job->m_process;
+    if (process) {
+        process->disconnect(this);
+        out = process->readAllStandardOutput();
+        err = process->readAllStandardError();
+        process->deleteLater();
+    }
+
+    m_jobs.remove(jobKey(p_job));
+    --m_running[p_job->m_tool];
+
+    QString tool = p_job->m_tool;
+    QList<quint64> ids = p_job->m_ids;
+    for (auto id : ids) {
+        m_requests.remove(id);
+    }
+
+    delete p_job;
+
+    for (auto id : ids) {
+        emit renderFinished(id, p_exitCode, p_exitStatus, out, err);
+    }
+
+    startJobs(tool);
+}
+
+VRenderScheduler::Job *VRenderScheduler::findJob(quint64 p_seq) const
+{
+    for (auto job : m_jobs) {
+        if (job->m_seq == p_seq) {
+            return job;
+        }
+    }
+
+    return NULL;
+}
@@ -0,0 +1,110 @@
+#ifndef VRENDERSCHEDULER_H
+#define VRENDERSCHEDULER_H
+
+#include <QObject>
+#include <QByteArray>
+#include <QHash>
+#include <QList>
+#include <QProcess>
+#include <QString>
+#include <QStringList>
+
+// Run renderer processes such as Graphviz shared by all the helpers.
+// - At most a few processes of one tool run at the same time;
+// - Jobs of higher priority start first;
+// - Identical jobs are run only once;
+// - Canceled jobs are dropped or killed if no one else waits for them.
+class VRenderScheduler : public QObject
+{
+    Q_OBJECT
+public:
+    enum Priority
+    {
+        Low = 0,
+        // Blocks in the viewport.
+        Visible,
+        // Live preview of the block under cursor.
+        Urgent
+    };
+
+    static VRenderScheduler *inst();
+
+    // Feed @p_input to @p_program with @p_args.
+    // If @p_args is empty, @p_program is a command line.
+    // Returns the request id. renderFinished() will be emitted later.
+    quint64 render(const QString &p_tool,
+                   const QString &p_program,
+                   const QStringList &p_args,
+                   const QByteArray &p_input,
+                   int p_priority = Priority::Low);
+
+    // The result of @p_id will not be emitted.
+    void cancel(quint64 p_id);
+
+signals:
+    void renderFinished(quint64 p_id,
+                        int p_exitCode,
+                        QProcess::ExitStatus p_exitStatus,
+                        const QByteArray &p_out,
+                        const QByteArray &p_err);
+
+private:
+    struct Job
+    {
+        QString m_tool;
+
+        QString m_program;
+
+        QStringList m_args;
+
+        QByteArray m_input;
+
+        int m_priority;
+
+        // Requests waiting for this job.
+        QList<quint64> m_ids;
+
+        // Unique sequence number.
+        quint64 m_seq;
+
+        QProcess *m_process;
+    };
+
+    explicit VRenderScheduler(QObject *p_parent = nullptr);
+
+    ~VRenderScheduler();
+
+    // Start pending jobs of @p_tool within the limit.
+    void startJobs(const QString &p_tool);
+
+    void startJob(Job *p_job);
+
+    void finishJob(Job *p_job, int p_exitCode, QProcess::ExitStatus p_exitStatus);
+
+    // Returns NULL if the job is gone.
+    Job *findJob(quint64 p_seq) const;
+
+    static QString jobKey(const Job *p_job);
+
+    static VRenderScheduler *s_inst;
+
+    int m_maxJobsPerTool;
+
+    quint64 m_nextId;
+
+    quint64 m_nextSeq;
+
+    // Pending jobs in the order of submission.
+    QList<Job *> m_pending;
+
+    // Pending and running jobs by jobKey().
+    QHash<QString, Job *> m_jobs;
+
+    // Jobs by request id.
+    QHash<quint64, Job *> m_requests;
+
+    // Number of running jobs of each tool.
+    QHash<QString, int> m_running;
+};
+
+#endif // VRENDERSCHEDULER_H
@@ -181,13 +181,13 @@ public:
 
     void setCodeBlockTimeStamp(TimeStamp p_ts);
 
-    bool isBlockHighlightCacheMatched(const QVector<HLUnit> &p_highlight) const;
+    bool isBlockHighlightCacheMatched(const BlockHighlights<HLUnit>::Units &p_highlight) const;
 
     QVector<HLUnit> &getBlockHighlightCache();
 
     void setBlockHighlightCache(const QVector<HLUnit> &p_highlight);
 
-    bool isCodeBlockHighlightCacheMatched(const QVector<HLUnitStyle> &p_highlight) const;
+    bool isCodeBlockHighlightCacheMatched(const BlockHighlights<HLUnitStyle>::Units &p_highlight) const;
 
     QVector<HLUnitStyle> &getCodeBlockHighlightCache();
 
@@ -265,7 +265,7 @@ inline void VTextBlockData::setCodeBlockTimeStamp(TimeStamp p_ts)
     m_codeBlockTimeStamp = p_ts;
 }
 
-inline bool VTextBlockData::isBlockHighlightCacheMatched(const QVector<HLUnit> &p_highlight) const
+inline bool VTextBlockData::isBlockHighlightCacheMatched(const BlockHighlights<HLUnit>::Units &p_highlight) const
 {
     if (!m_cacheValid
         || p_highlight.size() != m_blockHighlightCache.size()) {
@@ -293,7 +293,7 @@ inline void VTextBlockData::setBlockHighlightCache(const QVector<HLUnit> &p_high
     m_blockHighlightCache = p_highlight;
 }
 
-inline bool VTextBlockData::isCodeBlockHighlightCacheMatched(const QVector<HLUnitStyle> &p_highlight) const
+inline bool VTextBlockData::isCodeBlockHighlightCacheMatched(const BlockHighlights<HLUnitStyle>::Units &p_highlight) const
 {
     if (p_highlight.size() != m_codeBlockHighlightCache.size()) {
         return false;
@@ -8,6 +8,8 @@
 #include <QFontMetrics>
 #include <QFont>
 #include <QPainter>
+#include <QTimer>
+#include <QtMath>
 
 #include "vimageresourcemanager2.h"
 #include "vtextedit.h"
@@ -16,6 +18,15 @@
 #define MARKER_THICKNESS        2
 #define MAX_INLINE_IMAGE_HEIGHT 400
 
+// Extra blocks laid out around the clip region in lazy layout, in pages of
+// the clip region.
+#define LAZY_LAYOUT_MARGIN      1
+
+// Blocks taller than this in device pixels are not cached as tiles.
+#define MAX_BLOCK_TILE_HEIGHT   4096
+
+QCache<VTextDocumentLayout::BlockTileKey, BlockTile> VTextDocumentLayout::s_blockTiles(0);
+
 inline static bool realEqual(qreal p_a, qreal p_b)
 {
     return qAbs(p_a - p_b) < 1e-8;
@@ -26,7 +37,6 @@ VTextDocumentLayout::VTextDocumentLayout(QTextDocument *p_doc,
     : QAbstractTextDocumentLayout(p_doc),
       m_margin(p_doc->documentMargin()),
       m_width(0),
-      m_maximumWidthBlockNumber(-1),
       m_height(0),
       m_lineLeading(0),
       m_blockCount(0),
@@ -42,10 +52,18 @@ VTextDocumentLayout::VTextDocumentLayout(QTextDocument *p_doc,
       m_highlightCursorLineBlock(false),
       m_cursorLineBlockBg("#C0C0C0"),
       m_cursorLineBlockNumber(-1),
-      m_extraBufferHeight(0)
+      m_extraBufferHeight(0),
+      m_lazyLayoutBlockNumber(0),
+      m_numOfEstimatedBlocks(0),
+      m_documentSizeUpdatePending(false)
 {
 }
 
+VTextDocumentLayout::~VTextDocumentLayout()
+{
+    clearBlockTiles();
+}
+
 static void fillBackground(QPainter *p_painter,
                            const QRectF &p_rect,
                            QBrush p_brush,
@@ -79,130 +97,49 @@ void VTextDocumentLayout::blockRangeFromRect(const QRectF &p_rect,
         return;
     }
 
-    p_first = -1;
-    p_last = document()->blockCount() - 1;
-    int y = p_rect.y();
-    QTextBlock block = document()->firstBlock();
-    while (block.isValid()) {
-        const BlockLayoutInfo *info = VTextBlockData::layoutInfo(block);
-        V_ASSERT(info->hasOffset());
-
-        if (info->top() == y
-            || (info->top() < y && info->bottom() >= y)) {
-            p_first = block.blockNumber();
-            break;
-        }
-
-        block = block.next();
-    }
-
-    if (p_first == -1) {
-        p_last = -1;
-        return;
-    }
-
-    y += p_rect.height();
-    while (block.isValid()) {
-        const BlockLayoutInfo *info = VTextBlockData::layoutInfo(block);
-        V_ASSERT(info->hasOffset());
-
-        if (info->bottom() > y) {
-            p_last = block.blockNumber();
-            break;
-        }
-
-        block = block.next();
-    }
-}
-
-void VTextDocumentLayout::blockRangeFromRectBS(const QRectF &p_rect,
-                                               int &p_first,
-                                               int &p_last) const
-{
-    if (p_rect.isNull()) {
-        p_first = 0;
-        p_last = document()->blockCount() - 1;
-        return;
-    }
-
     p_first = findBlockByPosition(p_rect.topLeft());
     if (p_first == -1) {
         p_last = -1;
         return;
     }
 
-    int y = p_rect.bottom();
-    QTextBlock block = document()->findBlockByNumber(p_first);
-    const BlockLayoutInfo *info = VTextBlockData::layoutInfo(block);
-    if (realEqual(info->top(), p_rect.top()) && p_first > 0) {
+    if (realEqual(blockOffset(p_first), p_rect.top()) && p_first > 0) {
         --p_first;
     }
 
-    p_last = document()->blockCount() - 1;
-    while (block.isValid()) {
-        const BlockLayoutInfo *tinfo = VTextBlockData::layoutInfo(block);
-        if (!tinfo->hasOffset()) {
-            qWarning() << "block without offset"
-                       << block.blockNumber() << tinfo->m_offset
-                       << tinfo->m_rect << tinfo->m_rect.isNull();
-        }
-
-        V_ASSERT(tinfo->hasOffset());
-
-        if (tinfo->bottom() > y) {
-            p_last = block.blockNumber();
-            break;
-        }
-
-        block = block.next();
-    }
+    // The first block whose bottom is below the rect.
+    int y = p_rect.bottom();
+    p_last = qMin(m_blockHeights.findBlock(y), document()->blockCount() - 1);
 }
 
 int VTextDocumentLayout::findBlockByPosition(const QPointF &p_point) const
 {
-    QTextDocument *doc = document();
-    int first = 0, last = doc->blockCount() - 1;
-    int y = p_point.y();
-    while (first <= last) {
-        int mid = (first + last) / 2;
-        QTextBlock blk = doc->findBlockByNumber(mid);
-        const BlockLayoutInfo *info = VTextBlockData::layoutInfo(blk);
-        if (!info) {
-            return -1;
-        }
-
-        V_ASSERT(info->hasOffset());
-        if (info->top() <= y && info->bottom() > y) {
-            // Found it.
-            return mid;
-        } else if (info->top() > y) {
-            last = mid - 1;
-        } else {
-            first = mid + 1;
-        }
-    }
-
-    QTextBlock blk = doc->lastBlock();
-    const BlockLayoutInfo *info = VTextBlockData::layoutInfo(blk);
-    if (y >= info->bottom()) {
-        return blk.blockNumber();
+    int lastBlock = qMin(m_blockHeights.size(), document()->blockCount()) - 1;
+    if (lastBlock < 0) {
+        return -1;
     }
 
-    return 0;
+    // If @p_point is below all the blocks, return the last block.
+    int y = p_point.y();
+    return qMin(m_blockHeights.findBlock(y), lastBlock);
 }
 
 void VTextDocumentLayout::draw(QPainter *p_painter, const PaintContext &p_context)
 {
+    if (m_numOfEstimatedBlocks > 0) {
+        layoutEstimatedBlocks(p_context.clip);
+    }
+
     // Find out the blocks.
     int first, last;
-    blockRangeFromRectBS(p_context.clip, first, last);
+    blockRangeFromRect(p_context.clip, first, last);
     if (first == -1) {
         return;
     }
 
     QTextDocument *doc = document();
     QTextBlock block = doc->findBlockByNumber(first);
-    QPointF offset(m_margin, VTextBlockData::layoutInfo(block)->top());
+    QPointF offset(m_margin, blockOffset(first));
     QTextBlock lastBlock = doc->findBlockByNumber(last);
 
     QPen oldPen = p_painter->pen();
@@ -210,7 +147,7 @@ void VTextDocumentLayout::draw(QPainter *p_painter, const PaintContext &p_contex
 
     while (block.isValid()) {
         const BlockLayoutInfo *info = VTextBlockData::layoutInfo(block);
-        V_ASSERT(info->hasOffset());
+        V_ASSERT(!info->isNull());
 
         const QRectF &rect = info->m_rect;
         QTextLayout *layout = block.layout();
@@ -224,35 +161,31 @@ void VTextDocumentLayout::draw(QPainter *p_painter, const PaintContext &p_contex
             continue;
         }
 
-        QTextBlockFormat blockFormat = block.blockFormat();
-        QBrush bg = blockFormat.background();
-        if (bg != Qt::NoBrush) {
-            int x = offset.x();
-            int y = offset.y();
-            fillBackground(p_painter,
-                           rect.adjusted(x, y, x, y),
-                           bg);
-        }
-
-        // Draw block background for HRULE.
-        if (block.userState() == HighlightBlockState::HRule) {
-            QVector<QTextLayout::FormatRange> fmts = layout->formats();
-            if (fmts.size() == 1) {
-                int x = offset.x();
-                int y = offset.y();
-                fillBackground(p_painter,
-                               rect.adjusted(x, y, x, y),
-                               fmts[0].format.background());
-            }
-        }
-
         auto selections = formatRangeFromSelection(block, p_context.selections);
 
-        // Draw the cursor.
         int blpos = block.position();
         int bllen = block.length();
         bool drawCursor = p_context.cursorPosition >= blpos
                           && p_context.cursorPosition < blpos + bllen;
+
+        // Blit the cached tile if the block has nothing transient to draw.
+        if (!drawCursor
+            && selections.isEmpty()
+            && layout->preeditAreaText().isEmpty()
+            && !(m_highlightCursorLineBlock && m_cursorLineBlockNumber == block.blockNumber())
+            && drawBlockTile(p_painter, block, rect, offset)) {
+            offset.ry() += rect.height();
+            if (block == lastBlock) {
+                break;
+            }
+
+            block = block.next();
+            continue;
+        }
+
+        drawBlockBackground(p_painter, block, rect, offset);
+
+        // Draw the cursor.
         int cursorWidth = m_cursorWidth;
         int cursorPosition = p_context.cursorPosition - blpos;
         if (drawCursor && m_cursorBlockMode != CursorBlock::None) {
@@ -350,6 +283,118 @@ void VTextDocumentLayout::draw(QPainter *p_painter, const PaintContext &p_contex
     p_painter->setPen(oldPen);
 }
 
+void VTextDocumentLayout::drawBlockBackground(QPainter *p_painter,
+                                              const QTextBlock &p_block,
+                                              const QRectF &p_rect,
+                                              const QPointF &p_offset)
+{
+    int x = p_offset.x();
+    int y = p_offset.y();
+
+    QTextBlockFormat blockFormat = p_block.blockFormat();
+    QBrush bg = blockFormat.background();
+    if (bg != Qt::NoBrush) {
+        fillBackground(p_painter,
+                       p_rect.adjusted(x, y, x, y),
+                       bg);
+    }
+
+    // Draw block background for HRULE.
+    if (p_block.userState() == HighlightBlockState::HRule) {
+        QVector<QTextLayout::FormatRange> fmts = p_block.layout()->formats();
+        if (fmts.size() == 1) {
+            fillBackground(p_painter,
+                           p_rect.adjusted(x, y, x, y),
+                           fmts[0].format.background());
+        }
+    }
+}
+
+bool VTextDocumentLayout::drawBlockTile(QPainter *p_painter,
+                                        const QTextBlock &p_block,
+                                        const QRectF &p_rect,
+                                        const QPointF &p_offset)
+{
+    if (s_blockTiles.maxCost() <= 0) {
+        return false;
+    }
+
+    qreal dpr = p_painter->device()->devicePixelRatioF();
+
+    // Blocks may start at a fractional Y. Blit the tile at a whole device pixel
+    // and rasterize the block at the rest, which is then the same as drawing
+    // the block directly.
+    qreal tileY = qFloor(p_offset.y() * dpr) / dpr;
+    qreal yFraction = p_offset.y() - tileY;
+
+    QSize size(qCeil(p_offset.x() + p_rect.right()), qCeil(yFraction + p_rect.height()));
+    if (size.isEmpty() || size.height() * dpr > MAX_BLOCK_TILE_HEIGHT) {
+        return false;
+    }
+
+    int blockNum = p_block.blockNumber();
+    QRgb textColor = p_painter->pen().color().rgba();
+    const BlockTile *tile = s_blockTiles.object(BlockTileKey(this, blockNum));
+    if (tile && tile->isMatched(p_block.revision(), size, dpr, yFraction, textColor)) {
+        p_painter->drawPixmap(QPointF(0, tileY), tile->m_pixmap);
+        return true;
+    }
+
+    BlockTile *newTile = new BlockTile();
+    newTile->m_revision = p_block.revision();
+    newTile->m_size = size;
+    newTile->m_dpr = dpr;
+    newTile->m_yFraction = yFraction;
+    newTile->m_textColor = textColor;
+    newTile->m_pixmap = QPixmap(size * dpr);
+    newTile->m_pixmap.setDevicePixelRatio(dpr);
+    newTile->m_pixmap.fill(Qt::transparent);
+
+    bool imagesReady = true;
+    {
+    QPainter painter(&newTile->m_pixmap);
+    painter.setRenderHints(p_painter->renderHints());
+    painter.setPen(p_painter->pen());
+
+    QPointF offset(p_offset.x(), yFraction);
+    drawBlockBackground(&painter, p_block, p_rect, offset);
+
+    p_block.layout()->draw(&painter, offset);
+
+    imagesReady = drawImages(&painter, p_block, offset);
+
+    drawMarkers(&painter, p_block, offset);
+    }
+
+    p_painter->drawPixmap(QPointF(0, tileY), newTile->m_pixmap);
+
+    // Do not cache a block whose images will come later.
+    if (imagesReady) {
+        m_tileBlocks.insert(blockNum);
+        s_blockTiles.insert(BlockTileKey(this, blockNum), newTile, newTile->cost());
+    } else {
+        delete newTile;
+    }
+
+    return true;
+}
+
+void VTextDocumentLayout::removeBlockTile(int p_blockNumber)
+{
+    if (m_tileBlocks.remove(p_blockNumber)) {
+        s_blockTiles.remove(BlockTileKey(this, p_blockNumber));
+    }
+}
+
+void VTextDocumentLayout::clearBlockTiles()
+{
+    for (auto blockNum : m_tileBlocks) {
+        s_blockTiles.remove(BlockTileKey(this, blockNum));
+    }
+
+    m_tileBlocks.clear();
+}
+
 QVector<QTextLayout::FormatRange> VTextDocumentLayout::formatRangeFromSelection(const QTextBlock &p_block,
                                                                                 const QVector<Selection> &p_selections) const
 {
@@ -401,9 +446,19 @@ int VTextDocumentLayout::hitTest(const QPointF &p_point, Qt::HitTestAccuracy p_a
 
     QTextBlock block = document()->findBlockByNumber(bn);
     V_ASSERT(block.isValid());
+    const BlockLayoutInfo *info = VTextBlockData::layoutInfo(block);
+    if (info->isNull()) {
+        bool estimated = info->m_estimated;
+        VTextDocumentLayout *that = const_cast<VTextDocumentLayout *>(this);
+        that->layoutBlock(block);
+        if (estimated) {
+            that->updateDocumentSizeLater();
+        }
+    }
+
     QTextLayout *layout = block.layout();
     int off = 0;
-    QPointF pos = p_point - QPointF(m_margin, VTextBlockData::layoutInfo(block)->top());
+    QPointF pos = p_point - QPointF(m_margin, blockOffset(bn));
     for (int i = 0; i < layout->lineCount(); ++i) {
         QTextLine line = layout->lineAt(i);
         const QRectF lr = line.naturalTextRect();
@@ -445,15 +500,17 @@ QRectF VTextDocumentLayout::blockBoundingRect(const QTextBlock &p_block) const
     }
 
     const BlockLayoutInfo *info = VTextBlockData::layoutInfo(p_block);
-    if (!info->hasOffset()) {
-        if (info->isNull()) {
-            const_cast<VTextDocumentLayout *>(this)->layoutBlockAndUpdateOffset(p_block);
-        } else {
-            const_cast<VTextDocumentLayout *>(this)->updateOffset(p_block);
+    if (info->isNull()) {
+        bool estimated = info->m_estimated;
+        VTextDocumentLayout *that = const_cast<VTextDocumentLayout *>(this);
+        that->layoutBlock(p_block);
+        if (estimated) {
+            that->updateDocumentSizeLater();
         }
     }
 
-    QRectF geo = info->m_rect.adjusted(0, info->m_offset, 0, info->m_offset);
+    qreal offset = blockOffset(p_block.blockNumber());
+    QRectF geo = info->m_rect.adjusted(0, offset, 0, offset);
     return geo;
 }
 
@@ -466,12 +523,13 @@ void VTextDocumentLayout::documentChanged(int p_from, int p_charsRemoved, int p_
     m_margin = doc->documentMargin();
 
     int charsChanged = p_charsRemoved + p_charsAdded;
+    bool sameBlockCount = newBlockCount == m_blockCount;
 
     QTextBlock changeStartBlock = doc->findBlock(p_from);
     // May be an invalid block.
     QTextBlock changeEndBlock;
     if (p_charsRemoved == p_charsAdded
-        && newBlockCount == m_blockCount
+        && sameBlockCount
         && changeStartBlock.position() == p_from
         && changeStartBlock.length() == p_charsAdded) {
         // TODO: we may need one more next block.
@@ -486,21 +544,28 @@ void VTextDocumentLayout::documentChanged(int p_from, int p_charsRemoved, int p_
              << changeStartBlock.blockNumber() << changeEndBlock.blockNumber();
     */
 
+    // Tiles are indexed by block number.
+    if (!sameBlockCount) {
+        clearBlockTiles();
+    }
+
+    updateBlockCount(changeStartBlock.blockNumber(), newBlockCount);
+
     bool needRelayout = true;
     if (changeStartBlock == changeEndBlock
-        && newBlockCount == m_blockCount) {
+        && sameBlockCount) {
         // Change single block internal only.
         QTextBlock block = changeStartBlock;
         if (block.isValid() && block.length()) {
             needRelayout = false;
             QRectF oldBr = blockBoundingRect(block);
             clearBlockLayout(block);
-            layoutBlockAndUpdateOffset(block);
+            layoutBlock(block);
             QRectF newBr = blockBoundingRect(block);
             // Only one block is affected.
             if (newBr.height() == oldBr.height()) {
                 // Update document size.
-                updateDocumentSizeWithOneBlockChanged(block);
+                updateDocumentSize();
 
                 emit updateBlock(block);
                 return;
@@ -509,38 +574,182 @@ void VTextDocumentLayout::documentChanged(int p_from, int p_charsRemoved, int p_
     }
 
     if (needRelayout) {
+        int lastBlockNumber = changeEndBlock.isValid() ? changeEndBlock.blockNumber()
+                                                       : newBlockCount - 1;
+        bool lazy = isLazyLayout(lastBlockNumber - changeStartBlock.blockNumber() + 1);
+        qreal lineHeight = 0;
+        qreal charWidth = 0;
+        int charsPerLine = 0;
+        if (lazy) {
+            estimationMetrics(lineHeight, charWidth, charsPerLine);
+        }
+
         QTextBlock block = changeStartBlock;
         do {
-            clearBlockLayout(block);
-            layoutBlock(block);
+            if (lazy) {
+                estimateBlockLayout(block, lineHeight, charWidth, charsPerLine);
+            } else {
+                clearBlockLayout(block);
+                layoutBlock(block);
+            }
+
             if (block == changeEndBlock) {
                 break;
             }
 
             block = block.next();
         } while(block.isValid());
-
-        updateOffset(changeStartBlock);
     }
 
-    m_blockCount = newBlockCount;
-
     updateDocumentSize();
 
     // TODO: Update the view of all the blocks after changeStartBlock.
-    qreal offset = VTextBlockData::layoutInfo(changeStartBlock)->m_offset;
+    qreal offset = blockOffset(changeStartBlock.blockNumber());
     emit update(QRectF(0., offset, 1000000000., 1000000000.));
 }
 
+void VTextDocumentLayout::updateBlockCount(int p_blockNumber, int p_newBlockCount)
+{
+    // Blocks are inserted or removed right after @p_blockNumber, so the
+    // blocks after the change keep their heights and widths.
+    int idx = qMax(p_blockNumber, 0) + 1;
+    int delta = p_newBlockCount - m_blockHeights.size();
+    if (delta > 0) {
+        m_blockHeights.insert(idx, delta);
+        m_blockWidths.insert(idx, delta);
+    } else if (delta < 0) {
+        idx = qMin(idx, p_newBlockCount);
+        m_blockHeights.remove(idx, -delta);
+        m_blockWidths.remove(idx, -delta);
+    }
+
+    m_blockCount = p_newBlockCount;
+    m_numOfEstimatedBlocks = qMin(m_numOfEstimatedBlocks, m_blockCount);
+}
+
 // MUST layout out the block after clearBlockLayout().
-// TODO: Do we need to clear all the offset after @p_block?
 void VTextDocumentLayout::clearBlockLayout(QTextBlock &p_block)
 {
+    removeBlockTile(p_block.blockNumber());
     p_block.clearLayout();
     BlockLayoutInfo *info = VTextBlockData::layoutInfo(p_block);
     info->reset();
 }
 
+void VTextDocumentLayout::estimationMetrics(qreal &p_lineHeight,
+                                            qreal &p_charWidth,
+                                            int &p_charsPerLine) const
+{
+    QTextDocument *doc = document();
+    QFontMetricsF fm(doc->defaultFont());
+    p_lineHeight = fm.height() + m_lineLeading;
+    p_charWidth = qMax(fm.averageCharWidth(), qreal(1));
+
+    p_charsPerLine = 0;
+    qreal availableWidth = doc->pageSize().width();
+    if (availableWidth > 0) {
+        availableWidth -= (2 * m_margin + m_cursorMargin + m_cursorWidth);
+        p_charsPerLine = qMax(1, int(availableWidth / p_charWidth));
+    }
+}
+
+void VTextDocumentLayout::estimateBlockLayout(QTextBlock &p_block,
+                                              qreal p_lineHeight,
+                                              qreal p_charWidth,
+                                              int p_charsPerLine)
+{
+    clearBlockLayout(p_block);
+
+    BlockLayoutInfo *info = VTextBlockData::layoutInfo(p_block);
+    if (!info->m_estimated) {
+        info->m_estimated = true;
+        ++m_numOfEstimatedBlocks;
+    }
+
+    int blockNum = p_block.blockNumber();
+    if (blockNum >= m_blockHeights.size()
+        || m_blockHeights.size() != document()->blockCount()) {
+        return;
+    }
+
+    qreal height = 0;
+    qreal width = 0;
+    if (p_block.isVisible()) {
+        // Exclude the paragraph separator.
+        int chars = qMax(p_block.length() - 1, 0);
+        int lines = 1;
+        if (p_charsPerLine > 0) {
+            lines += qMax(chars - 1, 0) / p_charsPerLine;
+            chars = qMin(chars, p_charsPerLine);
+        }
+
+        height = lines * p_lineHeight;
+        if (!p_block.next().isValid()) {
+            height += m_margin;
+        }
+
+        // The horizontal scroll bar needs the width without wrapping.
+        width = m_margin + chars * p_charWidth;
+    }
+
+    m_blockHeights.setHeight(blockNum, height);
+    m_blockWidths.setWidth(blockNum, width);
+}
+
+void VTextDocumentLayout::layoutEstimatedBlocks(const QRectF &p_rect)
+{
+    QRectF rect(p_rect);
+    if (!rect.isNull()) {
+        qreal margin = rect.height() * LAZY_LAYOUT_MARGIN;
+        rect.adjust(0, -margin, 0, margin);
+    }
+
+    // Offsets of the blocks change once the estimated heights are replaced,
+    // so find out the range again until all the blocks within it are laid out.
+    bool changed = false;
+    while (true) {
+        int first, last;
+        blockRangeFromRect(rect, first, last);
+        if (first == -1) {
+            break;
+        }
+
+        bool laidOut = false;
+        QTextBlock block = document()->findBlockByNumber(first);
+        while (block.isValid() && block.blockNumber() <= last) {
+            if (VTextBlockData::layoutInfo(block)->isNull()) {
+                layoutBlock(block);
+                laidOut = true;
+            }
+
+            block = block.next();
+        }
+
+        if (!laidOut) {
+            break;
+        }
+
+        changed = true;
+    }
+
+    if (changed) {
+        updateDocumentSizeLater();
+    }
+}
+
+void VTextDocumentLayout::updateDocumentSizeLater()
+{
+    if (m_documentSizeUpdatePending) {
+        return;
+    }
+
+    m_documentSizeUpdatePending = true;
+    QTimer::singleShot(0, this, [this]() {
+        m_documentSizeUpdatePending = false;
+        updateDocumentSize();
+    });
+}
+
 // From Qt's qguiapplication_p.h.
 static Qt::Alignment visualAlignment(Qt::LayoutDirection p_direction,
                                      Qt::Alignment p_alignment)
@@ -611,74 +820,6 @@ void VTextDocumentLayout::layoutBlock(const QTextBlock &p_block)
     finishBlockLayout(p_block, markers, images);
 }
 
-void VTextDocumentLayout::updateOffsetBefore(const QTextBlock &p_block)
-{
-    BlockLayoutInfo *info = VTextBlockData::layoutInfo(p_block);
-    V_ASSERT(!info->isNull());
-
-    const int blockNum = p_block.blockNumber();
-    if (blockNum == 0) {
-        info->m_offset = 0;
-    } else {
-        QTextBlock blk = p_block.previous();
-        while (blk.isValid()) {
-            BlockLayoutInfo *pinfo = VTextBlockData::layoutInfo(blk);
-            if (!pinfo->hasOffset()) {
-                int num = blk.blockNumber();
-                if (pinfo->isNull()) {
-                    layoutBlock(blk);
-                }
-
-                if (num == 0) {
-                    pinfo->m_offset = 0;
-                } else {
-                    blk = blk.previous();
-                    continue;
-                }
-            }
-
-            // Now we reach a block with offset.
-            qreal offset = pinfo->bottom();
-            blk = blk.next();
-            while (blk.isValid() && blk.blockNumber() <= blockNum) {
-                BlockLayoutInfo *ninfo = VTextBlockData::layoutInfo(blk);
-                V_ASSERT(!ninfo->isNull());
-                ninfo->m_offset = offset;
-                offset = ninfo->bottom();
-                blk = blk.next();
-            }
-
-            break;
-        }
-
-        V_ASSERT(info->hasOffset());
-    }
-}
-
-// NOTICE: It will skip non-layouted or offset-non-changed blocks.
-// So if you relayout separated blocks, you need to updateOffsetAfter() for each of them.
-void VTextDocumentLayout::updateOffsetAfter(const QTextBlock &p_block)
-{
-    BlockLayoutInfo *info = VTextBlockData::layoutInfo(p_block);
-    V_ASSERT(info->hasOffset());
-    qreal offset = info->bottom();
-    QTextBlock blk = p_block.next();
-    while (blk.isValid()) {
-        BlockLayoutInfo *ninfo = VTextBlockData::layoutInfo(blk);
-        if (ninfo->isNull()) {
-            break;
-        }
-
-        if (realEqual(ninfo->m_offset, offset)) {
-            break;
-        }
-
-        ninfo->m_offset = offset;
-        offset = ninfo->bottom();
-        blk = blk.next();
-    }
-}
-
 qreal VTextDocumentLayout::layoutLines(const QTextBlock &p_block,
                                        QTextLayout *p_tl,
                                        QVector<Marker> &p_markers,
@@ -789,9 +930,21 @@ void VTextDocumentLayout::finishBlockLayout(const QTextBlock &p_block,
     BlockLayoutInfo *info = VTextBlockData::layoutInfo(p_block);
     V_ASSERT(info->isNull());
     info->reset();
+    if (info->m_estimated) {
+        info->m_estimated = false;
+        --m_numOfEstimatedBlocks;
+    }
     info->m_rect = blockRectFromTextLayout(p_block, &ipi);
     V_ASSERT(!info->m_rect.isNull());
 
+    // The trees may be outdated if it is called before documentChanged().
+    int blockNum = p_block.blockNumber();
+    if (blockNum < m_blockHeights.size()
+        && m_blockHeights.size() == document()->blockCount()) {
+        m_blockHeights.setHeight(blockNum, info->m_rect.height());
+        m_blockWidths.setWidth(blockNum, info->m_rect.width());
+    }
+
     bool hasImage = false;
     if (ipi.isValid()) {
         V_ASSERT(p_markers.isEmpty());
@@ -818,33 +971,11 @@ void VTextDocumentLayout::finishBlockLayout(const QTextBlock &p_block,
 
 void VTextDocumentLayout::updateDocumentSize()
 {
-    QTextBlock block = document()->lastBlock();
-    const BlockLayoutInfo *info = VTextBlockData::layoutInfo(block);
-    if (!info->hasOffset()) {
-        if (info->isNull()) {
-            layoutBlock(block);
-        }
-
-        updateOffsetBefore(block);
-    }
-
     int oldHeight = m_height;
     int oldWidth = m_width;
 
-    m_height = info->bottom();
-
-    m_width = 0;
-    QTextBlock blk = document()->firstBlock();
-    while (blk.isValid()) {
-        const BlockLayoutInfo *ninfo = VTextBlockData::layoutInfo(blk);
-        V_ASSERT(ninfo->hasOffset());
-        if (m_width < ninfo->m_rect.width()) {
-            m_width = ninfo->m_rect.width();
-            m_maximumWidthBlockNumber = blk.blockNumber();
-        }
-
-        blk = blk.next();
-    }
+    m_height = m_blockHeights.total();
+    m_width = m_blockWidths.maximum();
 
     if (oldHeight != m_height
         || oldWidth != m_width) {
@@ -913,20 +1044,6 @@ QRectF VTextDocumentLayout::blockRectFromTextLayout(const QTextBlock &p_block,
     return br;
 }
 
-void VTextDocumentLayout::updateDocumentSizeWithOneBlockChanged(const QTextBlock &p_block)
-{
-    const BlockLayoutInfo *info = VTextBlockData::layoutInfo(p_block);
-    qreal width = info->m_rect.width();
-    if (width > m_width) {
-        m_width = width;
-        m_maximumWidthBlockNumber = p_block.blockNumber();
-        emit documentSizeChanged(documentSize());
-    } else if (width < m_width && p_block.blockNumber() == m_maximumWidthBlockNumber) {
-        // Shrink the longest block.
-        updateDocumentSize();
-    }
-}
-
 void VTextDocumentLayout::setLineLeading(qreal p_leading)
 {
     if (p_leading >= 0) {
@@ -981,18 +1098,20 @@ void VTextDocumentLayout::adjustImagePaddingAndSize(const VPreviewedImageInfo *p
     }
 }
 
-void VTextDocumentLayout::drawImages(QPainter *p_painter,
+bool VTextDocumentLayout::drawImages(QPainter *p_painter,
                                      const QTextBlock &p_block,
                                      const QPointF &p_offset)
 {
     const QVector<ImagePaintInfo> &images = VTextBlockData::layoutInfo(p_block)->m_images;
     if (images.isEmpty()) {
-        return;
+        return true;
     }
 
+    bool ready = true;
     for (auto const & img : images) {
-        const QPixmap *image = m_imageMgr->findImage(img.m_name);
-        if (!image) {
+        QPixmap image = m_imageMgr->findImage(img.m_name);
+        if (image.isNull()) {
+            ready = false;
             continue;
         }
 
@@ -1007,8 +1126,10 @@ void VTextDocumentLayout::drawImages(QPainter *p_painter,
             p_painter->fillRect(targetRect, img.m_background);
         }
 
-        p_painter->drawPixmap(targetRect, *image);
+        p_painter->drawPixmap(targetRect, image);
     }
+
+    return ready;
 }
 
 
@@ -1039,15 +1160,34 @@ void VTextDocumentLayout::relayout()
     // Update the margin.
     m_margin = doc->documentMargin();
 
+    clearBlockTiles();
+
+    m_blockHeights.reset(doc->blockCount());
+    m_blockWidths.reset(doc->blockCount());
+    m_blockCount = doc->blockCount();
+
+    bool lazy = isLazyLayout(m_blockCount);
+    qreal lineHeight = 0;
+    qreal charWidth = 0;
+    int charsPerLine = 0;
+    if (lazy) {
+        estimationMetrics(lineHeight, charWidth, charsPerLine);
+    }
+
     QTextBlock block = doc->firstBlock();
     while (block.isValid()) {
-        clearBlockLayout(block);
-        layoutBlock(block);
+        if (lazy) {
+            estimateBlockLayout(block, lineHeight, charWidth, charsPerLine);
+        } else {
+            clearBlockLayout(block);
+            layoutBlock(block);
+        }
 
         block = block.next();
     }
 
-    updateOffset(doc->firstBlock());
+    // All the blocks are visited. Drop the count of removed blocks.
+    m_numOfEstimatedBlocks = lazy ? m_blockCount : 0;
 
     updateDocumentSize();
 
@@ -1078,16 +1218,9 @@ void VTextDocumentLayout::relayout(const OrderedIntSet &p_blocks)
         return;
     }
 
-    // Need to update offset for each of these discontinuous blocks, because
-    // the offset of the non-touched blocks may be the same but there are still
-    // touched blocks after them.
-    for (auto & blk : blocks) {
-        updateOffset(blk);
-    }
-
     updateDocumentSize();
 
-    qreal offset = VTextBlockData::layoutInfo(blocks.first())->m_offset;
+    qreal offset = blockOffset(blocks.first().blockNumber());
     emit update(QRectF(0., offset, 1000000000., 1000000000.));
 }
 
@@ -1201,6 +1334,8 @@ void VTextDocumentLayout::updateBlockByNumber(int p_blockNumber)
         return;
     }
 
+    removeBlockTile(p_blockNumber);
+
     QTextBlock block = document()->findBlockByNumber(p_blockNumber);
     if (block.isValid()) {
         emit updateBlock(block);
@@ -5,6 +5,9 @@
 #include <QVector>
 #include <QSize>
 #include <QMap>
+#include <QCache>
+#include <QPair>
+#include <QSet>
 
 #include "vconstants.h"
 #include "vtextdocumentlayoutdata.h"
@@ -26,6 +29,8 @@ public:
     VTextDocumentLayout(QTextDocument *p_doc,
                         VImageResourceManager2 *p_imageMgr);
 
+    ~VTextDocumentLayout();
+
     void draw(QPainter *p_painter, const PaintContext &p_context) Q_DECL_OVERRIDE;
 
     int hitTest(const QPointF &p_point, Qt::HitTestAccuracy p_accuracy) const Q_DECL_OVERRIDE;
@@ -79,6 +84,14 @@ public:
 
     void setExtraBufferHeight(int p_height);
 
+    // Lay out only the blocks around the viewport when there are more than
+    // @p_number blocks to lay out. 0 to disable it.
+    void setLazyLayoutBlockNumber(int p_number);
+
+    // Cache rasterized blocks of all the layouts up to @p_sizeKB KB.
+    // 0 to disable it.
+    void setBlockTileCacheSize(int p_sizeKB);
+
 signals:
     // Emit to update current cursor block width if m_cursorBlockMode is enabled.
     void cursorBlockWidthUpdated(int p_width);
@@ -88,20 +101,35 @@ protected:
 
 private:
     // Layout one block.
-    // Only update the rect of the block. Offset is not updated yet.
+    // Update the rect of the block and its height and width in the trees.
     void layoutBlock(const QTextBlock &p_block);
 
-    // Update the offset of @p_block.
-    // @p_block has a valid layout.
-    // After the call, all block before @p_block will have the correct layout and offset.
-    void updateOffsetBefore(const QTextBlock &p_block);
+    // Clear the layout of @p_block and give it an estimated size.
+    // It will be laid out once it is drawn.
+    void estimateBlockLayout(QTextBlock &p_block,
+                             qreal p_lineHeight,
+                             qreal p_charWidth,
+                             int p_charsPerLine);
+
+    // Get the metrics used to estimate the size of a block.
+    // @p_charsPerLine: 0 if the lines will not be wrapped.
+    void estimationMetrics(qreal &p_lineHeight, qreal &p_charWidth, int &p_charsPerLine) const;
 
-    // Update the offset of blocks after @p_block if they are layouted.
-    void updateOffsetAfter(const QTextBlock &p_block);
+    // Whether we should lay out only the visible ones of @p_numOfBlocks blocks.
+    bool isLazyLayout(int p_numOfBlocks) const;
 
-    void updateOffset(const QTextBlock &p_block);
+    // Lay out the estimated blocks within @p_rect and a margin around it.
+    void layoutEstimatedBlocks(const QRectF &p_rect);
 
-    void layoutBlockAndUpdateOffset(const QTextBlock &p_block);
+    // Update the document size later to merge the changes of estimated blocks.
+    void updateDocumentSizeLater();
+
+    // Y offset of block @p_blockNumber.
+    qreal blockOffset(int p_blockNumber) const;
+
+    // Resize the block trees to @p_newBlockCount after a change starting
+    // from block @p_blockNumber.
+    void updateBlockCount(int p_blockNumber, int p_newBlockCount);
 
     // Returns the total height of this block after layouting lines and inline
     // images.
@@ -136,7 +164,6 @@ private:
                                       QVector<QPair<qreal, qreal>> &p_imageRange);
 
     // Clear the layout of @p_block.
-    // Also clear all the offset behind this block.
     void clearBlockLayout(QTextBlock &p_block);
 
     // Update rect of a block.
@@ -154,9 +181,6 @@ private:
     // Return [-1, -1] if no valid block range found.
     void blockRangeFromRect(const QRectF &p_rect, int &p_first, int &p_last) const;
 
-    // Binary search to get the block range [first, last] by @p_rect.
-    void blockRangeFromRectBS(const QRectF &p_rect, int &p_first, int &p_last) const;
-
     // Return a rect from the layout.
     // If @p_imageRect is not NULL and there is block image for this block, it will
     // be set to the rect of that image.
@@ -164,10 +188,6 @@ private:
     QRectF blockRectFromTextLayout(const QTextBlock &p_block,
                                    ImagePaintInfo *p_image = NULL);
 
-    // Update document size when only @p_block is changed and the height
-    // remains the same.
-    void updateDocumentSizeWithOneBlockChanged(const QTextBlock &p_block);
-
     void adjustImagePaddingAndSize(const VPreviewedImageInfo *p_info,
                                    int p_maximumWidth,
                                    int &p_padding,
@@ -175,7 +195,8 @@ private:
 
     // Draw images of block @p_block.
     // @p_offset: the offset for the drawing of the block.
-    void drawImages(QPainter *p_painter,
+    // Returns false if some images are not ready.
+    bool drawImages(QPainter *p_painter,
                     const QTextBlock &p_block,
                     const QPointF &p_offset);
 
@@ -183,6 +204,25 @@ private:
                      const QTextBlock &p_block,
                      const QPointF &p_offset);
 
+    // Draw block format background and HRULE background of @p_block.
+    void drawBlockBackground(QPainter *p_painter,
+                             const QTextBlock &p_block,
+                             const QRectF &p_rect,
+                             const QPointF &p_offset);
+
+    // Draw @p_block via its cached tile, rasterizing it if needed.
+    // The block should have no cursor and selections.
+    // Returns false if the block could not be drawn as a tile.
+    bool drawBlockTile(QPainter *p_painter,
+                       const QTextBlock &p_block,
+                       const QRectF &p_rect,
+                       const QPointF &p_offset);
+
+    void removeBlockTile(int p_blockNumber);
+
+    // Remove all the tiles of this layout from the shared cache.
+    void clearBlockTiles();
+
     void scaleSize(QSize &p_size, int p_width, int p_height);
 
     // Get text length in pixel.
@@ -195,12 +235,15 @@ private:
     // Maximum width of the contents.
     qreal m_width;
 
-    // The block number of the block which contains the m_width.
-    int m_maximumWidthBlockNumber;
-
     // Height of all the document (all the blocks, excluding m_extraBufferHeight).
     qreal m_height;
 
+    // Heights of all the blocks, which give the offset of each block.
+    BlockHeightTree m_blockHeights;
+
+    // Widths of all the blocks, which give m_width.
+    BlockWidthTree m_blockWidths;
+
     // Set the leading space of a line.
     qreal m_lineLeading;
 
@@ -242,6 +285,26 @@ private:
 
     // Extra buffer height in document size.
     int m_extraBufferHeight;
+
+    // Lay out lazily when there are more blocks than this. 0 to disable.
+    int m_lazyLayoutBlockNumber;
+
+    // Number of blocks with estimated sizes instead of a layout.
+    // Removed blocks may be still counted until next relayout().
+    int m_numOfEstimatedBlocks;
+
+    // Whether there is a pending updateDocumentSizeLater().
+    bool m_documentSizeUpdatePending;
+
+    // Block numbers of this layout which may have a tile in s_blockTiles.
+    QSet<int> m_tileBlocks;
+
+    typedef QPair<const VTextDocumentLayout *, int> BlockTileKey;
+
+    // Rasterized blocks of all the layouts indexed by layout and block number,
+    // with cost in KB. Tiles of hidden editors are evicted first as they are
+    // the least recently used.
+    static QCache<BlockTileKey, BlockTile> s_blockTiles;
 };
 
 inline qreal VTextDocumentLayout::getLineLeading() const
@@ -252,6 +315,7 @@ inline qreal VTextDocumentLayout::getLineLeading() const
 inline void VTextDocumentLayout::setImageLineColor(const QColor &p_color)
 {
     m_imageLineColor = p_color;
+    clearBlockTiles();
 }
 
 inline void VTextDocumentLayout::scaleSize(QSize &p_size, int p_width, int p_height)
@@ -319,16 +383,24 @@ inline int VTextDocumentLayout::cursorWidth() const
     return m_cursorWidth;
 }
 
-inline void VTextDocumentLayout::layoutBlockAndUpdateOffset(const QTextBlock &p_block)
+inline qreal VTextDocumentLayout::blockOffset(int p_blockNumber) const
+{
+    return m_blockHeights.offset(qBound(0, p_blockNumber, m_blockHeights.size()));
+}
+
+inline void VTextDocumentLayout::setLazyLayoutBlockNumber(int p_number)
+{
+    m_lazyLayoutBlockNumber = qMax(p_number, 0);
+}
+
+inline void VTextDocumentLayout::setBlockTileCacheSize(int p_sizeKB)
 {
-    layoutBlock(p_block);
-    updateOffset(p_block);
+    s_blockTiles.setMaxCost(qMax(p_sizeKB, 0));
 }
 
-inline void VTextDocumentLayout::updateOffset(const QTextBlock &p_block)
+inline bool VTextDocumentLayout::isLazyLayout(int p_numOfBlocks) const
 {
-    updateOffsetBefore(p_block);
-    updateOffsetAfter(p_block);
+    return m_lazyLayoutBlockNumber > 0 && p_numOfBlocks > m_lazyLayoutBlockNumber;
 }
 
 inline void VTextDocumentLayout::setExtraBufferHeight(int p_height)
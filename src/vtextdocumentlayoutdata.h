@@ -1,6 +1,8 @@
 #ifndef VTEXTDOCUMENTLAYOUTDATA_H
 #define VTEXTDOCUMENTLAYOUTDATA_H
 
+#include <QPixmap>
+
 #include "utils/vutils.h"
 
 // Denote the start and end position of a marker line.
@@ -35,13 +37,13 @@ struct ImagePaintInfo
 struct BlockLayoutInfo
 {
     BlockLayoutInfo()
-        : m_offset(-1)
+        : m_estimated(false)
     {
     }
 
+    // Keep m_estimated, which is cleared once the block is laid out.
     void reset()
     {
-        m_offset = -1;
         m_rect = QRectF();
         m_markers.clear();
         m_images.clear();
@@ -52,37 +54,252 @@ struct BlockLayoutInfo
         return m_rect.isNull();
     }
 
-    bool hasOffset() const
+    // The bounding rect of this block, including the margins.
+    // Null for invalid.
+    // Y offset of this block is maintained by BlockHeightTree.
+    QRectF m_rect;
+
+    // Markers to draw for this block.
+    // Y is the offset within this block.
+    QVector<Marker> m_markers;
+
+    // Images to draw for this block.
+    // Y is the offset within this block.
+    QVector<ImagePaintInfo> m_images;
+
+    // Whether this block has an estimated size instead of a layout.
+    bool m_estimated;
+};
+
+// Rasterized contents of a block, without cursor and selections.
+struct BlockTile
+{
+    bool isMatched(int p_revision,
+                   const QSize &p_size,
+                   qreal p_dpr,
+                   qreal p_yFraction,
+                   QRgb p_textColor) const
     {
-        return m_offset > -1 && !m_rect.isNull();
+        return m_revision == p_revision
+               && m_size == p_size
+               && m_dpr == p_dpr
+               && m_yFraction == p_yFraction
+               && m_textColor == p_textColor;
     }
 
-    qreal top() const
+    // Cost in KB.
+    int cost() const
     {
-        V_ASSERT(hasOffset());
-        return m_offset;
+        qint64 bytes = qint64(m_pixmap.width()) * m_pixmap.height() * 4;
+        return int(qMax(bytes / 1024, qint64(1)));
     }
 
-    qreal bottom() const
+    // Revision of the block.
+    int m_revision;
+
+    // Size of the tile in pixels.
+    QSize m_size;
+
+    // Device pixel ratio of the tile.
+    qreal m_dpr;
+
+    // Y offset of the block within the tile, less than one device pixel,
+    // so that the tile is blitted at a whole device pixel.
+    qreal m_yFraction;
+
+    // Default text color of the tile.
+    QRgb m_textColor;
+
+    QPixmap m_pixmap;
+};
+
+// Heights of blocks indexed by block number in a Fenwick tree, so that the
+// Y offset of a block and the block at a given Y could be got in O(log n).
+// Inserting or removing blocks takes O(n) to rebuild the tree.
+class BlockHeightTree
+{
+public:
+    int size() const
     {
-        V_ASSERT(hasOffset());
-        return m_offset + m_rect.height();
+        return m_heights.size();
     }
 
-    // Y offset of this block.
-    // -1 for invalid.
-    qreal m_offset;
+    void reset(int p_size)
+    {
+        m_heights.fill(0, p_size);
+        m_tree.fill(0, p_size + 1);
+    }
 
-    // The bounding rect of this block, including the margins.
-    // Null for invalid.
-    QRectF m_rect;
+    qreal height(int p_idx) const
+    {
+        return m_heights[p_idx];
+    }
 
-    // Markers to draw for this block.
-    // Y is the offset within this block.
-    QVector<Marker> m_markers;
+    void setHeight(int p_idx, qreal p_height)
+    {
+        qreal delta = p_height - m_heights[p_idx];
+        if (delta == 0) {
+            return;
+        }
 
-    // Images to draw for this block.
-    // Y is the offset within this block.
-    QVector<ImagePaintInfo> m_images;
+        m_heights[p_idx] = p_height;
+        for (int i = p_idx + 1; i < m_tree.size(); i += i & -i) {
+            m_tree[i] += delta;
+        }
+    }
+
+    // Total height of blocks [0, @p_idx), which is the Y offset of block @p_idx.
+    qreal offset(int p_idx) const
+    {
+        qreal sum = 0;
+        for (int i = p_idx; i > 0; i -= i & -i) {
+            sum += m_tree[i];
+        }
+
+        return sum;
+    }
+
+    qreal total() const
+    {
+        return offset(size());
+    }
+
+    // Return the first block whose bottom is greater than @p_y.
+    // Return size() if there is no such block.
+    int findBlock(qreal p_y) const
+    {
+        int step = 1;
+        while (step * 2 <= size()) {
+            step *= 2;
+        }
+
+        // Find the largest idx with offset(idx) <= @p_y.
+        int idx = 0;
+        qreal sum = 0;
+        for (; step > 0 && size() > 0; step /= 2) {
+            int next = idx + step;
+            if (next <= size() && sum + m_tree[next] <= p_y) {
+                idx = next;
+                sum += m_tree[next];
+            }
+        }
+
+        return idx;
+    }
+
+    // Insert @p_count blocks of zero height before block @p_idx.
+    void insert(int p_idx, int p_count)
+    {
+        m_heights.insert(qBound(0, p_idx, size()), p_count, 0);
+        rebuild();
+    }
+
+    // Remove @p_count blocks starting from block @p_idx.
+    void remove(int p_idx, int p_count)
+    {
+        m_heights.remove(p_idx, p_count);
+        rebuild();
+    }
+
+private:
+    void rebuild()
+    {
+        int sz = m_heights.size();
+        m_tree.fill(0, sz + 1);
+        for (int i = 1; i <= sz; ++i) {
+            m_tree[i] += m_heights[i - 1];
+            int parent = i + (i & -i);
+            if (parent <= sz) {
+                m_tree[parent] += m_tree[i];
+            }
+        }
+    }
+
+    QVector<qreal> m_heights;
+
+    // 1-based Fenwick tree of m_heights.
+    QVector<qreal> m_tree;
+};
+
+// Widths of blocks indexed by block number in a segment tree, so that the
+// maximum width could be maintained in O(log n) on a block change.
+// Inserting or removing blocks takes O(n) to rebuild the tree.
+class BlockWidthTree
+{
+public:
+    BlockWidthTree()
+        : m_leafBase(1)
+    {
+    }
+
+    int size() const
+    {
+        return m_widths.size();
+    }
+
+    void reset(int p_size)
+    {
+        m_widths.fill(0, p_size);
+        rebuild();
+    }
+
+    void setWidth(int p_idx, qreal p_width)
+    {
+        if (m_widths[p_idx] == p_width) {
+            return;
+        }
+
+        m_widths[p_idx] = p_width;
+        int i = m_leafBase + p_idx;
+        m_tree[i] = p_width;
+        for (i /= 2; i >= 1; i /= 2) {
+            m_tree[i] = qMax(m_tree[2 * i], m_tree[2 * i + 1]);
+        }
+    }
+
+    qreal maximum() const
+    {
+        return m_tree.isEmpty() ? 0 : m_tree[1];
+    }
+
+    // Insert @p_count blocks of zero width before block @p_idx.
+    void insert(int p_idx, int p_count)
+    {
+        m_widths.insert(qBound(0, p_idx, size()), p_count, 0);
+        rebuild();
+    }
+
+    // Remove @p_count blocks starting from block @p_idx.
+    void remove(int p_idx, int p_count)
+    {
+        m_widths.remove(p_idx, p_count);
+        rebuild();
+    }
+
+private:
+    void rebuild()
+    {
+        m_leafBase = 1;
+        while (m_leafBase < m_widths.size()) {
+            m_leafBase *= 2;
+        }
+
+        m_tree.fill(0, 2 * m_leafBase);
+        for (int i = 0; i < m_widths.size(); ++i) {
+            m_tree[m_leafBase + i] = m_widths[i];
+        }
+
+        for (int i = m_leafBase - 1; i >= 1; --i) {
+            m_tree[i] = qMax(m_tree[2 * i], m_tree[2 * i + 1]);
+        }
+    }
+
+    QVector<qreal> m_widths;
+
+    // Index of the first leaf in m_tree, which is a power of 2.
+    int m_leafBase;
+
+    // 1-based segment tree with the maximum of children in each node.
+    QVector<qreal> m_tree;
 };
 #endif // VTEXTDOCUMENTLAYOUTDATA_H
@@ -4,8 +4,10 @@
 #include <QScrollBar>
 #include <QPainter>
 #include <QResizeEvent>
+#include <QHideEvent>
 
 #include "vimageresourcemanager2.h"
+#include "vtextblockdata.h"
 
 #define VIRTUAL_CURSOR_BLOCK_WIDTH 8
 
@@ -360,15 +362,10 @@ bool VTextEdit::containsImage(const QString &p_imageName) const
 
 QSize VTextEdit::imageSize(const QString &p_imageName) const
 {
-    const QPixmap *img = m_imageMgr->findImage(p_imageName);
-    if (img) {
-        return img->size();
-    }
-
-    return QSize();
+    return m_imageMgr->imageSize(p_imageName);
 }
 
-const QPixmap *VTextEdit::findImage(const QString &p_name) const
+QPixmap VTextEdit::findImage(const QString &p_name) const
 {
     return m_imageMgr->findImage(p_name);
 }
@@ -380,6 +377,27 @@ void VTextEdit::addImage(const QString &p_imageName, const QPixmap &p_image)
     }
 }
 
+void VTextEdit::addImagePlaceholder(const QString &p_imageName, const QSize &p_size)
+{
+    if (m_blockImageEnabled) {
+        m_imageMgr->addPlaceholder(p_imageName, p_size);
+    }
+}
+
+void VTextEdit::addSharedImage(const QString &p_imageName,
+                               const QString &p_key,
+                               const QPixmap &p_image)
+{
+    if (m_blockImageEnabled) {
+        m_imageMgr->addSharedImage(p_imageName, p_key, p_image);
+    }
+}
+
+void VTextEdit::setImageMissingHandler(const std::function<void(const QString &)> &p_handler)
+{
+    m_imageMgr->setImageMissingHandler(p_handler);
+}
+
 void VTextEdit::removeImage(const QString &p_imageName)
 {
     m_imageMgr->removeImage(p_imageName);
@@ -464,6 +482,41 @@ void VTextEdit::updateLineNumberAreaWidth(const QFontMetrics &p_metrics)
     updateLineNumberAreaMargin();
 }
 
+void VTextEdit::paintEvent(QPaintEvent *p_event)
+{
+    QTextEdit::paintEvent(p_event);
+
+    // Blocks are laid out once painted.
+    updateVisibleImages();
+}
+
+void VTextEdit::hideEvent(QHideEvent *p_event)
+{
+    QTextEdit::hideEvent(p_event);
+
+    m_imageMgr->setVisibleImages(QSet<QString>());
+}
+
+void VTextEdit::updateVisibleImages()
+{
+    QSet<QString> names;
+    int first, last;
+    visibleBlockRange(first, last);
+    if (first > -1) {
+        QTextBlock block = document()->findBlockByNumber(first);
+        while (block.isValid() && block.blockNumber() <= last) {
+            const BlockLayoutInfo *info = VTextBlockData::layoutInfo(block);
+            for (const auto &img : info->m_images) {
+                names.insert(img.m_name);
+            }
+
+            block = block.next();
+        }
+    }
+
+    m_imageMgr->setVisibleImages(names);
+}
+
 void VTextEdit::dragMoveEvent(QDragMoveEvent *p_event)
 {
     QTextEdit::dragMoveEvent(p_event);
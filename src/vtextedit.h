@@ -1,6 +1,8 @@
 #ifndef VTEXTEDIT_H
 #define VTEXTEDIT_H
 
+#include <functional>
+
 #include <QTextEdit>
 #include <QTextBlock>
 
@@ -50,11 +52,23 @@ public:
     QSize imageSize(const QString &p_imageName) const;
 
     // Get the image from the resource manager.
-    const QPixmap *findImage(const QString &p_name) const;
+    QPixmap findImage(const QString &p_name) const;
 
     // Add an image to the resources.
     void addImage(const QString &p_imageName, const QPixmap &p_image);
 
+    // Add a placeholder for an image which is still loading.
+    void addImagePlaceholder(const QString &p_imageName, const QSize &p_size);
+
+    // Add an image kept in the preview image cache shared by all the editors.
+    void addSharedImage(const QString &p_imageName,
+                        const QString &p_key,
+                        const QPixmap &p_image);
+
+    // @p_handler will be called with the name of a shared image which is
+    // needed but has been evicted from the preview image cache.
+    void setImageMissingHandler(const std::function<void(const QString &)> &p_handler);
+
     // Remove an image from the resources.
     void removeImage(const QString &p_imageName);
 
@@ -80,9 +94,17 @@ public:
 
     void setEnableExtraBuffer(bool p_enable);
 
+    void setLazyLayoutBlockNumber(int p_number);
+
+    void setBlockTileCacheSize(int p_sizeKB);
+
 protected:
     void resizeEvent(QResizeEvent *p_event) Q_DECL_OVERRIDE;
 
+    void paintEvent(QPaintEvent *p_event) Q_DECL_OVERRIDE;
+
+    void hideEvent(QHideEvent *p_event) Q_DECL_OVERRIDE;
+
     // Return the Y offset of the content via the scrollbar.
     int contentOffsetY() const;
 
@@ -101,6 +123,9 @@ private slots:
 private:
     VTextDocumentLayout *getLayout() const;
 
+    // Let the resource manager pin the images of the visible blocks.
+    void updateVisibleImages();
+
     VLineNumberArea *m_lineNumberArea;
 
     LineNumberType m_lineNumberType;
@@ -146,4 +171,14 @@ inline void VTextEdit::setEnableExtraBuffer(bool p_enable)
     getLayout()->setExtraBufferHeight(m_enableExtraBuffer ? contentsRect().height() / 2
                                                           : 0);
 }
+
+inline void VTextEdit::setLazyLayoutBlockNumber(int p_number)
+{
+    getLayout()->setLazyLayoutBlockNumber(p_number);
+}
+
+inline void VTextEdit::setBlockTileCacheSize(int p_sizeKB)
+{
+    getLayout()->setBlockTileCacheSize(p_sizeKB);
+}
 #endif // VTEXTEDIT_H
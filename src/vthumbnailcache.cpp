@@ -0,0 +1,112 @@
+#include "vthumbnailcache.h"
+
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDebug>
+#include <QDir>
+#include <QFileInfo>
+#include <QSaveFile>
+
+#include "utils/vutils.h"
+
+QMutex VThumbnailCache::s_mutex;
+
+QString VThumbnailCache::s_folder;
+
+qint64 VThumbnailCache::s_capacity = 0;
+
+qint64 VThumbnailCache::s_size = -1;
+
+void VThumbnailCache::init(const QString &p_folder, qint64 p_capacity)
+{
+    QMutexLocker locker(&s_mutex);
+    if (s_folder != p_folder) {
+        s_folder = p_folder;
+        s_size = -1;
+    }
+
+    s_capacity = qMax(qint64(0), p_capacity);
+}
+
+QString VThumbnailCache::key(const QString &p_path,
+                             int p_width,
+                             int p_height,
+                             qreal p_scaleFactor,
+                             int p_maxWidth)
+{
+    QFileInfo info(p_path);
+    return QString("%1|%2|%3|%4x%5|%6|%7").arg(info.absoluteFilePath())
+                                          .arg(info.size())
+                                          .arg(info.lastModified().toMSecsSinceEpoch())
+                                          .arg(p_width)
+                                          .arg(p_height)
+                                          .arg(p_scaleFactor)
+                                          .arg(p_maxWidth);
+}
+
+QString VThumbnailCache::filePath(const QString &p_key)
+{
+    QByteArray hash = QCryptographicHash::hash(p_key.toUtf8(), QCryptographicHash::Sha1);
+    return QDir(s_folder).filePath(QString::fromLatin1(hash.toHex()) + ".png");
+}
+
+QImage VThumbnailCache::load(const QString &p_key)
+{
+    QString path;
+    {
+    QMutexLocker locker(&s_mutex);
+    if (s_capacity == 0 || s_folder.isEmpty()) {
+        return QImage();
+    }
+
+    path = filePath(p_key);
+    }
+
+    QImage image;
+    if (QFileInfo::exists(path)) {
+        image.load(path, "PNG");
+    }
+
+    return image;
+}
+
+void VThumbnailCache::save(const QString &p_key, const QImage &p_image)
+{
+    QString path;
+    {
+    QMutexLocker locker(&s_mutex);
+    if (s_capacity == 0 || s_folder.isEmpty() || p_image.isNull()) {
+        return;
+    }
+
+    path = filePath(p_key);
+    }
+
+    if (!QDir().mkpath(QFileInfo(path).absolutePath())) {
+        return;
+    }
+
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly)
+        || !p_image.save(&file, "PNG")
+        || !file.commit()) {
+        qWarning() << "fail to save preview thumbnail" << path;
+        return;
+    }
+
+    QMutexLocker locker(&s_mutex);
+    if (s_size >= 0) {
+        s_size += QFileInfo(path).size();
+    }
+
+    evict();
+}
+
+void VThumbnailCache::evict()
+{
+    if (s_size >= 0 && s_size <= s_capacity) {
+        return;
+    }
+
+    s_size = VUtils::evictFilesByTime(s_folder, "*.png", s_capacity);
+}
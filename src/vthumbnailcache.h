@@ -0,0 +1,51 @@
+#ifndef VTHUMBNAILCACHE_H
+#define VTHUMBNAILCACHE_H
+
+#include <QImage>
+#include <QMutex>
+#include <QString>
+
+// Disk cache of scaled preview images, so that reopening a note loads small
+// pre-scaled files instead of decoding the full-resolution originals.
+// Files are evicted from the oldest one once the budget is exceeded.
+// Could be used from any thread.
+class VThumbnailCache
+{
+public:
+    // Set the folder to store the files and the budget in bytes.
+    // 0 to disable the cache.
+    static void init(const QString &p_folder, qint64 p_capacity);
+
+    // Key of image file @p_path scaled to preview with the size in the link
+    // (@p_width and @p_height, -1 for not specified) and scale factor @p_scaleFactor,
+    // no wider than @p_maxWidth (0 for unlimited).
+    // The size and modification time of the file are part of the key.
+    static QString key(const QString &p_path,
+                       int p_width,
+                       int p_height,
+                       qreal p_scaleFactor,
+                       int p_maxWidth);
+
+    // Returns a null image if not found.
+    static QImage load(const QString &p_key);
+
+    static void save(const QString &p_key, const QImage &p_image);
+
+private:
+    static QString filePath(const QString &p_key);
+
+    // Remove the oldest files until the budget is met.
+    // Should be called with s_mutex locked.
+    static void evict();
+
+    static QMutex s_mutex;
+
+    static QString s_folder;
+
+    static qint64 s_capacity;
+
+    // Bytes of all the files. -1 if not counted yet.
+    static qint64 s_size;
+};
+
+#endif // VTHUMBNAILCACHE_H